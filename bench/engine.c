@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "libwfs.h"
+
+// Times the engine's calls in-process, without a mount in the way, on an image made by mkfs.wfs. The log is
+// first filled with small writes spread over a few files, so the calls run against a log of that length,
+// then the image is closed and opened again and each call is timed in turn, in nanoseconds per call
+
+#define LOG_FILES 256
+#define FILL_SIZE 64
+#define IO_SIZE 4096
+#define CALLS 10000
+
+struct wfs *fs;
+unsigned int log_dir;
+unsigned int files[LOG_FILES];
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void check(int result, const char *call)
+{
+    if (result < 0)
+    {
+        fprintf(stderr, "%s: %s\n", call, strerror(-result));
+        exit(EXIT_FAILURE);
+    }
+}
+
+void open_image(const char *disk_path)
+{
+    fs = wfs_open_image(disk_path);
+    if (fs == NULL)
+    {
+        perror(disk_path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Append entries small writes to the files of /log
+void fill_log(long entries)
+{
+    char name[32], data[FILL_SIZE];
+    struct stat st;
+
+    memset(data, 'f', FILL_SIZE);
+    check(wfs_create(fs, WFS_ROOT, "log", S_IFDIR, &st, 0), "create /log");
+    log_dir = WFS_INODE(st.st_ino);
+    for (int i = 0; i < LOG_FILES; i++)
+    {
+        snprintf(name, sizeof(name), "f%d", i);
+        check(wfs_create(fs, log_dir, name, S_IFREG, &st, 0), "create");
+    }
+
+    for (long k = 0; k < entries; k++)
+    {
+        snprintf(name, sizeof(name), "f%ld", k % LOG_FILES);
+        check(wfs_lookup(fs, log_dir, name, &st, 0), "lookup");
+        check(wfs_pwrite(fs, WFS_INODE(st.st_ino), data, FILL_SIZE, k / LOG_FILES * FILL_SIZE), "pwrite");
+        // each write an entry of its own rather than gathered with the file's next ones
+        check(wfs_flush(fs, WFS_INODE(st.st_ino)), "flush");
+    }
+}
+
+void find_files()
+{
+    char name[32];
+    struct stat st;
+
+    check(wfs_lookup(fs, WFS_ROOT, "log", &st, 0), "lookup /log");
+    log_dir = WFS_INODE(st.st_ino);
+    for (int i = 0; i < LOG_FILES; i++)
+    {
+        snprintf(name, sizeof(name), "f%d", i);
+        check(wfs_lookup(fs, log_dir, name, &st, 0), "lookup");
+        files[i] = WFS_INODE(st.st_ino);
+    }
+}
+
+int count_name(void *context, const char *name, const struct stat *stbuf, off_t next_offset)
+{
+    (*(long *)context)++;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <disk_path> <log_entries>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    const char *disk_path = argv[1];
+    long entries = atol(argv[2]);
+    char name[32], data[IO_SIZE];
+    struct stat st;
+    unsigned int made[CALLS];
+
+    // nothing but errors while timing
+    wfs_set_log_level(LEVEL_ERROR);
+    memset(data, 'w', IO_SIZE);
+
+    open_image(disk_path);
+    fill_log(entries);
+    wfs_close_image(fs);
+
+    double start = now();
+    open_image(disk_path);
+    double open_ms = (now() - start) * 1e3;
+    find_files();
+
+    start = now();
+    for (int i = 0; i < CALLS; i++)
+    {
+        snprintf(name, sizeof(name), "f%d", i % LOG_FILES);
+        check(wfs_lookup(fs, log_dir, name, &st, 0), "lookup");
+    }
+    double lookup_ns = (now() - start) * 1e9 / CALLS;
+
+    start = now();
+    for (int i = 0; i < CALLS; i++)
+        check(wfs_getattr(fs, files[i % LOG_FILES], &st), "getattr");
+    double getattr_ns = (now() - start) * 1e9 / CALLS;
+
+    // one new file per call, so the names grow as they would unpacking an archive
+    check(wfs_create(fs, WFS_ROOT, "new", S_IFDIR, &st, 0), "create /new");
+    unsigned int new_dir = WFS_INODE(st.st_ino);
+    start = now();
+    for (int i = 0; i < CALLS; i++)
+    {
+        snprintf(name, sizeof(name), "n%d", i);
+        check(wfs_create(fs, new_dir, name, S_IFREG, &st, 0), "create");
+        made[i] = WFS_INODE(st.st_ino);
+    }
+    double create_ns = (now() - start) * 1e9 / CALLS;
+
+    start = now();
+    for (int i = 0; i < CALLS; i++)
+        check(wfs_pwrite(fs, made[i], data, IO_SIZE, 0), "pwrite");
+    double pwrite_ns = (now() - start) * 1e9 / CALLS;
+
+    start = now();
+    for (int i = 0; i < CALLS; i++)
+        check(wfs_pread(fs, made[i], data, IO_SIZE, 0), "pread");
+    double pread_ns = (now() - start) * 1e9 / CALLS;
+
+    long listed = 0;
+    start = now();
+    check(wfs_readdir(fs, new_dir, 0, count_name, &listed), "readdir");
+    double readdir_ns = (now() - start) * 1e9 / listed;
+
+    start = now();
+    for (int i = 0; i < CALLS; i++)
+    {
+        snprintf(name, sizeof(name), "n%d", i);
+        check(wfs_unlink(fs, new_dir, name), "unlink");
+    }
+    double unlink_ns = (now() - start) * 1e9 / CALLS;
+
+    wfs_close_image(fs);
+
+    printf("%8ld log entries: open %8.2f ms, ns per call: lookup %6.0f getattr %6.0f create %6.0f pwrite %6.0f pread %6.0f readdir %6.0f unlink %6.0f\n",
+           entries, open_ms, lookup_ns, getattr_ns, create_ns, pwrite_ns, pread_ns, readdir_ns, unlink_ns);
+    return 0;
+}
@@ -0,0 +1,17 @@
+#!/bin/bash
+set -euo pipefail
+
+# Nanoseconds per call of the engine's lookup, getattr, create, pwrite, pread, readdir and unlink in-process,
+# without a mount, on images whose logs were filled to each length in ENTRIES, appended to bench_output.txt.
+# Usage: bench/engine.sh, run from the repository root after make bench
+
+ENTRIES=${ENTRIES:-1000 10000 100000}
+SIZE=${SIZE:-256M}
+
+echo "== libwfs" | tee -a bench_output.txt
+for entries in $ENTRIES; do
+    rm -f bench_disk
+    ./mkfs.wfs -s "$SIZE" bench_disk >/dev/null
+    ./bench/engine bench_disk "$entries" | tee -a bench_output.txt
+done
+rm -f bench_disk
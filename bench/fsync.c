@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+// Runs clients that each append a record to a file of their own and fsync it, the way a database commits
+// to its write-ahead log, against a mounted wfs for a number of seconds. Reports commits per second, the
+// commit latency percentiles and how many times the log was synced per commit, from the statistics file.
+// Run it at every durability= mode to compare them
+
+#define MAX_CLIENTS 256
+#define MAX_SAMPLES (1 << 20)
+
+struct client {
+    pthread_t thread;
+    int id;
+    double *latencies;
+    long count;
+};
+
+const char *mount_point;
+double duration;
+int record_size;
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void fail(const char *path)
+{
+    perror(path);
+    exit(EXIT_FAILURE);
+}
+
+void *allocate(size_t size)
+{
+    void *memory = malloc(size);
+    if (memory == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    return memory;
+}
+
+// Times the log was synced so far, from the statistics file
+unsigned long log_syncs()
+{
+    char path[256], line[256];
+    unsigned long syncs = 0;
+
+    snprintf(path, sizeof(path), "%s/.wfs_stats", mount_point);
+    FILE *stats = fopen(path, "r");
+    if (stats == NULL)
+        fail(path);
+
+    while (fgets(line, sizeof(line), stats) != NULL)
+        if (sscanf(line, "log_syncs %lu", &syncs) == 1)
+            break;
+    fclose(stats);
+
+    return syncs;
+}
+
+void *client_main(void *arg)
+{
+    struct client *client = arg;
+    char path[256];
+    char *record = allocate(record_size);
+
+    memset(record, 'a' + client->id % 26, record_size);
+    snprintf(path, sizeof(path), "%s/wal%d", mount_point, client->id);
+    int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd == -1)
+        fail(path);
+
+    double start = now();
+    while (now() - start < duration && client->count < MAX_SAMPLES)
+    {
+        double before = now();
+        if (write(fd, record, record_size) != record_size || fsync(fd) == -1)
+            fail(path);
+        client->latencies[client->count++] = now() - before;
+    }
+
+    close(fd);
+    if (unlink(path) == -1)
+        fail(path);
+    free(record);
+    return NULL;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double first = *(const double *)a, second = *(const double *)b;
+
+    return (first > second) - (first < second);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4 || argc > 5)
+    {
+        fprintf(stderr, "Usage: %s <mount_point> <seconds> <clients> [record_size]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    mount_point = argv[1];
+    duration = atof(argv[2]);
+    int client_count = atoi(argv[3]);
+    record_size = argc > 4 ? atoi(argv[4]) : 512;
+    if (client_count < 1 || client_count > MAX_CLIENTS || record_size < 1)
+    {
+        fprintf(stderr, "1 to %d clients and a record of a byte or more expected\n", MAX_CLIENTS);
+        exit(EXIT_FAILURE);
+    }
+
+    struct client clients[MAX_CLIENTS];
+    unsigned long syncs = log_syncs();
+
+    double start = now();
+    for (int i = 0; i < client_count; i++)
+    {
+        clients[i] = (struct client){.id = i, .latencies = allocate(MAX_SAMPLES * sizeof(double))};
+        if (pthread_create(&clients[i].thread, NULL, client_main, &clients[i]) != 0)
+        {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < client_count; i++)
+        pthread_join(clients[i].thread, NULL);
+    double elapsed = now() - start;
+    syncs = log_syncs() - syncs;
+
+    long commits = 0;
+    for (int i = 0; i < client_count; i++)
+        commits += clients[i].count;
+    double *latencies = allocate(commits * sizeof(double));
+    long count = 0;
+    for (int i = 0; i < client_count; i++)
+    {
+        memcpy(latencies + count, clients[i].latencies, clients[i].count * sizeof(double));
+        count += clients[i].count;
+        free(clients[i].latencies);
+    }
+    qsort(latencies, count, sizeof(double), compare_doubles);
+
+    printf("%3d clients, %5d byte records: %8ld commits, %9.0f commits/s, p50 %8.1f us, p99 %8.1f us, %5.3f log syncs per commit\n",
+           client_count, record_size, commits, commits / elapsed, latencies[count * 500 / 1000] * 1e6,
+           latencies[count * 990 / 1000] * 1e6, (double)syncs / commits);
+
+    free(latencies);
+    return 0;
+}
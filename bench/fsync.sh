@@ -0,0 +1,36 @@
+#!/bin/bash
+set -euo pipefail
+
+# Append and fsync commits from 1, 4 and 16 clients with mount.wfs at every durability mode, periodic syncing
+# every INTERVAL milliseconds, appended to bench_output.txt. See bench/fsync.c
+# Usage: bench/fsync.sh [seconds] [record_size], run from the repository root after make bench
+
+SECONDS_PER_RUN=${1:-2}
+RECORD_SIZE=${2:-512}
+CLIENTS=${CLIENTS:-1 4 16}
+INTERVAL=${INTERVAL:-100}
+SIZE=${SIZE:-1G}
+
+mkdir -p mnt
+for mode in none periodic fsync; do
+    options="durability=$mode"
+    label=$options
+    if [ "$mode" = periodic ]; then
+        options="$options,sync_interval=$INTERVAL"
+        label="$label every $INTERVAL ms"
+    fi
+
+    rm -f bench_disk
+    ./mkfs.wfs -s "$SIZE" bench_disk >/dev/null
+    ./mount.wfs -o "$options" bench_disk mnt >/dev/null
+
+    for clients in $CLIENTS; do
+        {
+            echo "== $label"
+            ./bench/fsync mnt "$SECONDS_PER_RUN" "$clients" "$RECORD_SIZE"
+        } | tee -a bench_output.txt
+    done
+
+    fusermount -u mnt
+done
+rm -f bench_disk
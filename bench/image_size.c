@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Times path lookups and appends on a mounted wfs, so runs on images of different sizes can be compared
+
+#define APPEND_SIZE 4096
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 4)
+    {
+        fprintf(stderr, "Usage: %s <mount_point> [files] [appends]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    const char *mount_point = argv[1];
+    int files = argc > 2 ? atoi(argv[2]) : 1000;
+    int appends = argc > 3 ? atoi(argv[3]) : 10000;
+    char path[256];
+    struct stat st;
+
+    for (int i = 0; i < files; i++)
+    {
+        snprintf(path, sizeof(path), "%s/f%d", mount_point, i);
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd == -1)
+        {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+    }
+
+    // every file a few times over, so later rounds measure cached lookups
+    int lookups = 0;
+    double start = now();
+    for (int round = 0; round < 10; round++)
+    {
+        for (int i = 0; i < files; i++, lookups++)
+        {
+            snprintf(path, sizeof(path), "%s/f%d", mount_point, i);
+            if (stat(path, &st) == -1)
+            {
+                perror(path);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    double lookup_time = now() - start;
+
+    char *data = malloc(APPEND_SIZE);
+    if (data == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    memset(data, 'x', APPEND_SIZE);
+
+    // appends spread over the files, each one a new extent entry at the head of the log
+    start = now();
+    for (int i = 0; i < appends; i++)
+    {
+        snprintf(path, sizeof(path), "%s/f%d", mount_point, i % files);
+        int fd = open(path, O_WRONLY | O_APPEND);
+        if (fd == -1 || write(fd, data, APPEND_SIZE) != APPEND_SIZE)
+        {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+    }
+    double append_time = now() - start;
+
+    printf("lookup: %d in %.3f s, %.1f us/op\n", lookups, lookup_time, lookup_time * 1e6 / lookups);
+    printf("append: %d x %d bytes in %.3f s, %.1f us/op, %.1f MB/s\n", appends, APPEND_SIZE, append_time,
+           append_time * 1e6 / appends, (double)appends * APPEND_SIZE / append_time / (1024 * 1024));
+
+    free(data);
+    return 0;
+}
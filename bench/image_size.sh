@@ -0,0 +1,28 @@
+#!/bin/bash
+set -euo pipefail
+
+# Lookup and append cost on sparse images of growing size, appended to bench_output.txt.
+# Usage: bench/image_size.sh [sizes...], run from the repository root after make bench
+
+SIZES=${@:-1G 10G 100G}
+FILES=${FILES:-1000}
+APPENDS=${APPENDS:-10000}
+
+mkdir -p mnt
+for size in $SIZES; do
+    rm -f bench_disk
+    ./mkfs.wfs -s "$size" bench_disk >/dev/null
+
+    # mount replays the log and reads every segment header
+    start=$(date +%s%N)
+    ./mount.wfs -s bench_disk mnt >/dev/null
+    mounted=$(date +%s%N)
+
+    {
+        echo "== $size image, mount took $(( (mounted - start) / 1000000 )) ms"
+        ./bench/image_size mnt "$FILES" "$APPENDS"
+    } | tee -a bench_output.txt
+
+    fusermount -u mnt
+done
+rm -f bench_disk
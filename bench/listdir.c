@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Times what ls -l does -- list a directory and stat every name in it -- on a mounted wfs, for directories
+// of growing size. Each pass waits out the kernel's attribute cache first, so every name goes to mount.wfs
+
+#define PASSES 3
+// mount.wfs lets the kernel cache names and attributes for a second
+#define CACHE_TIMEOUT_US 1100000
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void fill_directory(const char *dir_path, int count)
+{
+    char path[512];
+
+    if (mkdir(dir_path, 0755) == -1)
+    {
+        perror(dir_path);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(path, sizeof(path), "%s/entry%d", dir_path, i);
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd == -1)
+        {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+    }
+}
+
+// List a directory and stat each name, returns how many names it found
+int list_long(const char *dir_path)
+{
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL)
+    {
+        perror(dir_path);
+        exit(EXIT_FAILURE);
+    }
+
+    struct dirent *dentry;
+    struct stat stbuf;
+    int found = 0;
+    while ((dentry = readdir(dir)) != NULL)
+    {
+        if (strcmp(dentry->d_name, ".") == 0 || strcmp(dentry->d_name, "..") == 0)
+            continue;
+        if (fstatat(dirfd(dir), dentry->d_name, &stbuf, AT_SYMLINK_NOFOLLOW) == -1)
+        {
+            perror(dentry->d_name);
+            exit(EXIT_FAILURE);
+        }
+        found++;
+    }
+    closedir(dir);
+
+    return found;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <mount_point> [entries...]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    const char *mount_point = argv[1];
+    int default_counts[] = {1000, 10000, 100000};
+    int size_count = argc > 2 ? argc - 2 : 3;
+
+    for (int i = 0; i < size_count; i++)
+    {
+        int count = argc > 2 ? atoi(argv[i + 2]) : default_counts[i];
+        char dir_path[256];
+
+        snprintf(dir_path, sizeof(dir_path), "%s/dir%d", mount_point, count);
+        fill_directory(dir_path, count);
+
+        double best = 0, total = 0;
+        for (int pass = 0; pass < PASSES; pass++)
+        {
+            usleep(CACHE_TIMEOUT_US);
+
+            double start = now();
+            int found = list_long(dir_path);
+            double elapsed = now() - start;
+
+            if (found != count)
+            {
+                fprintf(stderr, "%s: listed %d names, expected %d\n", dir_path, found, count);
+                exit(EXIT_FAILURE);
+            }
+            if (pass == 0 || elapsed < best)
+                best = elapsed;
+            total += elapsed;
+        }
+
+        printf("%7d entries: ls -l best %9.2f ms, mean %9.2f ms, %6.2f us per entry\n", count, best * 1000,
+               total / PASSES * 1000, best / count * 1e6);
+        fflush(stdout);
+    }
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Runs concurrent clients against a mounted wfs, each one creating, writing, stating, reading back and
+// unlinking small files of its own, and reports the operations per second. Every operation logs on the
+// way through mount.wfs, so running it with and without tracing shows what the logging costs
+
+#define IO_SIZE 4096
+#define MAX_CLIENTS 32
+
+struct client {
+    pthread_t thread;
+    int id;
+    double duration;
+    long ops;
+};
+
+const char *mount_point;
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void fail(const char *path)
+{
+    perror(path);
+    exit(EXIT_FAILURE);
+}
+
+void *client_main(void *arg)
+{
+    struct client *client = arg;
+    char path[256];
+    char data[IO_SIZE];
+    struct stat st;
+
+    memset(data, 'a' + client->id % 26, IO_SIZE);
+
+    double start = now();
+    for (long round = 0; now() - start < client->duration; round++)
+    {
+        snprintf(path, sizeof(path), "%s/c%d_%ld", mount_point, client->id, round);
+
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd == -1 || write(fd, data, IO_SIZE) != IO_SIZE)
+            fail(path);
+        close(fd);
+
+        if (stat(path, &st) == -1)
+            fail(path);
+
+        fd = open(path, O_RDONLY);
+        if (fd == -1 || read(fd, data, IO_SIZE) != IO_SIZE)
+            fail(path);
+        close(fd);
+
+        if (unlink(path) == -1)
+            fail(path);
+
+        // create and write, stat, open and read, unlink
+        client->ops += 4;
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 4)
+    {
+        fprintf(stderr, "Usage: %s <mount_point> [seconds] [clients]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    mount_point = argv[1];
+    double duration = argc > 2 ? atof(argv[2]) : 2;
+    int client_count = argc > 3 ? atoi(argv[3]) : 4;
+    if (client_count < 1 || client_count > MAX_CLIENTS)
+    {
+        fprintf(stderr, "clients must be 1 to %d\n", MAX_CLIENTS);
+        exit(EXIT_FAILURE);
+    }
+
+    struct client clients[MAX_CLIENTS];
+    for (int i = 0; i < client_count; i++)
+        clients[i] = (struct client){.id = i, .duration = duration};
+
+    double start = now();
+    for (int i = 0; i < client_count; i++)
+        pthread_create(&clients[i].thread, NULL, client_main, &clients[i]);
+    long ops = 0;
+    for (int i = 0; i < client_count; i++)
+    {
+        pthread_join(clients[i].thread, NULL);
+        ops += clients[i].ops;
+    }
+    double elapsed = now() - start;
+
+    printf("%2d clients: %9.0f ops/s\n", client_count, ops / elapsed);
+    return 0;
+}
@@ -0,0 +1,39 @@
+#!/bin/bash
+set -euo pipefail
+
+# Throughput of small-file operations with the given mount.wfs binaries (./mount.wfs by default) running in
+# the foreground, their messages going to a file, at every log level in LEVELS, appended to bench_output.txt.
+# LEVELS=default runs a binary without -o loglevel, e.g. one built before the logger was added:
+#   LEVELS=default bench/logging.sh ./mount.wfs.old && bench/logging.sh
+# Usage: bench/logging.sh [mount.wfs binaries...], run from the repository root after make bench
+
+BINARIES=${@:-./mount.wfs}
+LEVELS=${LEVELS:-info debug trace}
+SECONDS_PER_RUN=${SECONDS_PER_RUN:-5}
+CLIENTS=${CLIENTS:-4}
+SIZE=${SIZE:-1G}
+
+mkdir -p mnt
+for binary in $BINARIES; do
+    for level in $LEVELS; do
+        options=()
+        [ "$level" != default ] && options=(-o "loglevel=$level")
+
+        rm -f bench_disk bench_log
+        ./mkfs.wfs -s "$SIZE" bench_disk >/dev/null
+        "$binary" -f "${options[@]}" bench_disk mnt >bench_log &
+        while ! mountpoint -q mnt; do
+            sleep 0.1
+        done
+
+        {
+            echo "== $binary, log level $level"
+            ./bench/logging mnt "$SECONDS_PER_RUN" "$CLIENTS"
+        } | tee -a bench_output.txt
+
+        fusermount -u mnt
+        wait
+        echo "   $(wc -c <bench_log) bytes logged" | tee -a bench_output.txt
+    done
+done
+rm -f bench_disk bench_log
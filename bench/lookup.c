@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Times name lookups on a mounted wfs -- stat of names a directory holds and of names it doesn't -- for
+// directories of growing size, in random order. Each pass of present names waits out the kernel's caches
+// first, missing names are never asked for twice, so every lookup goes to mount.wfs
+
+#define PASSES 3
+#define LOOKUPS 20000
+// mount.wfs lets the kernel cache names and attributes for a second
+#define CACHE_TIMEOUT_US 1100000
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void fill_directory(const char *dir_path, int count)
+{
+    char path[512];
+
+    if (mkdir(dir_path, 0755) == -1)
+    {
+        perror(dir_path);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(path, sizeof(path), "%s/entry%d", dir_path, i);
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd == -1)
+        {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+    }
+}
+
+// Stat random names of a directory, present ones or missing ones, returns the time taken
+double lookup_names(int dir_fd, int count, int missing, unsigned int *seed, int *next_missing)
+{
+    char name[64];
+    struct stat stbuf;
+
+    double start = now();
+    for (int i = 0; i < LOOKUPS; i++)
+    {
+        if (missing)
+            snprintf(name, sizeof(name), "missing%d", (*next_missing)++);
+        else
+            snprintf(name, sizeof(name), "entry%d", rand_r(seed) % count);
+
+        int found = fstatat(dir_fd, name, &stbuf, AT_SYMLINK_NOFOLLOW) == 0;
+        if (found == missing || (!found && errno != ENOENT))
+        {
+            fprintf(stderr, "%s: %s\n", name, found ? "found" : strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return now() - start;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <mount_point> [entries...]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    const char *mount_point = argv[1];
+    int default_counts[] = {1000, 10000, 100000};
+    int size_count = argc > 2 ? argc - 2 : 3;
+    unsigned int seed = 1;
+    int next_missing = 0;
+
+    for (int i = 0; i < size_count; i++)
+    {
+        int count = argc > 2 ? atoi(argv[i + 2]) : default_counts[i];
+        char dir_path[256];
+
+        snprintf(dir_path, sizeof(dir_path), "%s/dir%d", mount_point, count);
+        fill_directory(dir_path, count);
+        int dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+        if (dir_fd == -1)
+        {
+            perror(dir_path);
+            exit(EXIT_FAILURE);
+        }
+
+        for (int missing = 0; missing < 2; missing++)
+        {
+            double best = 0;
+            for (int pass = 0; pass < PASSES; pass++)
+            {
+                if (!missing)
+                    usleep(CACHE_TIMEOUT_US);
+
+                double elapsed = lookup_names(dir_fd, count, missing, &seed, &next_missing);
+                if (pass == 0 || elapsed < best)
+                    best = elapsed;
+            }
+
+            printf("%7d entries: %s names %7.2f us per lookup\n", count, missing ? "missing" : "present",
+                   best / LOOKUPS * 1e6);
+            fflush(stdout);
+        }
+        close(dir_fd);
+    }
+
+    return 0;
+}
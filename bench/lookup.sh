@@ -0,0 +1,25 @@
+#!/bin/bash
+set -euo pipefail
+
+# Latency of looking up present and missing names in directories of growing size with the given mount.wfs
+# binaries (./mount.wfs by default), e.g. one built before a change and one after, appended to bench_output.txt.
+# Usage: bench/lookup.sh [mount.wfs binaries...], run from the repository root after make bench
+
+BINARIES=${@:-./mount.wfs}
+ENTRIES=${ENTRIES:-1000 10000 100000}
+SIZE=${SIZE:-1G}
+
+mkdir -p mnt
+for binary in $BINARIES; do
+    rm -f bench_disk
+    ./mkfs.wfs -s "$SIZE" bench_disk >/dev/null
+    "$binary" bench_disk mnt >/dev/null
+
+    {
+        echo "== $binary"
+        ./bench/lookup mnt $ENTRIES
+    } | tee -a bench_output.txt
+
+    fusermount -u mnt
+done
+rm -f bench_disk
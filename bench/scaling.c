@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Runs 1 to 32 concurrent clients against a mounted wfs, each one mixing stats, reads and writes on its
+// own files and stats of the others', and reports the throughput and the stat latency at every count
+
+#define IO_SIZE 4096
+#define FILE_SIZE (64 * 1024)
+#define FILES_PER_CLIENT 4
+#define MAX_CLIENTS 32
+#define MAX_SAMPLES (1 << 20)
+
+// Percentages of stats and reads, the rest are writes
+struct mix {
+    const char *name;
+    int stat;
+    int read;
+};
+
+struct mix mixes[] = {
+    {"read-mostly", 70, 25},
+    {"write-heavy", 40, 20},
+};
+
+struct client {
+    pthread_t thread;
+    int id;
+    int client_count;
+    struct mix *mix;
+    double duration;
+    long ops;
+    double *stat_latencies;
+    long stat_count;
+};
+
+const char *mount_point;
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void file_path(char *path, size_t size, int client, int file)
+{
+    snprintf(path, size, "%s/c%d_%d", mount_point, client, file);
+}
+
+void *client_main(void *arg)
+{
+    struct client *client = arg;
+    unsigned int seed = client->id + 1;
+    char path[256];
+    char data[IO_SIZE];
+    struct stat st;
+
+    memset(data, 'a' + client->id % 26, IO_SIZE);
+
+    double start = now();
+    while (now() - start < client->duration)
+    {
+        int kind = rand_r(&seed) % 100;
+        off_t offset = (rand_r(&seed) % (FILE_SIZE / IO_SIZE)) * IO_SIZE;
+
+        if (kind < client->mix->stat)
+        {
+            // half the stats look at files other clients are writing
+            int other = rand_r(&seed) % 2 ? rand_r(&seed) % client->client_count : client->id;
+            file_path(path, sizeof(path), other, rand_r(&seed) % FILES_PER_CLIENT);
+
+            double before = now();
+            if (stat(path, &st) == -1)
+            {
+                perror(path);
+                exit(EXIT_FAILURE);
+            }
+            if (client->stat_count < MAX_SAMPLES)
+                client->stat_latencies[client->stat_count++] = now() - before;
+        }
+        else
+        {
+            int write_op = kind >= client->mix->stat + client->mix->read;
+            file_path(path, sizeof(path), client->id, rand_r(&seed) % FILES_PER_CLIENT);
+
+            int fd = open(path, write_op ? O_WRONLY : O_RDONLY);
+            if (fd == -1 || (write_op ? pwrite(fd, data, IO_SIZE, offset) : pread(fd, data, IO_SIZE, offset)) != IO_SIZE)
+            {
+                perror(path);
+                exit(EXIT_FAILURE);
+            }
+            close(fd);
+        }
+        client->ops++;
+    }
+
+    return NULL;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double first = *(const double *)a, second = *(const double *)b;
+
+    return (first > second) - (first < second);
+}
+
+// Give every client its files, filled so reads anywhere in them hit data
+void create_files(int client_count)
+{
+    char path[256];
+    char *data = malloc(FILE_SIZE);
+    if (data == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    memset(data, 'x', FILE_SIZE);
+
+    for (int client = 0; client < client_count; client++)
+    {
+        for (int file = 0; file < FILES_PER_CLIENT; file++)
+        {
+            file_path(path, sizeof(path), client, file);
+            int fd = open(path, O_CREAT | O_WRONLY, 0644);
+            if (fd == -1 || write(fd, data, FILE_SIZE) != FILE_SIZE)
+            {
+                perror(path);
+                exit(EXIT_FAILURE);
+            }
+            close(fd);
+        }
+    }
+
+    free(data);
+}
+
+void run(struct mix *mix, int client_count, double duration)
+{
+    struct client clients[MAX_CLIENTS];
+
+    for (int i = 0; i < client_count; i++)
+    {
+        clients[i] = (struct client){.id = i, .client_count = client_count, .mix = mix, .duration = duration};
+        clients[i].stat_latencies = malloc(MAX_SAMPLES * sizeof(double));
+        if (clients[i].stat_latencies == NULL)
+        {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    double start = now();
+    for (int i = 0; i < client_count; i++)
+        pthread_create(&clients[i].thread, NULL, client_main, &clients[i]);
+    for (int i = 0; i < client_count; i++)
+        pthread_join(clients[i].thread, NULL);
+    double elapsed = now() - start;
+
+    // pool the stat latencies of all clients for the percentiles
+    long ops = 0, stat_count = 0;
+    for (int i = 0; i < client_count; i++)
+    {
+        ops += clients[i].ops;
+        stat_count += clients[i].stat_count;
+    }
+
+    double *latencies = malloc((stat_count + 1) * sizeof(double));
+    if (latencies == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    long count = 0;
+    for (int i = 0; i < client_count; i++)
+    {
+        memcpy(latencies + count, clients[i].stat_latencies, clients[i].stat_count * sizeof(double));
+        count += clients[i].stat_count;
+        free(clients[i].stat_latencies);
+    }
+    qsort(latencies, count, sizeof(double), compare_doubles);
+
+    printf("%-12s %2d clients: %9.0f ops/s, stat p50 %7.1f us, p99 %7.1f us\n", mix->name, client_count, ops / elapsed,
+           count > 0 ? latencies[count / 2] * 1e6 : 0, count > 0 ? latencies[count * 99 / 100] * 1e6 : 0);
+    fflush(stdout);
+
+    free(latencies);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 4)
+    {
+        fprintf(stderr, "Usage: %s <mount_point> [seconds] [max_clients]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    mount_point = argv[1];
+    double duration = argc > 2 ? atof(argv[2]) : 2;
+    int max_clients = argc > 3 ? atoi(argv[3]) : MAX_CLIENTS;
+    if (max_clients < 1 || max_clients > MAX_CLIENTS)
+    {
+        fprintf(stderr, "max_clients must be between 1 and %d\n", MAX_CLIENTS);
+        exit(EXIT_FAILURE);
+    }
+
+    create_files(max_clients);
+
+    for (unsigned int m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++)
+    {
+        for (int client_count = 1; client_count <= max_clients; client_count *= 2)
+            run(&mixes[m], client_count, duration);
+    }
+
+    return 0;
+}
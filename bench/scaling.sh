@@ -0,0 +1,26 @@
+#!/bin/bash
+set -euo pipefail
+
+# Throughput and stat latency of 1-32 concurrent clients, with FUSE serializing requests (-s) and without,
+# appended to bench_output.txt.
+# Usage: bench/scaling.sh [seconds] [max_clients], run from the repository root after make bench
+
+SECONDS_PER_RUN=${1:-2}
+MAX_CLIENTS=${2:-32}
+SIZE=${SIZE:-10G}
+
+mkdir -p mnt
+for threading in -s ""; do
+    rm -f bench_disk
+    ./mkfs.wfs -s "$SIZE" bench_disk >/dev/null
+    ./mount.wfs $threading bench_disk mnt >/dev/null
+
+    {
+        label=${threading:+serialized (-s)}
+        echo "== ${label:-multi-threaded} mount, $SIZE image"
+        ./bench/scaling mnt "$SECONDS_PER_RUN" "$MAX_CLIENTS"
+    } | tee -a bench_output.txt
+
+    fusermount -u mnt
+done
+rm -f bench_disk
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// Reads large files on a mounted wfs sequentially and reports the throughput and the CPU time spent per GB,
+// by mount.wfs (given its pid) and by this process. One file is written in large chunks, so reads mostly
+// fall within one extent, the other in small ones, so every read spans many extents
+
+#define READ_SIZE (128 * 1024)
+#define SMALL_WRITE 4096
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// CPU seconds a process has used, from /proc, 0 if it can't be read
+double process_cpu(int pid)
+{
+    char path[64];
+    unsigned long utime, stime;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *stat_file = fopen(path, "r");
+    if (stat_file == NULL)
+        return 0;
+
+    // utime and stime are the 14th and 15th fields, past the parenthesized command name
+    int found = fscanf(stat_file, "%*d (%*[^)]) %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2;
+    fclose(stat_file);
+
+    return found ? (double)(utime + stime) / sysconf(_SC_CLK_TCK) : 0;
+}
+
+double own_cpu()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+void write_file(const char *path, size_t file_size, size_t chunk)
+{
+    char *data = malloc(chunk);
+    if (data == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    memset(data, 'x', chunk);
+
+    int fd = open(path, O_CREAT | O_WRONLY, 0644);
+    if (fd == -1)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t written = 0; written < file_size; written += chunk)
+    {
+        if (write(fd, data, chunk) != (ssize_t)chunk)
+        {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    close(fd);
+    free(data);
+}
+
+void read_file(const char *name, const char *path, size_t file_size, int passes, int daemon_pid)
+{
+    char *buf = malloc(READ_SIZE);
+    if (buf == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    double elapsed = 0, daemon_cpu = 0, client_cpu = 0;
+    for (int pass = 0; pass < passes; pass++)
+    {
+        int fd = open(path, O_RDONLY);
+        if (fd == -1)
+        {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+
+        // every pass has to go to mount.wfs rather than the page cache
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+        double start = now(), daemon_start = process_cpu(daemon_pid), client_start = own_cpu();
+        ssize_t got;
+        size_t total = 0;
+        while ((got = read(fd, buf, READ_SIZE)) > 0)
+            total += got;
+        elapsed += now() - start;
+        daemon_cpu += process_cpu(daemon_pid) - daemon_start;
+        client_cpu += own_cpu() - client_start;
+
+        if (got == -1 || total != file_size)
+        {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+    }
+
+    double gigabytes = (double)file_size * passes / (1 << 30);
+    printf("%-10s %8.0f MB/s, mount.wfs %6.2f s CPU/GB, reader %6.2f s CPU/GB\n", name,
+           gigabytes * 1024 / elapsed, daemon_pid > 0 ? daemon_cpu / gigabytes : 0, client_cpu / gigabytes);
+    fflush(stdout);
+
+    free(buf);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 5)
+    {
+        fprintf(stderr, "Usage: %s <mount_point> [file_mb] [passes] [mount_pid]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    const char *mount_point = argv[1];
+    size_t file_size = (size_t)(argc > 2 ? atoi(argv[2]) : 256) << 20;
+    int passes = argc > 3 ? atoi(argv[3]) : 4;
+    int daemon_pid = argc > 4 ? atoi(argv[4]) : 0;
+    char large[256], small[256];
+
+    snprintf(large, sizeof(large), "%s/large_writes", mount_point);
+    snprintf(small, sizeof(small), "%s/small_writes", mount_point);
+    write_file(large, file_size, READ_SIZE);
+    write_file(small, file_size, SMALL_WRITE);
+
+    read_file("contiguous", large, file_size, passes, daemon_pid);
+    read_file("fragmented", small, file_size, passes, daemon_pid);
+
+    return 0;
+}
@@ -0,0 +1,27 @@
+#!/bin/bash
+set -euo pipefail
+
+# Large sequential read throughput and CPU per GB of the given mount.wfs binaries (./mount.wfs by default),
+# e.g. one built before a change and one after, appended to bench_output.txt.
+# Usage: bench/seqread.sh [mount.wfs binaries...], run from the repository root after make bench
+
+BINARIES=${@:-./mount.wfs}
+FILE_MB=${FILE_MB:-256}
+PASSES=${PASSES:-4}
+SIZE=${SIZE:-4G}
+
+mkdir -p mnt
+for binary in $BINARIES; do
+    rm -f bench_disk
+    ./mkfs.wfs -s "$SIZE" bench_disk >/dev/null
+    "$binary" bench_disk mnt >/dev/null
+    pid=$(pgrep -n -f "bench_disk mnt")
+
+    {
+        echo "== $binary, $FILE_MB MB files, $PASSES passes"
+        ./bench/seqread mnt "$FILE_MB" "$PASSES" "$pid"
+    } | tee -a bench_output.txt
+
+    fusermount -u mnt
+done
+rm -f bench_disk
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+// Writes a file on a mounted wfs in small write calls, each one a separate request to mount.wfs, and reports
+// how fast they go and how many bytes the log grew by per byte written, from the statistics file:
+//   append     every write carries on from the last one
+//   overlap    every write starts half way into the last one
+// Each phase ends with the file closed, so whatever mount.wfs held back is in the log by then
+
+#define APPEND_BYTES (16L * 1024 * 1024)
+#define OVERLAP_BYTES (4L * 1024 * 1024)
+
+const char *mount_point;
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void fail(const char *path)
+{
+    perror(path);
+    exit(EXIT_FAILURE);
+}
+
+// Bytes appended to the log so far, from the statistics file
+unsigned long log_bytes_appended()
+{
+    char path[256], line[256];
+    unsigned long appended = 0;
+
+    snprintf(path, sizeof(path), "%s/.wfs_stats", mount_point);
+    FILE *stats = fopen(path, "r");
+    if (stats == NULL)
+        fail(path);
+
+    while (fgets(line, sizeof(line), stats) != NULL)
+        if (sscanf(line, "log_bytes_appended %lu", &appended) == 1)
+            break;
+    fclose(stats);
+
+    return appended;
+}
+
+// Write bytes to a new file in size-byte writes, each at offset step bytes past the last one
+void phase(const char *name, const char *data, int size, int step, long bytes)
+{
+    char path[256];
+    long writes = bytes / size;
+
+    snprintf(path, sizeof(path), "%s/%s", mount_point, name);
+    unsigned long appended = log_bytes_appended();
+
+    double start = now();
+    int fd = open(path, O_CREAT | O_WRONLY, 0644);
+    if (fd == -1)
+        fail(path);
+    for (long i = 0; i < writes; i++)
+        if (pwrite(fd, data, size, i * step) != size)
+            fail(path);
+    if (close(fd) == -1)
+        fail(path);
+    double elapsed = now() - start;
+
+    appended = log_bytes_appended() - appended;
+    printf("%-8s %8ld writes of %5d bytes in %8.1f ms, %9.0f writes/s, %6.3f log bytes per byte written\n",
+           name, writes, size, elapsed * 1000, writes / elapsed, (double)appended / (writes * size));
+    fflush(stdout);
+
+    if (unlink(path) == -1)
+        fail(path);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "Usage: %s <mount_point> [write_size]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    mount_point = argv[1];
+    int size = argc > 2 ? atoi(argv[2]) : 128;
+    if (size < 2)
+    {
+        fprintf(stderr, "Write size %s is too small\n", argv[2]);
+        exit(EXIT_FAILURE);
+    }
+
+    char *data = malloc(size);
+    if (data == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    memset(data, 'w', size);
+
+    phase("append", data, size, size, APPEND_BYTES);
+    phase("overlap", data, size, size / 2, OVERLAP_BYTES);
+
+    free(data);
+    return 0;
+}
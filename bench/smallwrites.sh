@@ -0,0 +1,27 @@
+#!/bin/bash
+set -euo pipefail
+
+# Small writes with the given mount.wfs binaries (./mount.wfs by default), e.g. one built before a change and
+# one after, at every write size in SIZES, appended to bench_output.txt. See bench/smallwrites.c
+# Usage: bench/smallwrites.sh [mount.wfs binaries...], run from the repository root after make bench
+
+BINARIES=${@:-./mount.wfs}
+SIZES=${SIZES:-64 512 4096}
+SIZE=${SIZE:-1G}
+
+mkdir -p mnt
+for binary in $BINARIES; do
+    rm -f bench_disk
+    ./mkfs.wfs -s "$SIZE" bench_disk >/dev/null
+    "$binary" bench_disk mnt >/dev/null
+
+    for size in $SIZES; do
+        {
+            echo "== $binary, $size byte writes"
+            ./bench/smallwrites mnt "$size"
+        } | tee -a bench_output.txt
+    done
+
+    fusermount -u mnt
+done
+rm -f bench_disk
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "libwfs.h"
+
+// Compares the storage backends in-process on an image made by mkfs.wfs. The log is filled with files
+// written 256 KB at a time in turn, so each is scattered over the log in extents of that size, and synced.
+// Then, for every thread count, the image is dropped from the page cache and threads read random 1 MB
+// ranges of the files, a handful of extents each, for a number of seconds -- with an image larger than
+// memory, most of them from the disk however long it runs
+
+#define FILES 64
+#define WRITE_SIZE (256 * 1024)
+#define READ_SIZE (1024 * 1024)
+#define MAX_THREADS 256
+#define MAX_SAMPLES (1 << 20)
+
+struct reader {
+    pthread_t thread;
+    unsigned int seed;
+    double *latencies;
+    long count;
+};
+
+struct wfs *fs;
+const char *disk_path;
+int storage;
+unsigned int files[FILES];
+size_t file_size;
+double duration;
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void check(long result, const char *call)
+{
+    if (result < 0)
+    {
+        fprintf(stderr, "%s: %s\n", call, strerror(-result));
+        exit(EXIT_FAILURE);
+    }
+}
+
+void *allocate(size_t size)
+{
+    void *memory = malloc(size);
+    if (memory == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    return memory;
+}
+
+void open_image()
+{
+    fs = wfs_open_image(disk_path);
+    if (fs == NULL)
+    {
+        perror(disk_path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Write fill bytes over the files in turn and sync them, returns MB/s
+double fill_log(size_t fill)
+{
+    char name[32];
+    char *data = allocate(WRITE_SIZE);
+    struct stat st;
+
+    memset(data, 'f', WRITE_SIZE);
+    for (int i = 0; i < FILES; i++)
+    {
+        snprintf(name, sizeof(name), "f%d", i);
+        check(wfs_create(fs, WFS_ROOT, name, S_IFREG, &st, 0), "create");
+        files[i] = WFS_INODE(st.st_ino);
+    }
+
+    file_size = fill / FILES / WRITE_SIZE * WRITE_SIZE;
+    double start = now();
+    for (size_t offset = 0; offset < file_size; offset += WRITE_SIZE)
+    {
+        for (int i = 0; i < FILES; i++)
+        {
+            check(wfs_pwrite(fs, files[i], data, WRITE_SIZE, offset), "pwrite");
+            check(wfs_flush(fs, files[i]), "flush");
+        }
+    }
+    check(wfs_sync(fs), "sync");
+    free(data);
+
+    return file_size * FILES / (now() - start) / (1024 * 1024);
+}
+
+// Write the image out and drop it from the page cache, it has to be closed so none of it is mapped
+void drop_image()
+{
+    int fd = open(disk_path, O_RDONLY);
+    if (fd == -1 || fdatasync(fd) == -1 || posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0)
+    {
+        perror(disk_path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+}
+
+void *reader_main(void *arg)
+{
+    struct reader *reader = arg;
+    char *buf = allocate(READ_SIZE);
+
+    double start = now();
+    while (now() - start < duration && reader->count < MAX_SAMPLES)
+    {
+        unsigned int file = files[rand_r(&reader->seed) % FILES];
+        off_t offset = (off_t)(rand_r(&reader->seed) % ((file_size - READ_SIZE) / 4096 + 1)) * 4096;
+
+        double before = now();
+        check(wfs_pread(fs, file, buf, READ_SIZE, offset), "pread");
+        reader->latencies[reader->count++] = now() - before;
+    }
+
+    free(buf);
+    return NULL;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double first = *(const double *)a, second = *(const double *)b;
+
+    return (first > second) - (first < second);
+}
+
+void read_files(int thread_count)
+{
+    struct reader readers[MAX_THREADS];
+
+    drop_image();
+    open_image();
+
+    double start = now();
+    for (int i = 0; i < thread_count; i++)
+    {
+        readers[i] = (struct reader){.seed = i + 1, .latencies = allocate(MAX_SAMPLES * sizeof(double))};
+        if (pthread_create(&readers[i].thread, NULL, reader_main, &readers[i]) != 0)
+        {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < thread_count; i++)
+        pthread_join(readers[i].thread, NULL);
+    double elapsed = now() - start;
+
+    long count = 0;
+    for (int i = 0; i < thread_count; i++)
+        count += readers[i].count;
+    double *latencies = allocate(count * sizeof(double));
+    count = 0;
+    for (int i = 0; i < thread_count; i++)
+    {
+        memcpy(latencies + count, readers[i].latencies, readers[i].count * sizeof(double));
+        count += readers[i].count;
+        free(readers[i].latencies);
+    }
+    qsort(latencies, count, sizeof(double), compare_doubles);
+
+    printf("%-5s %3d threads: %8.0f reads/s, %8.1f MB/s, p50 %9.1f us, p99 %9.1f us\n", wfs_storage_name(storage),
+           thread_count, count / elapsed, count * (double)READ_SIZE / elapsed / (1024 * 1024),
+           latencies[count * 500 / 1000] * 1e6, latencies[count * 990 / 1000] * 1e6);
+    fflush(stdout);
+
+    free(latencies);
+    wfs_close_image(fs);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 6)
+    {
+        fprintf(stderr, "Usage: %s <disk_path> <mmap|uring> <fill_mb> <seconds> <threads>...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    disk_path = argv[1];
+    storage = -1;
+    for (int i = STORAGE_MMAP; i <= STORAGE_URING; i++)
+        if (strcmp(argv[2], wfs_storage_name(i)) == 0)
+            storage = i;
+    size_t fill = (size_t)atol(argv[3]) * 1024 * 1024;
+    duration = atof(argv[4]);
+    if (storage == -1)
+    {
+        fprintf(stderr, "Unknown storage %s\n", argv[2]);
+        exit(EXIT_FAILURE);
+    }
+    if (fill / FILES < READ_SIZE)
+    {
+        fprintf(stderr, "Fill %s MB is too small\n", argv[3]);
+        exit(EXIT_FAILURE);
+    }
+
+    // nothing but errors, and reads leave the image alone
+    wfs_set_log_level(LEVEL_ERROR);
+    wfs_set_atime_mode(ATIME_NONE);
+    wfs_set_storage(storage);
+
+    open_image();
+    double fill_mb_per_sec = fill_log(fill);
+    wfs_close_image(fs);
+    printf("%-5s fill of %zu MB: %.1f MB/s\n", wfs_storage_name(storage), fill / (1024 * 1024), fill_mb_per_sec);
+
+    for (int i = 5; i < argc; i++)
+    {
+        int thread_count = atoi(argv[i]);
+        if (thread_count < 1 || thread_count > MAX_THREADS)
+        {
+            fprintf(stderr, "1 to %d threads expected\n", MAX_THREADS);
+            exit(EXIT_FAILURE);
+        }
+        read_files(thread_count);
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+#!/bin/bash
+set -euo pipefail
+
+# The storage backends compared in-process on an image twice the size of memory by default, so reads keep
+# going to the disk: fill rate, then random 1 MB reads of fragmented files from each thread count in
+# THREADS, appended to bench_output.txt. See bench/storage.c
+# Usage: bench/storage.sh [seconds], run from the repository root after make bench
+
+SECONDS_PER_RUN=${1:-10}
+THREADS=${THREADS:-1 8 32}
+MEMORY_MB=$(awk '/^MemTotal/ { print int($2 / 1024) }' /proc/meminfo)
+SIZE_MB=${SIZE_MB:-$((MEMORY_MB * 2))}
+# the log takes more than the files, checkpoints list every extent
+FILL_MB=${FILL_MB:-$((SIZE_MB / 3))}
+
+echo "== ${SIZE_MB} MB image, ${FILL_MB} MB of files, ${MEMORY_MB} MB of memory" | tee -a bench_output.txt
+for backend in mmap uring; do
+    rm -f bench_disk
+    ./mkfs.wfs -s "${SIZE_MB}M" bench_disk >/dev/null
+    ./bench/storage bench_disk "$backend" "$FILL_MB" "$SECONDS_PER_RUN" $THREADS | tee -a bench_output.txt
+done
+rm -f bench_disk
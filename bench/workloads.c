@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Runs a set of standard workloads on a mounted wfs and reports each one's operations per second, MB/s and
+// latency percentiles as a CSV row or a JSON line, labelled so runs of different commits can be compared:
+//   metadata     create, stat and unlink of empty files
+//   smallfile    write whole 4 KB files, then read them back
+//   seqwrite     128 KB writes to one large file
+//   seqread      128 KB reads of it, dropped from the page cache first
+//   randwrite    4 KB overwrites at random offsets of it
+//   deeplookup   stat of files at the bottom of deep directory chains
+//   widels       what ls -l does on a directory of many files
+// The lookup workloads wait out the kernel's caches first, so every name goes to mount.wfs
+
+#define METADATA_FILES 5000
+#define SMALL_FILES 2000
+#define SMALL_SIZE 4096
+#define SEQ_SIZE (256L * 1024 * 1024)
+#define SEQ_IO_SIZE (128 * 1024)
+#define RAND_IO_SIZE 4096
+#define RAND_WRITES 20000
+#define DEEP_CHAINS 64
+#define DEEP_DEPTH 16
+#define DEEP_PASSES 5
+#define WIDE_FILES 10000
+#define WIDE_PASSES 3
+// mount.wfs lets the kernel cache names and attributes for a second
+#define CACHE_TIMEOUT_US 1100000
+
+// What a workload did, latencies in seconds
+struct result {
+    const char *workload;
+    long ops;
+    long bytes;
+    double elapsed;
+    double *latencies;
+    long count;
+};
+
+const char *mount_point;
+const char *format;
+const char *label;
+char *data;
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void fail(const char *path)
+{
+    perror(path);
+    exit(EXIT_FAILURE);
+}
+
+void *allocate(size_t size)
+{
+    void *memory = malloc(size);
+    if (memory == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    return memory;
+}
+
+void start_result(struct result *result, const char *workload, long max_samples)
+{
+    *result = (struct result){.workload = workload};
+    result->latencies = allocate(max_samples * sizeof(double));
+}
+
+// Count one operation of a workload that started at before
+void count_op(struct result *result, double before, long bytes)
+{
+    result->latencies[result->count++] = now() - before;
+    result->ops++;
+    result->bytes += bytes;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double first = *(const double *)a, second = *(const double *)b;
+
+    return (first > second) - (first < second);
+}
+
+double percentile(struct result *result, int per_thousand)
+{
+    if (result->count == 0)
+        return 0;
+    return result->latencies[result->count * per_thousand / 1000] * 1e6;
+}
+
+void report(struct result *result)
+{
+    qsort(result->latencies, result->count, sizeof(double), compare_doubles);
+
+    double ops_per_sec = result->ops / result->elapsed;
+    double mb_per_sec = result->bytes / result->elapsed / (1024 * 1024);
+    if (strcmp(format, "json") == 0)
+        printf("{\"label\": \"%s\", \"workload\": \"%s\", \"ops\": %ld, \"seconds\": %.3f, \"ops_per_sec\": %.0f, "
+               "\"mb_per_sec\": %.2f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f}\n",
+               label, result->workload, result->ops, result->elapsed, ops_per_sec, mb_per_sec,
+               percentile(result, 500), percentile(result, 990), percentile(result, 999));
+    else
+        printf("%s,%s,%ld,%.3f,%.0f,%.2f,%.1f,%.1f,%.1f\n", label, result->workload, result->ops, result->elapsed,
+               ops_per_sec, mb_per_sec, percentile(result, 500), percentile(result, 990), percentile(result, 999));
+    fflush(stdout);
+
+    free(result->latencies);
+}
+
+void make_directory(const char *path)
+{
+    if (mkdir(path, 0755) == -1)
+        fail(path);
+}
+
+void metadata()
+{
+    struct result result;
+    char path[256];
+    struct stat st;
+
+    start_result(&result, "metadata", 3 * METADATA_FILES);
+    snprintf(path, sizeof(path), "%s/metadata", mount_point);
+    make_directory(path);
+
+    double start = now();
+    for (int i = 0; i < METADATA_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/metadata/m%d", mount_point, i);
+        double before = now();
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd == -1)
+            fail(path);
+        close(fd);
+        count_op(&result, before, 0);
+    }
+    for (int i = 0; i < METADATA_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/metadata/m%d", mount_point, i);
+        double before = now();
+        if (stat(path, &st) == -1)
+            fail(path);
+        count_op(&result, before, 0);
+    }
+    for (int i = 0; i < METADATA_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/metadata/m%d", mount_point, i);
+        double before = now();
+        if (unlink(path) == -1)
+            fail(path);
+        count_op(&result, before, 0);
+    }
+    result.elapsed = now() - start;
+
+    report(&result);
+}
+
+void smallfile()
+{
+    struct result result;
+    char path[256];
+
+    start_result(&result, "smallfile", 2 * SMALL_FILES);
+    snprintf(path, sizeof(path), "%s/small", mount_point);
+    make_directory(path);
+
+    double start = now();
+    for (int i = 0; i < SMALL_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/small/s%d", mount_point, i);
+        double before = now();
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd == -1 || write(fd, data, SMALL_SIZE) != SMALL_SIZE)
+            fail(path);
+        close(fd);
+        count_op(&result, before, SMALL_SIZE);
+    }
+    for (int i = 0; i < SMALL_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/small/s%d", mount_point, i);
+        double before = now();
+        int fd = open(path, O_RDONLY);
+        if (fd == -1 || read(fd, data, SMALL_SIZE) != SMALL_SIZE)
+            fail(path);
+        close(fd);
+        count_op(&result, before, SMALL_SIZE);
+    }
+    result.elapsed = now() - start;
+
+    report(&result);
+}
+
+// Large sequential writes, reads and random overwrites, all on one file
+void large_file()
+{
+    struct result result;
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/large", mount_point);
+    int fd = open(path, O_CREAT | O_RDWR, 0644);
+    if (fd == -1)
+        fail(path);
+
+    start_result(&result, "seqwrite", SEQ_SIZE / SEQ_IO_SIZE);
+    double start = now();
+    for (off_t offset = 0; offset < SEQ_SIZE; offset += SEQ_IO_SIZE)
+    {
+        double before = now();
+        if (pwrite(fd, data, SEQ_IO_SIZE, offset) != SEQ_IO_SIZE)
+            fail(path);
+        count_op(&result, before, SEQ_IO_SIZE);
+    }
+    result.elapsed = now() - start;
+    report(&result);
+
+    // written pages stay in the page cache, the reads have to come from mount.wfs
+    fsync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    start_result(&result, "seqread", SEQ_SIZE / SEQ_IO_SIZE);
+    start = now();
+    for (off_t offset = 0; offset < SEQ_SIZE; offset += SEQ_IO_SIZE)
+    {
+        double before = now();
+        if (pread(fd, data, SEQ_IO_SIZE, offset) != SEQ_IO_SIZE)
+            fail(path);
+        count_op(&result, before, SEQ_IO_SIZE);
+    }
+    result.elapsed = now() - start;
+    report(&result);
+
+    unsigned int seed = 1;
+    start_result(&result, "randwrite", RAND_WRITES);
+    start = now();
+    for (int i = 0; i < RAND_WRITES; i++)
+    {
+        off_t offset = (off_t)(rand_r(&seed) % (SEQ_SIZE / RAND_IO_SIZE)) * RAND_IO_SIZE;
+        double before = now();
+        if (pwrite(fd, data, RAND_IO_SIZE, offset) != RAND_IO_SIZE)
+            fail(path);
+        count_op(&result, before, RAND_IO_SIZE);
+    }
+    result.elapsed = now() - start;
+    report(&result);
+
+    close(fd);
+    if (unlink(path) == -1)
+        fail(path);
+}
+
+// Path of the file at the bottom of a chain of directories
+void chain_path(char *path, size_t size, int chain, int depth)
+{
+    int used = snprintf(path, size, "%s/deep/c%d", mount_point, chain);
+    for (int level = 1; level < depth; level++)
+        used += snprintf(path + used, size - used, "/d%d", level);
+}
+
+void deeplookup()
+{
+    struct result result;
+    char path[1024];
+    struct stat st;
+
+    snprintf(path, sizeof(path), "%s/deep", mount_point);
+    make_directory(path);
+    for (int chain = 0; chain < DEEP_CHAINS; chain++)
+    {
+        for (int depth = 1; depth <= DEEP_DEPTH; depth++)
+        {
+            chain_path(path, sizeof(path), chain, depth);
+            make_directory(path);
+        }
+        strcat(path, "/leaf");
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd == -1)
+            fail(path);
+        close(fd);
+    }
+
+    // every chain has directories of its own, so each stat looks up all of them
+    start_result(&result, "deeplookup", DEEP_PASSES * DEEP_CHAINS);
+    for (int pass = 0; pass < DEEP_PASSES; pass++)
+    {
+        usleep(CACHE_TIMEOUT_US);
+        double start = now();
+        for (int chain = 0; chain < DEEP_CHAINS; chain++)
+        {
+            chain_path(path, sizeof(path), chain, DEEP_DEPTH);
+            strcat(path, "/leaf");
+            double before = now();
+            if (stat(path, &st) == -1)
+                fail(path);
+            count_op(&result, before, 0);
+        }
+        result.elapsed += now() - start;
+    }
+
+    report(&result);
+}
+
+void widels()
+{
+    struct result result;
+    char dir_path[256], path[512];
+    struct stat st;
+
+    snprintf(dir_path, sizeof(dir_path), "%s/wide", mount_point);
+    make_directory(dir_path);
+    for (int i = 0; i < WIDE_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/w%d", dir_path, i);
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd == -1)
+            fail(path);
+        close(fd);
+    }
+
+    // an operation is a name listed and stat'ed
+    start_result(&result, "widels", WIDE_PASSES * WIDE_FILES);
+    for (int pass = 0; pass < WIDE_PASSES; pass++)
+    {
+        usleep(CACHE_TIMEOUT_US);
+        double start = now();
+        DIR *dir = opendir(dir_path);
+        if (dir == NULL)
+            fail(dir_path);
+
+        struct dirent *dentry;
+        double before = now();
+        while ((dentry = readdir(dir)) != NULL)
+        {
+            if (strcmp(dentry->d_name, ".") == 0 || strcmp(dentry->d_name, "..") == 0)
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", dir_path, dentry->d_name);
+            if (lstat(path, &st) == -1)
+                fail(path);
+            count_op(&result, before, 0);
+            before = now();
+        }
+        closedir(dir);
+        result.elapsed += now() - start;
+    }
+
+    report(&result);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 4)
+    {
+        fprintf(stderr, "Usage: %s <mount_point> [csv|json] [label]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    mount_point = argv[1];
+    format = argc > 2 ? argv[2] : "csv";
+    label = argc > 3 ? argv[3] : "";
+    if (strcmp(format, "csv") != 0 && strcmp(format, "json") != 0)
+    {
+        fprintf(stderr, "Unknown format %s\n", format);
+        exit(EXIT_FAILURE);
+    }
+
+    data = allocate(SEQ_IO_SIZE);
+    memset(data, 'w', SEQ_IO_SIZE);
+
+    metadata();
+    smallfile();
+    large_file();
+    deeplookup();
+    widels();
+
+    free(data);
+    return 0;
+}
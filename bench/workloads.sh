@@ -0,0 +1,33 @@
+#!/bin/bash
+set -euo pipefail
+
+# The standard workloads (see bench/workloads.c) on a fresh image mounted by each of the given mount.wfs binaries
+# (./mount.wfs by default), one row per workload appended to bench_workloads.csv, or to bench_workloads.json as
+# JSON lines with FORMAT=json. Rows are labelled with the commit, or with the binary when one is given, e.g.
+#   bench/workloads.sh ./mount.wfs.old ./mount.wfs
+# Usage: bench/workloads.sh [mount.wfs binaries...], run from the repository root after make bench
+
+BINARIES=${@:-./mount.wfs}
+FORMAT=${FORMAT:-csv}
+SIZE=${SIZE:-2G}
+COMMIT=$(git describe --always --dirty 2>/dev/null || echo unknown)
+OUTPUT=bench_workloads.$FORMAT
+
+if [ "$FORMAT" = csv ] && [ ! -s "$OUTPUT" ]; then
+    echo "label,workload,ops,seconds,ops_per_sec,mb_per_sec,p50_us,p99_us,p999_us" >"$OUTPUT"
+fi
+
+mkdir -p mnt
+for binary in $BINARIES; do
+    label=$COMMIT
+    [ $# -gt 0 ] && label=$binary
+
+    rm -f bench_disk
+    ./mkfs.wfs -s "$SIZE" bench_disk >/dev/null
+    "$binary" bench_disk mnt >/dev/null
+
+    ./bench/workloads mnt "$FORMAT" "$label" | tee -a "$OUTPUT"
+
+    fusermount -u mnt
+done
+rm -f bench_disk
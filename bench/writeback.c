@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+
+// Writes many small files on a mounted wfs and then unlinks them, and reports after each phase how much of
+// mount.wfs's mapping of the image is dirty (given its pid) and how long the image takes to write back.
+// The image is written back before each phase, so only the pages that phase changed are counted
+
+#define FILE_SIZE 1024
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// KB of a process's mappings of a file that are dirty, from /proc, -1 if it can't be read
+long dirty_kb(int pid, const char *path)
+{
+    char smaps_path[64], line[PATH_MAX + 128];
+    long dirty = 0, kb;
+    int in_image = 0;
+
+    snprintf(smaps_path, sizeof(smaps_path), "/proc/%d/smaps", pid);
+    FILE *smaps = fopen(smaps_path, "r");
+    if (smaps == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), smaps) != NULL)
+    {
+        // every mapping starts with its address range and ends its first line with the file mapped
+        unsigned long start, end;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+        {
+            line[strcspn(line, "\n")] = '\0';
+            size_t length = strlen(line), path_length = strlen(path);
+            in_image = length >= path_length && strcmp(line + length - path_length, path) == 0;
+        }
+        else if (in_image && (sscanf(line, "Shared_Dirty: %ld", &kb) == 1 || sscanf(line, "Private_Dirty: %ld", &kb) == 1))
+        {
+            dirty += kb;
+        }
+    }
+    fclose(smaps);
+
+    return dirty;
+}
+
+// Report the dirty pages a phase left and write them back
+void report(const char *name, int count, int image_fd, const char *image_path, int daemon_pid, double elapsed)
+{
+    long dirty = daemon_pid > 0 ? dirty_kb(daemon_pid, image_path) : -1;
+
+    double start = now();
+    if (fsync(image_fd) == -1)
+    {
+        perror(image_path);
+        exit(EXIT_FAILURE);
+    }
+    double writeback = now() - start;
+
+    printf("%-8s %6d files in %7.1f ms, %8ld KB dirty, writeback %7.2f ms\n", name, count, elapsed * 1000, dirty, writeback * 1000);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3 || argc > 5)
+    {
+        fprintf(stderr, "Usage: %s <mount_point> <disk_path> [files] [mount_pid]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    const char *mount_point = argv[1];
+    int count = argc > 3 ? atoi(argv[3]) : 10000;
+    int daemon_pid = argc > 4 ? atoi(argv[4]) : 0;
+    char image_path[PATH_MAX], path[PATH_MAX], data[FILE_SIZE];
+
+    // /proc names the mapped file by its absolute path
+    if (realpath(argv[2], image_path) == NULL)
+    {
+        perror(argv[2]);
+        exit(EXIT_FAILURE);
+    }
+    int image_fd = open(image_path, O_RDONLY);
+    if (image_fd == -1)
+    {
+        perror(image_path);
+        exit(EXIT_FAILURE);
+    }
+    memset(data, 'w', sizeof(data));
+
+    fsync(image_fd);
+    double start = now();
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(path, sizeof(path), "%s/file%d", mount_point, i);
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd == -1 || write(fd, data, sizeof(data)) != sizeof(data))
+        {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+    }
+    report("create", count, image_fd, image_path, daemon_pid, now() - start);
+
+    start = now();
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(path, sizeof(path), "%s/file%d", mount_point, i);
+        if (unlink(path) == -1)
+        {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    report("unlink", count, image_fd, image_path, daemon_pid, now() - start);
+
+    close(image_fd);
+    return 0;
+}
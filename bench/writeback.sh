@@ -0,0 +1,26 @@
+#!/bin/bash
+set -euo pipefail
+
+# Dirty pages and writeback time of creating and then unlinking many small files with the given mount.wfs
+# binaries (./mount.wfs by default), e.g. one built before a change and one after, appended to bench_output.txt.
+# Usage: bench/writeback.sh [mount.wfs binaries...], run from the repository root after make bench
+
+BINARIES=${@:-./mount.wfs}
+FILES=${FILES:-10000}
+SIZE=${SIZE:-1G}
+
+mkdir -p mnt
+for binary in $BINARIES; do
+    rm -f bench_disk
+    ./mkfs.wfs -s "$SIZE" bench_disk >/dev/null
+    "$binary" bench_disk mnt >/dev/null
+    pid=$(pgrep -n -f "bench_disk mnt")
+
+    {
+        echo "== $binary, $FILES files"
+        ./bench/writeback mnt bench_disk "$FILES" "$pid"
+    } | tee -a bench_output.txt
+
+    fusermount -u mnt
+done
+rm -f bench_disk
@@ -1,2 +1,663 @@
-int main(int argc, char *argv[]) {
-}
\ No newline at end of file
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include "wfs.h"
+
+char *base;
+size_t disk_size;
+int disk_fd;
+
+// Segment layout of the image, legacy images are one segment without a header
+char *log_start;
+size_t segment_size;
+size_t segment_header_size;
+unsigned int segment_count;
+
+// Segments in use, sorted into log order by their sequence numbers
+unsigned int *log_order;
+uint32_t *sequences;
+unsigned int used_count;
+
+// Per-inode facts gathered by the first pass, indexed by inode number
+uint64_t *base_position;        // log position of the inode's latest full (WFS_ENTRY_INODE) entry
+uint32_t *name_bound;           // upper bound on the names of a directory
+unsigned char *inode_bits;      // INODE_* bits below
+unsigned int inode_capacity;
+
+#define INODE_DELETED 1         // its latest entry is marked deleted
+#define INODE_DENTRY_RECORDS 2  // a directory with add/remove records after its full entry
+#define INODE_UNLINKED 4        // a remove record took its name away
+
+// Entries the newest valid checkpoint lists as live, sorted by offset, and the log position it covers
+// the log up to. Entries before that position it doesn't list are garbage, whatever they say
+uint64_t *checkpoint_entries;
+size_t checkpoint_entry_count;
+uint64_t checkpoint_position;   // 0 without a checkpoint, then every entry may be live
+
+// Merged contents of a directory that had add/remove records, rewritten as one full entry
+struct merged_dir {
+    unsigned int inode_number;
+    struct wfs_inode inode;     // attributes from its latest entry
+    struct wfs_dentry *dentries;
+    unsigned int dentry_count;
+    unsigned int dentry_capacity;
+};
+
+struct merged_dir *merged_dirs;
+unsigned int merged_dir_count;
+unsigned int merged_dir_capacity;
+
+// Where the second pass writes: the segment being filled, and the segments already read that it moves on to
+#define NO_SEGMENT 0xffffffff
+
+unsigned int output_segment;
+char *output;
+uint32_t output_sequence;
+int *is_output;
+unsigned int *read_segments;
+unsigned int read_head, read_tail;
+
+// Get the start of a segment
+char *segment_start(unsigned int segment)
+{
+    return log_start + segment * segment_size;
+}
+
+// Check that a log entry lies within the segment ending at end -- the first one that doesn't marks
+// the end of the log in that segment
+int valid_log_entry(char *curr, char *end)
+{
+    struct wfs_log_entry *curr_log_entry = (struct wfs_log_entry *)curr;
+
+    if (curr + sizeof(struct wfs_log_entry) > end)
+        return 0;
+
+    return curr_log_entry->inode.size >= sizeof(struct wfs_log_entry) &&
+           curr_log_entry->inode.size <= end - curr;
+}
+
+// Position of a log entry in log order, segments get reused so offsets alone don't tell
+uint64_t log_position(unsigned int order, char *curr)
+{
+    return ((uint64_t)order << 32) | (uint64_t)(curr - base);
+}
+
+// Check whether a range of the image lies in a hole of a sparse image, where it reads as zeros without
+// having to be faulted in. next_data carries the start of the next data on from one call to the next
+int in_hole(off_t offset, size_t length, off_t *next_data)
+{
+    if (*next_data <= offset)
+    {
+        *next_data = lseek(disk_fd, offset, SEEK_DATA);
+
+        // ENXIO means there is no data past offset, other errors that holes aren't reported
+        if (*next_data == -1)
+            *next_data = errno == ENXIO ? (off_t)disk_size : offset;
+    }
+
+    return *next_data >= offset + (off_t)length;
+}
+
+// Order segment indices by sequence number for qsort
+int compare_sequences(const void *a, const void *b)
+{
+    uint32_t first = sequences[*(const unsigned int *)a], second = sequences[*(const unsigned int *)b];
+
+    return (first > second) - (first < second);
+}
+
+// Find the segments in use from their headers and sort them into log order
+void load_segments(struct wfs_sb *superblock)
+{
+    if (superblock->version == 0)
+    {
+        log_start = base + WFS_LEGACY_SB_SIZE;
+        segment_count = 1;
+        segment_size = disk_size - WFS_LEGACY_SB_SIZE;
+        segment_header_size = 0;
+    }
+    else
+    {
+        log_start = base + sizeof(struct wfs_sb);
+        segment_count = superblock->segment_count;
+        segment_size = superblock->segment_size;
+        segment_header_size = sizeof(struct wfs_segment);
+    }
+
+    log_order = malloc(segment_count * sizeof(unsigned int));
+    sequences = calloc(segment_count, sizeof(uint32_t));
+    is_output = calloc(segment_count, sizeof(int));
+    read_segments = malloc(segment_count * sizeof(unsigned int));
+    if (log_order == NULL || sequences == NULL || is_output == NULL || read_segments == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    off_t next_data = 0;
+    for (unsigned int i = 0; i < segment_count; i++)
+    {
+        struct wfs_segment *header = (struct wfs_segment *)segment_start(i);
+
+        if (superblock->version == 0)
+            sequences[i] = 1;
+        else if (!in_hole((char *)header - base, segment_header_size, &next_data) && header->magic == WFS_SEGMENT_MAGIC)
+            sequences[i] = header->sequence;
+
+        if (sequences[i] != 0)
+            log_order[used_count++] = i;
+    }
+
+    qsort(log_order, used_count, sizeof(unsigned int), compare_sequences);
+}
+
+// Order log offsets for qsort and bsearch
+int compare_offsets(const void *a, const void *b)
+{
+    uint64_t first = *(const uint64_t *)a, second = *(const uint64_t *)b;
+
+    return (first > second) - (first < second);
+}
+
+// Get the place of a segment in log order, NO_SEGMENT if it isn't in use
+unsigned int segment_order(unsigned int segment)
+{
+    for (unsigned int order = 0; order < used_count; order++)
+    {
+        if (log_order[order] == segment)
+            return order;
+    }
+
+    return NO_SEGMENT;
+}
+
+// Get the checkpoint part stored at an offset, NULL unless it is intact and in a segment in use
+struct wfs_checkpoint *read_checkpoint_part(uint64_t offset)
+{
+    if (offset < (uint64_t)(log_start - base) + segment_header_size || offset >= (uint64_t)(segment_start(segment_count) - base))
+        return NULL;
+
+    unsigned int segment = (offset - (log_start - base)) / segment_size;
+    struct wfs_log_entry *log_entry = (struct wfs_log_entry *)(base + offset);
+    struct wfs_checkpoint *checkpoint = (struct wfs_checkpoint *)log_entry->data;
+
+    if (segment_order(segment) == NO_SEGMENT || !valid_log_entry(base + offset, segment_start(segment) + segment_size) ||
+        log_entry->inode.flags != WFS_ENTRY_CHECKPOINT ||
+        log_entry->inode.size < sizeof(struct wfs_log_entry) + sizeof(struct wfs_checkpoint) ||
+        log_entry->inode.size != sizeof(struct wfs_log_entry) + sizeof(struct wfs_checkpoint) + checkpoint->entry_count * sizeof(uint64_t))
+        return NULL;
+
+    // the checksum is computed with its own field zeroed
+    uint32_t checksum = checkpoint->checksum;
+    checkpoint->checksum = 0;
+    uint32_t expected = wfs_checksum(log_entry, log_entry->inode.size);
+    checkpoint->checksum = checksum;
+
+    return checksum == expected ? checkpoint : NULL;
+}
+
+// Get the last part of the checkpoint ending at an offset, NULL unless all its parts are intact
+struct wfs_checkpoint *read_checkpoint(uint64_t offset)
+{
+    struct wfs_checkpoint *last = read_checkpoint_part(offset);
+    struct wfs_checkpoint *part = last;
+
+    while (part != NULL && part->part > 0)
+    {
+        struct wfs_checkpoint *previous = read_checkpoint_part(part->previous);
+        if (previous == NULL || previous->version != part->version || previous->part != part->part - 1)
+            return NULL;
+        part = previous;
+    }
+
+    return part != NULL ? last : NULL;
+}
+
+// Collect what the newest valid checkpoint lists. mount.wfs no longer marks the entries of unlinked or
+// superseded inodes in place, so which old entries are live is only known from there
+void load_checkpoint(struct wfs_sb *superblock)
+{
+    if (superblock->version == 0)
+        return;
+
+    struct wfs_checkpoint *first = read_checkpoint(superblock->checkpoint[0]);
+    struct wfs_checkpoint *second = read_checkpoint(superblock->checkpoint[1]);
+    struct wfs_checkpoint *checkpoint = first;
+    if (second != NULL && (first == NULL || second->version > first->version))
+        checkpoint = second;
+    if (checkpoint == NULL)
+        return;
+
+    for (struct wfs_checkpoint *part = checkpoint; ; part = read_checkpoint_part(part->previous))
+    {
+        checkpoint_entries = realloc(checkpoint_entries, (checkpoint_entry_count + part->entry_count) * sizeof(uint64_t));
+        if (checkpoint_entries == NULL && checkpoint_entry_count + part->entry_count > 0)
+        {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(checkpoint_entries + checkpoint_entry_count, part->entries, part->entry_count * sizeof(uint64_t));
+        checkpoint_entry_count += part->entry_count;
+
+        if (part->part == 0)
+            break;
+    }
+    qsort(checkpoint_entries, checkpoint_entry_count, sizeof(uint64_t), compare_offsets);
+
+    // the head it covers up to may be the very end of the segment holding its last part
+    uint64_t last_part = (char *)checkpoint - sizeof(struct wfs_log_entry) - base;
+    unsigned int segment = (last_part - (log_start - base)) / segment_size;
+    checkpoint_position = log_position(segment_order(segment), base + checkpoint->head);
+}
+
+// Check whether a log entry can still be live: the checkpoint lists it or it was appended after it
+int may_be_live(unsigned int order, char *curr)
+{
+    uint64_t offset = curr - base;
+
+    return checkpoint_position == 0 || log_position(order, curr) >= checkpoint_position ||
+           bsearch(&offset, checkpoint_entries, checkpoint_entry_count, sizeof(uint64_t), compare_offsets) != NULL;
+}
+
+// Grow the per-inode tables so they have a slot for the given inode number
+void grow_inode_tables(unsigned int inode_number)
+{
+    if (inode_number < inode_capacity)
+        return;
+
+    unsigned int new_capacity = inode_capacity ? inode_capacity : 1024;
+    while (new_capacity <= inode_number)
+        new_capacity *= 2;
+
+    base_position = realloc(base_position, new_capacity * sizeof(uint64_t));
+    name_bound = realloc(name_bound, new_capacity * sizeof(uint32_t));
+    inode_bits = realloc(inode_bits, new_capacity);
+    if (base_position == NULL || name_bound == NULL || inode_bits == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(base_position + inode_capacity, 0, (new_capacity - inode_capacity) * sizeof(uint64_t));
+    memset(name_bound + inode_capacity, 0, (new_capacity - inode_capacity) * sizeof(uint32_t));
+    memset(inode_bits + inode_capacity, 0, new_capacity - inode_capacity);
+    inode_capacity = new_capacity;
+}
+
+// First pass: find each inode's latest full entry and whether it is still alive; returns the bytes of entries read
+size_t scan_log()
+{
+    size_t scanned = 0;
+
+    for (unsigned int order = 0; order < used_count; order++)
+    {
+        char *curr = segment_start(log_order[order]) + segment_header_size;
+        char *end = segment_start(log_order[order]) + segment_size;
+
+        while (valid_log_entry(curr, end))
+        {
+            struct wfs_log_entry *log_entry = (struct wfs_log_entry *)curr;
+            unsigned int inode_number = log_entry->inode.inode_number;
+
+            if (log_entry->inode.flags != WFS_ENTRY_CHECKPOINT && log_entry->inode.flags != WFS_ENTRY_PADDING &&
+                may_be_live(order, curr))
+            {
+                grow_inode_tables(inode_number);
+
+                if (log_entry->inode.flags == WFS_ENTRY_INODE)
+                {
+                    // a full entry supersedes everything logged for the inode before it
+                    base_position[inode_number] = log_position(order, curr);
+                    name_bound[inode_number] = (log_entry->inode.size - sizeof(struct wfs_log_entry)) / sizeof(struct wfs_dentry);
+                    inode_bits[inode_number] &= ~INODE_DENTRY_RECORDS;
+                }
+                else if (log_entry->inode.flags == WFS_ENTRY_DENTRY_ADD || log_entry->inode.flags == WFS_ENTRY_DENTRY_REMOVE)
+                {
+                    name_bound[inode_number] += log_entry->inode.flags == WFS_ENTRY_DENTRY_ADD;
+                    inode_bits[inode_number] |= INODE_DENTRY_RECORDS;
+                }
+
+                // inodes are never handed out twice, once unlinked one stays gone
+                if (log_entry->inode.flags == WFS_ENTRY_DENTRY_REMOVE)
+                {
+                    unsigned int unlinked = ((struct wfs_dentry *)log_entry->data)->inode_number;
+                    grow_inode_tables(unlinked);
+                    inode_bits[unlinked] |= INODE_UNLINKED;
+                }
+
+                // only the latest entry's deleted flag counts: legacy images flagged superseded ones too,
+                // and an orphan's entries are flagged from its unlink on
+                if (log_entry->inode.deleted == 1)
+                    inode_bits[inode_number] |= INODE_DELETED;
+                else
+                    inode_bits[inode_number] &= ~INODE_DELETED;
+            }
+
+            scanned += log_entry->inode.size;
+            curr += log_entry->inode.size;
+        }
+    }
+
+    // a directory whose merged entry might not fit in a segment keeps its records as they are
+    for (unsigned int i = 0; i < inode_capacity; i++)
+    {
+        if (sizeof(struct wfs_log_entry) + (size_t)name_bound[i] * sizeof(struct wfs_dentry) > segment_size - segment_header_size)
+            inode_bits[i] &= ~INODE_DENTRY_RECORDS;
+    }
+
+    return scanned;
+}
+
+// Get the merged view of a directory, creating it on first use
+struct merged_dir *get_merged_dir(unsigned int inode_number)
+{
+    for (unsigned int i = merged_dir_count; i > 0; i--)
+    {
+        if (merged_dirs[i - 1].inode_number == inode_number)
+            return &merged_dirs[i - 1];
+    }
+
+    if (merged_dir_count == merged_dir_capacity)
+    {
+        merged_dir_capacity = merged_dir_capacity ? merged_dir_capacity * 2 : 16;
+        merged_dirs = realloc(merged_dirs, merged_dir_capacity * sizeof(struct merged_dir));
+        if (merged_dirs == NULL)
+        {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct merged_dir *dir = &merged_dirs[merged_dir_count++];
+    memset(dir, 0, sizeof(struct merged_dir));
+    dir->inode_number = inode_number;
+    return dir;
+}
+
+// Add a name to a merged directory
+void merge_add(struct merged_dir *dir, struct wfs_dentry *dentry)
+{
+    if (dir->dentry_count == dir->dentry_capacity)
+    {
+        dir->dentry_capacity = dir->dentry_capacity ? dir->dentry_capacity * 2 : 16;
+        dir->dentries = realloc(dir->dentries, dir->dentry_capacity * sizeof(struct wfs_dentry));
+        if (dir->dentries == NULL)
+        {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    dir->dentries[dir->dentry_count++] = *dentry;
+}
+
+// Remove a name from a merged directory, keeping the order of the others
+void merge_remove(struct merged_dir *dir, struct wfs_dentry *dentry)
+{
+    for (unsigned int i = 0; i < dir->dentry_count; i++)
+    {
+        if (strcmp(dir->dentries[i].name, dentry->name) == 0)
+        {
+            memmove(&dir->dentries[i], &dir->dentries[i + 1], (dir->dentry_count - i - 1) * sizeof(struct wfs_dentry));
+            dir->dentry_count--;
+            return;
+        }
+    }
+}
+
+// Fold a directory entry into the merged view of its directory instead of copying it, an attributes record
+// only updates the attributes
+void merge_dir_entry(struct wfs_log_entry *log_entry)
+{
+    struct merged_dir *dir = get_merged_dir(log_entry->inode.inode_number);
+
+    dir->inode = log_entry->inode;
+
+    if (log_entry->inode.flags == WFS_ENTRY_DENTRY_ADD)
+    {
+        merge_add(dir, (struct wfs_dentry *)log_entry->data);
+    }
+    else if (log_entry->inode.flags == WFS_ENTRY_DENTRY_REMOVE)
+    {
+        merge_remove(dir, (struct wfs_dentry *)log_entry->data);
+    }
+    else if (log_entry->inode.flags == WFS_ENTRY_INODE)
+    {
+        dir->dentry_count = 0;
+        for (char *data_addr = log_entry->data; data_addr < (char *)log_entry + log_entry->inode.size; data_addr += sizeof(struct wfs_dentry))
+            merge_add(dir, (struct wfs_dentry *)data_addr);
+    }
+}
+
+// Zero the unused end of the segment being written so the log ends there
+void close_output_segment()
+{
+    if (output != NULL)
+        memset(output, 0, segment_start(output_segment) + segment_size - output);
+}
+
+// Get room for a log entry in the output. Once the current output segment is full the output moves on to
+// a segment that has been read completely or, failing that, to the one being read: there it starts out
+// behind the input and stays behind it. NULL if neither is available
+char *output_space(unsigned int size, unsigned int reading)
+{
+    if (output != NULL && output + size <= segment_start(output_segment) + segment_size)
+        return output;
+
+    unsigned int next = read_head < read_tail ? read_segments[read_head++] : reading;
+    if (next == NO_SEGMENT || (output != NULL && next == output_segment))
+        return NULL;
+
+    close_output_segment();
+
+    output_segment = next;
+    is_output[output_segment] = 1;
+    output = segment_start(output_segment) + segment_header_size;
+
+    if (segment_header_size > 0)
+    {
+        struct wfs_segment *header = (struct wfs_segment *)segment_start(output_segment);
+        header->magic = WFS_SEGMENT_MAGIC;
+        header->sequence = ++output_sequence;
+        header->created = time(NULL);
+    }
+
+    return output;
+}
+
+// Second pass: copy every live entry to the output, in log order; returns the bytes written
+size_t compact_log()
+{
+    size_t written = 0;
+
+    for (unsigned int order = 0; order < used_count; order++)
+    {
+        unsigned int segment = log_order[order];
+        char *read = segment_start(segment) + segment_header_size;
+        char *end = segment_start(segment) + segment_size;
+
+        while (valid_log_entry(read, end))
+        {
+            struct wfs_log_entry *log_entry = (struct wfs_log_entry *)read;
+            unsigned int size = log_entry->inode.size;
+            unsigned int inode_number = log_entry->inode.inode_number;
+
+            // checkpoints refer to offsets that are about to change, padding never held anything and
+            // deleted inodes are gone
+            int live = log_entry->inode.flags != WFS_ENTRY_CHECKPOINT && log_entry->inode.flags != WFS_ENTRY_PADDING &&
+                       may_be_live(order, read) && !(inode_bits[inode_number] & (INODE_DELETED | INODE_UNLINKED)) &&
+                       log_position(order, read) >= base_position[inode_number];
+
+            if (live && (inode_bits[inode_number] & INODE_DENTRY_RECORDS))
+            {
+                merge_dir_entry(log_entry);
+            }
+            else if (live)
+            {
+                // the output never overtakes the input, so a forward memmove is safe
+                char *destination = output_space(size, segment);
+                if (destination != read)
+                    memmove(destination, read, size);
+                output += size;
+                written += size;
+            }
+
+            read += size;
+        }
+
+        // once read, the segment can take output
+        if (!is_output[segment])
+            read_segments[read_tail++] = segment;
+    }
+
+    // append one full entry per merged directory, never more bytes than the entries it replaces
+    for (unsigned int i = 0; i < merged_dir_count; i++)
+    {
+        struct merged_dir *dir = &merged_dirs[i];
+        unsigned int size = sizeof(struct wfs_log_entry) + dir->dentry_count * sizeof(struct wfs_dentry);
+        struct wfs_log_entry *log_entry = (struct wfs_log_entry *)output_space(size, NO_SEGMENT);
+
+        if (log_entry == NULL)
+        {
+            fprintf(stderr, "No room left for merged directory %u\n", dir->inode_number);
+            exit(EXIT_FAILURE);
+        }
+
+        log_entry->inode = dir->inode;
+        log_entry->inode.flags = WFS_ENTRY_INODE;
+        log_entry->inode.deleted = 0;
+        log_entry->inode.size = size;
+        memcpy(log_entry->data, dir->dentries, dir->dentry_count * sizeof(struct wfs_dentry));
+
+        output += size;
+        written += size;
+        free(dir->dentries);
+    }
+
+    // an empty log still needs its first segment
+    if (output == NULL)
+        output_space(0, log_order[0]);
+    close_output_segment();
+
+    // whatever was read but not written to is free, without a header mount doesn't read it. Segments
+    // that were free already are left alone, on a sparse image they are holes
+    for (unsigned int order = 0; order < used_count; order++)
+    {
+        if (!is_output[log_order[order]])
+            memset(segment_start(log_order[order]), 0, segment_header_size);
+    }
+
+    return written;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <disk_path>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    const char *disk_path = argv[1];
+
+    // Open file descriptor for the image to compact
+    int fd = open(disk_path, O_RDWR, 0666);
+    if (fd == -1) {
+        perror("Error opening file");
+        exit(EXIT_FAILURE);
+    }
+
+    // Get file info (for file size)
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1) {
+        perror("fstat");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+    disk_size = file_stat.st_size;
+    disk_fd = fd;
+
+    // Memory map file
+    base = mmap(NULL, disk_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+
+    // Both passes read the log front to back
+    madvise(base, disk_size, MADV_SEQUENTIAL);
+
+    struct wfs_sb *superblock = (struct wfs_sb *)base;
+    if (superblock->magic != WFS_MAGIC) {
+        fprintf(stderr, "%s is not a wfs image\n", disk_path);
+        exit(EXIT_FAILURE);
+    }
+    if (superblock->version != 0 && superblock->version != WFS_VERSION) {
+        fprintf(stderr, "Unsupported format version %u\n", superblock->version);
+        exit(EXIT_FAILURE);
+    }
+    if (superblock->version != 0 && superblock->disk_size > disk_size) {
+        fprintf(stderr, "%s is %zu bytes but was made for %llu bytes\n", disk_path, disk_size, (unsigned long long)superblock->disk_size);
+        exit(EXIT_FAILURE);
+    }
+
+    load_segments(superblock);
+    if (used_count == 0) {
+        fprintf(stderr, "No log segments found in %s\n", disk_path);
+        exit(EXIT_FAILURE);
+    }
+    load_checkpoint(superblock);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    size_t scanned = scan_log();
+    size_t written = compact_log();
+
+    if (superblock->version == 0)
+    {
+        superblock->legacy_head = output - base;
+    }
+    else
+    {
+        superblock->head = output - base;
+
+        // the old checkpoints point at entries that moved, mount replays the compacted log instead
+        superblock->checkpoint[0] = 0;
+        superblock->checkpoint[1] = 0;
+
+        // tell a running mount.wfs to reload
+        superblock->generation += 1;
+    }
+
+    if (msync(base, disk_size, MS_SYNC) == -1)
+        perror("msync");
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("Compacted log from %zu to %zu bytes in %u of %u segments, reclaimed %zu bytes in %.3f s (%.1f MB/s)\n",
+           scanned, written, used_count, segment_count, scanned - written, seconds,
+           seconds > 0 ? scanned / seconds / (1024 * 1024) : 0.0);
+
+    munmap(base, disk_size);
+    close(fd);
+    free(base_position);
+    free(name_bound);
+    free(inode_bits);
+    free(merged_dirs);
+    free(log_order);
+    free(sequences);
+    free(is_output);
+    free(read_segments);
+    free(checkpoint_entries);
+
+    return 0;
+}
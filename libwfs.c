@@ -0,0 +1,4547 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+#include <dirent.h>
+
+#include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include "wfs.h"
+#include "libwfs.h"
+
+static int inode_count = 0;
+static size_t total_size;
+
+static int disk_fd;
+
+static char *head;
+static char *base;
+static struct wfs_sb *superblock;
+
+static char *log_start;
+static size_t disk_size;
+
+// In-memory state of a log segment
+struct segment {
+    uint32_t sequence;          // 0 if the segment is free
+    uint32_t created;
+    size_t live_bytes;          // bytes of the segment held by live log entries
+    uint32_t reusable_at;       // once cleaned, the checkpoint version after which it is free again
+    int unsynced;               // started or freed since the log was last synced, listed in unsynced_segments
+};
+
+static struct segment *segments;
+static unsigned int segment_count;
+static size_t segment_size;
+static size_t segment_header_size;     // 0 on legacy images, which are a single segment without a header
+static unsigned int current_segment;   // segment holding the head
+static uint32_t next_sequence;
+static unsigned int free_segment_count;
+static unsigned int free_cursor;       // where open_segment() starts looking for a free segment
+
+// Segments to sync whole next time the log is synced, and how far the head had got then, see sync_ranges()
+static unsigned int *unsynced_segments;
+static unsigned int unsynced_count;
+static unsigned int unsynced_capacity;
+static unsigned int synced_segment;
+static char *synced_head;
+
+// Segments in use sorted by sequence, as found by load_segments() -- the order mount replays them in
+static unsigned int *log_order;
+static unsigned int log_order_count;
+
+// Segments the cleaner keeps for itself besides room for two checkpoints, relocating live entries needs room at the head
+#define CLEANER_RESERVE 1
+// Segments unlinking keeps for its remove records, so a full log can always be cleaned out by deleting files
+#define REMOVE_RESERVE 1
+// Cleaning a victim has to free at least 1/CLEANER_MIN_GAIN of a segment, on top of the checkpoints it takes
+#define CLEANER_MIN_GAIN 4
+// The background cleaner starts once fewer segments than this are free on top of the reserves
+#define CLEANER_MIN_FREE 2
+#define NO_SEGMENT 0xffffffff
+
+static unsigned int cleaning_segment = NO_SEGMENT;    // victim being cleaned
+static char *cleaning_pos;             // next log entry of the victim to look at
+static int cleaning;                   // set while the cleaner appends, it may use the reserve
+static int removing;                   // set while a name is unlinked, its remove record may use the remove reserve
+static unsigned long segments_released;    // cleaned segments freed again so far
+static size_t cleaner_taken;               // bytes the cleaner took at the head so far, padding included
+
+// How much cleaning had freed and taken the last time a victim came free
+struct cleaning_round {
+    unsigned long released;
+    size_t taken;
+};
+
+// Lookups and writes hold the log lock shared, so FUSE can run them side by side; anything that changes
+// the namespace or moves entries around -- the cleaner, checkpoints, reloads -- holds it exclusively
+static pthread_rwlock_t log_lock;
+// Writers holding the log lock shared reserve space at the head one at a time under this
+static pthread_mutex_t head_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Per-inode locks, striped by inode number. A writer holds its inode's exclusively from reserving log
+// space to publishing the entry, so entries of one inode are applied in log order
+#define INODE_LOCK_COUNT 256
+static pthread_rwlock_t inode_locks[INODE_LOCK_COUNT];
+
+// The cleaner sleeps until the head moves on to another segment
+static pthread_mutex_t cleaner_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cleaner_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_t cleaner_thread;
+static int cleaner_running;
+static int cleaner_kicked;
+static int cleaner_stop;
+
+// How accesses update access times, see libwfs.h
+static int atime_mode = ATIME_STRICT;
+
+void wfs_set_atime_mode(int mode)
+{
+    atime_mode = mode;
+}
+
+// How writes reach the disk, see libwfs.h
+static int durability = DURABILITY_NONE;
+static unsigned int sync_interval = 1000;
+static const char *durability_names[] = {"none", "periodic", "fsync"};
+
+void wfs_set_durability(int mode)
+{
+    durability = mode;
+}
+
+void wfs_set_sync_interval(unsigned int milliseconds)
+{
+    sync_interval = milliseconds;
+}
+
+const char *wfs_durability_name(int mode)
+{
+    return mode >= DURABILITY_NONE && mode <= DURABILITY_FSYNC ? durability_names[mode] : NULL;
+}
+
+// Syncs of the log are shared: a caller waits for one that starts after it came in, and whoever finds
+// none running starts it for everyone waiting by then
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sync_done = PTHREAD_COND_INITIALIZER;
+static uint64_t syncs_started;
+static uint64_t syncs_finished;
+static int sync_running;
+static int sync_result;                // of the last sync finished
+
+// In DURABILITY_PERIODIC the syncer wakes up every sync_interval milliseconds
+static pthread_mutex_t syncer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t syncer_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_t syncer_thread;
+static int syncer_running;
+static int syncer_stop;
+
+// relatime still updates access times older than this many seconds
+#define RELATIME_INTERVAL (24 * 60 * 60)
+
+// Holes in files are read from here
+static char zero_block[64 * 1024];
+
+// Add to a counter that writers holding the log lock shared update at the same time
+#define COUNT(counter, amount) __atomic_fetch_add(&(counter), (amount), __ATOMIC_RELAXED)
+
+// A run of file bytes stored contiguously in the log
+struct extent {
+    size_t offset;              // file offset of the first byte
+    size_t length;
+    size_t data;                // log offset of the bytes
+    size_t entry;               // log offset of the entry holding them
+};
+
+// A name in a directory, pointing at its wfs_dentry in the log
+struct dentry_ref {
+    size_t dentry;              // log offset of the wfs_dentry
+    size_t entry;               // log offset of the entry holding it
+};
+
+// A slot of a directory's name index. The hash is kept beside the position so probing and moving names
+// around the index don't read them from the log
+struct indexed_name {
+    unsigned int position;      // position in the directory's dentries + 1, 0 if the slot is empty
+    unsigned int hash;          // hash_path of the name
+};
+
+// In-memory state of an inode, rebuilt from the log at mount
+struct inode_state {
+    size_t entry;               // offset of its latest log entry, 0 if the inode doesn't exist
+    size_t base;                // offset of a directory's latest full (WFS_ENTRY_INODE) entry
+    size_t live_size;           // bytes of the log held by its live entries
+    size_t file_size;
+    struct extent *extents;     // file contents, sorted by offset and non-overlapping
+    unsigned int extent_count;
+    unsigned int extent_capacity;
+    struct dentry_ref *dentries;    // directory contents: the base entry merged with the add/remove records after it
+    unsigned int dentry_count;      // slots used in dentries, removed names leave holes (dentry 0) behind
+    unsigned int dentry_capacity;
+    unsigned int name_count;        // names in dentries, not counting the holes
+    struct indexed_name *name_index;    // open addressing by name hash; NULL until the first lookup
+    unsigned int name_index_size;   // slots in name_index, a power of two
+    size_t *removals;           // remove records that hide a name of the base entry and so must be kept
+    unsigned int removal_count;
+    unsigned int removal_capacity;
+    unsigned long lookups;      // references taken with WFS_HOLD, the kernel's through the low-level API
+    int orphan;                 // unlinked while the kernel still held references, dropped with the last one
+    uint64_t generation;        // taken from extent_generation whenever its extents change, 0 while it has none
+    unsigned int atime;         // access time newer than its latest entry's, not yet in the log
+    struct write_buffer *dirty; // small writes to a file not yet in the log, NULL if there are none
+};
+
+// Source of inode generations, never reused so a cursor can't mistake a rebuilt inode for the one it knew
+static uint64_t extent_generation;
+
+// Small writes to a file are gathered in a buffer of this size and appended as one extent entry
+#define WRITE_BUFFER_SIZE (64 * 1024)
+// Buffered writes go to the log once the first of them is this many seconds old
+#define WRITE_BUFFER_AGE 1
+// Memory all write buffers may take, writes to other files go straight to the log past it
+#define WRITE_BUFFER_LIMIT (16 * 1024 * 1024)
+
+// Bytes written to a file but not yet appended, a single run of them. Reads and stat lay them over the
+// file's extents
+struct write_buffer {
+    size_t offset;              // file offset of the first byte
+    size_t length;
+    time_t started;             // when the first write went in
+    time_t mtime;               // when the last write went in
+    unsigned int position;      // place in dirty_inodes, under write_buffer_lock
+    char data[WRITE_BUFFER_SIZE];
+};
+
+// A file with a write buffer
+struct dirty_inode {
+    unsigned int inode_number;
+    struct write_buffer *buffer;
+};
+
+// Files with write buffers in no particular order, for flushing them when they get old, and the memory
+// the buffers take
+static struct dirty_inode *dirty_inodes;
+static unsigned int dirty_count;
+static unsigned int dirty_capacity;
+static size_t buffered_bytes;
+static pthread_mutex_t write_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// An open file, from wfs_open to wfs_release
+struct wfs_file {
+    unsigned int inode_number;
+    // where the last read through it stopped, so a sequential read carries on without searching the extents
+    pthread_mutex_t cursor_lock;
+    uint64_t generation;        // the inode's generation when the cursor was taken, the cursor is stale otherwise
+    size_t next_offset;         // file offset the last read ended at
+    unsigned int extent;        // first extent ending after next_offset
+    char *snapshot;             // what the statistics file read when it was opened, NULL for other files
+    size_t snapshot_length;
+};
+
+// Lookups hold the log lock shared, the first one to look a name up in a directory builds its name index under this
+static pthread_mutex_t name_index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Size of a dentry add/remove record
+#define DENTRY_ENTRY_SIZE (sizeof(struct wfs_log_entry) + sizeof(struct wfs_dentry))
+// Size of a checkpoint part without its entries
+#define CHECKPOINT_PART_SIZE (sizeof(struct wfs_log_entry) + sizeof(struct wfs_checkpoint))
+
+// inode number -> in-memory inode state
+static struct inode_state *inode_map;
+static unsigned int inode_map_capacity;
+
+// bytes of the log held by live entries
+static size_t live_size;
+
+// Checkpoint the inode map after this many bytes have been appended, or CHECKPOINT_GROWTH times the size
+// of the last checkpoint if that is more: a checkpoint lists every live entry, so with a fixed interval
+// their cost per appended byte would grow with the number of files and extents
+#ifndef CHECKPOINT_INTERVAL
+#define CHECKPOINT_INTERVAL (256 * 1024)
+#endif
+#define CHECKPOINT_GROWTH 4
+
+static struct wfs_checkpoint *last_checkpoint;    // its last part
+static size_t *checkpoint_parts;                   // log offsets of all its parts, first to last
+static unsigned int checkpoint_part_count;
+static unsigned int checkpoint_part_capacity;
+static size_t checkpoint_entry_count;              // live entries it lists, over all parts
+static size_t checkpoint_size;                     // bytes of all its parts, read without the log lock
+static size_t appended_since_checkpoint;          // read without the log lock to tell whether a checkpoint is due
+static size_t entries_since_checkpoint;    // at most this many log entries were added since the last checkpoint
+
+// superblock generation the inode map was built from, fsck.wfs bumps it when it compacts the log
+static uint32_t mounted_generation;
+
+// Path -> inode number cache, including negative (WFS_NO_INODE) entries for paths that don't exist. Handlers
+// that only know a directory and a name can't find the paths they change, so a positive entry holds until
+// the next name is unlinked and a negative one until the next name is created. Longer paths aren't cached
+#define MAX_PATH_LEN 128
+#define DCACHE_SIZE 4096
+
+struct dcache_entry {
+    char path[MAX_PATH_LEN];
+    unsigned int inode_number;
+    int valid;
+    unsigned long changes;      // names_unlinked when it was cached, or names_created for a negative entry
+};
+
+static struct dcache_entry dcache[DCACHE_SIZE];
+static unsigned long dcache_hits;
+static unsigned long dcache_misses;
+static unsigned long names_created;    // changed with the log lock held exclusively
+static unsigned long names_unlinked;
+static pthread_mutex_t dcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *op_names[OP_COUNT] = {"lookup", "getattr", "mknod", "mkdir", "create", "open", "read", "write", "readdir", "unlink", "fsync"};
+
+// Latencies are counted in buckets of powers of two nanoseconds, the last one takes everything slower
+#define LATENCY_BUCKETS 32
+
+// Statistics gathered by one thread. Only the thread owning it writes to it, so counting takes no lock
+// and no atomic read-modify-write; the statistics file adds up those of all threads
+struct thread_stats {
+    unsigned long calls[OP_COUNT];
+    unsigned long errors[OP_COUNT];
+    unsigned long nanoseconds[OP_COUNT];
+    unsigned long latency[OP_COUNT][LATENCY_BUCKETS];   // calls taking [2^i, 2^(i+1)) ns
+    unsigned long bytes_appended;       // log entries appended, checkpoints included
+    unsigned long bytes_superseded;     // log entries that turned into garbage, replay aside
+    unsigned long bytes_written;        // file bytes written, buffered or not
+    unsigned long buffers_flushed;      // write buffers appended as an extent entry
+    unsigned long syncs;                // times the log was synced to the disk
+    unsigned long cleaner_steps;
+    unsigned long cleaner_scanned;      // entries of victim segments the cleaner looked at
+    struct log_ring *log_ring;          // messages the thread logged for the logger thread to write out
+    struct uring *uring;                // the thread's io_uring with STORAGE_URING, see own_uring()
+    struct thread_stats *next;
+    int in_use;                         // 0 once its thread exited, the next thread to start takes it over
+};
+
+static struct thread_stats *all_stats;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stats_key;
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+static __thread struct thread_stats *own_stats_cache;
+
+// When the statistics started, at mount
+static time_t stats_since;
+
+// Log entries the last mount or reload replayed past the checkpoint
+static size_t replayed_entries;
+
+// Set while the inode map is rebuilt, what that finds superseded was counted by an earlier mount
+static int replaying;
+
+// Hand the statistics of an exiting thread over to the next one
+static void release_thread_stats(void *stats)
+{
+    pthread_mutex_lock(&stats_lock);
+    ((struct thread_stats *)stats)->in_use = 0;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void create_stats_key()
+{
+    pthread_key_create(&stats_key, release_thread_stats);
+}
+
+// Get the statistics of the calling thread, taking a free one or a new one on its first count
+static struct thread_stats *own_stats()
+{
+    if (own_stats_cache != NULL)
+        return own_stats_cache;
+
+    pthread_once(&stats_key_once, create_stats_key);
+    pthread_mutex_lock(&stats_lock);
+    struct thread_stats *stats = all_stats;
+    while (stats != NULL && stats->in_use)
+        stats = stats->next;
+    if (stats == NULL)
+    {
+        stats = calloc(1, sizeof(struct thread_stats));
+        if (stats == NULL)
+        {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+        stats->next = all_stats;
+        all_stats = stats;
+    }
+    stats->in_use = 1;
+    pthread_mutex_unlock(&stats_lock);
+
+    pthread_setspecific(stats_key, stats);
+    own_stats_cache = stats;
+    return stats;
+}
+
+// Add to a counter of the calling thread's statistics. A plain add, the store is only atomic for the
+// statistics file reading it meanwhile
+#define STAT(counter, amount) __atomic_store_n(&own_stats()->counter, own_stats()->counter + (amount), __ATOMIC_RELAXED)
+
+// Current time in nanoseconds for timing operations
+unsigned long wfs_stats_clock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+// Count an operation that started at start (from wfs_stats_clock) and ended with result, negative on an error
+void wfs_count_op(int op, unsigned long start, int result)
+{
+    unsigned long elapsed = wfs_stats_clock() - start;
+    unsigned int bucket = 63 - __builtin_clzl(elapsed | 1);
+    if (bucket >= LATENCY_BUCKETS)
+        bucket = LATENCY_BUCKETS - 1;
+
+    // As STAT, looking up the thread's counters once
+    struct thread_stats *stats = own_stats();
+    __atomic_store_n(&stats->calls[op], stats->calls[op] + 1, __ATOMIC_RELAXED);
+    if (result < 0)
+        __atomic_store_n(&stats->errors[op], stats->errors[op] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->nanoseconds[op], stats->nanoseconds[op] + elapsed, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->latency[op][bucket], stats->latency[op][bucket] + 1, __ATOMIC_RELAXED);
+}
+
+// Messages above this level are skipped, see libwfs.h
+static int log_level = LEVEL_INFO;
+static const char *level_names[] = {"error", "warn", "info", "debug", "trace"};
+
+void wfs_set_log_level(int level)
+{
+    log_level = level;
+}
+
+int wfs_log_level()
+{
+    return log_level;
+}
+
+const char *wfs_level_name(int level)
+{
+    return level >= LEVEL_ERROR && level <= LEVEL_TRACE ? level_names[level] : NULL;
+}
+
+// With debug or trace messages on, threads only copy their messages into a ring of their own and the
+// logger thread writes them out, so stdout's lock and writes stay off the requests
+#define LOG_RING_SIZE (1024 * 1024)
+#define LOG_LINE_MAX 512
+// How long the logger thread sleeps between writing out the rings, unless a ring fills up to half
+#define LOG_DRAIN_INTERVAL_NS 10000000
+
+// Only the thread owning the ring moves written and only the logger thread moves drained. Both only
+// grow, the text of byte n is at n % LOG_RING_SIZE
+struct log_ring {
+    char text[LOG_RING_SIZE];
+    size_t written;
+    size_t drained;
+    unsigned long dropped;              // messages that didn't fit
+    unsigned long dropped_reported;
+};
+
+static pthread_mutex_t logger_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logger_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_t logger_thread;
+static int logger_running;
+static int logger_stop;
+
+// Write a message to stdout, through the calling thread's ring while the logger thread runs.
+// A full ring drops the message rather than wait
+void wfs_log_message(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    if (!__atomic_load_n(&logger_running, __ATOMIC_ACQUIRE))
+    {
+        vprintf(format, args);
+        va_end(args);
+        return;
+    }
+
+    char line[LOG_LINE_MAX];
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length < 0)
+        return;
+    if (length >= LOG_LINE_MAX)
+    {
+        length = LOG_LINE_MAX - 1;
+        line[length - 1] = '\n';
+    }
+
+    struct thread_stats *stats = own_stats();
+    struct log_ring *ring = stats->log_ring;
+    if (ring == NULL)
+    {
+        ring = calloc(1, sizeof(struct log_ring));
+        if (ring == NULL)
+        {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+        __atomic_store_n(&stats->log_ring, ring, __ATOMIC_RELEASE);
+    }
+
+    size_t used = ring->written - __atomic_load_n(&ring->drained, __ATOMIC_ACQUIRE);
+    if (used + length > LOG_RING_SIZE)
+    {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    size_t at = ring->written % LOG_RING_SIZE;
+    size_t first = length < LOG_RING_SIZE - at ? length : LOG_RING_SIZE - at;
+    memcpy(ring->text + at, line, first);
+    memcpy(ring->text, line + first, length - first);
+    __atomic_store_n(&ring->written, ring->written + length, __ATOMIC_RELEASE);
+
+    // wake the logger thread early when the ring reaches half full, rather than wait for it to drop
+    if (used < LOG_RING_SIZE / 2 && used + length >= LOG_RING_SIZE / 2)
+    {
+        pthread_mutex_lock(&logger_lock);
+        pthread_cond_signal(&logger_wakeup);
+        pthread_mutex_unlock(&logger_lock);
+    }
+}
+
+// Write out what every thread logged since the last time. Each ring is written whole, so lines of
+// one thread stay in order, lines of different threads only in the order of the rings
+static void drain_log_rings()
+{
+    pthread_mutex_lock(&stats_lock);
+    struct thread_stats *first = all_stats;
+    pthread_mutex_unlock(&stats_lock);
+
+    // threads put their statistics in front, the ones after first are there for good
+    for (struct thread_stats *stats = first; stats != NULL; stats = stats->next)
+    {
+        struct log_ring *ring = __atomic_load_n(&stats->log_ring, __ATOMIC_ACQUIRE);
+        if (ring == NULL)
+            continue;
+
+        size_t written = __atomic_load_n(&ring->written, __ATOMIC_ACQUIRE);
+        size_t drained = ring->drained;
+        while (drained < written)
+        {
+            size_t at = drained % LOG_RING_SIZE;
+            size_t length = written - drained < LOG_RING_SIZE - at ? written - drained : LOG_RING_SIZE - at;
+            fwrite(ring->text + at, 1, length, stdout);
+            drained += length;
+        }
+        __atomic_store_n(&ring->drained, drained, __ATOMIC_RELEASE);
+
+        unsigned long dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        if (dropped != ring->dropped_reported)
+        {
+            printf("%lu log messages dropped\n", dropped - ring->dropped_reported);
+            ring->dropped_reported = dropped;
+        }
+    }
+    fflush(stdout);
+}
+
+static void *logger_main(void *arg)
+{
+    pthread_mutex_lock(&logger_lock);
+    while (!logger_stop)
+    {
+        pthread_mutex_unlock(&logger_lock);
+        drain_log_rings();
+        pthread_mutex_lock(&logger_lock);
+
+        struct timespec wakeup;
+        clock_gettime(CLOCK_REALTIME, &wakeup);
+        wakeup.tv_nsec += LOG_DRAIN_INTERVAL_NS;
+        if (wakeup.tv_nsec >= 1000000000)
+        {
+            wakeup.tv_sec++;
+            wakeup.tv_nsec -= 1000000000;
+        }
+        if (!logger_stop)
+            pthread_cond_timedwait(&logger_wakeup, &logger_lock, &wakeup);
+    }
+    pthread_mutex_unlock(&logger_lock);
+
+    return NULL;
+}
+
+// Start writing messages through the rings if debug or trace messages are on
+static void start_logger()
+{
+    if (log_level < LEVEL_DEBUG || WFS_LOG_LEVEL < LEVEL_DEBUG)
+        return;
+
+    if (pthread_create(&logger_thread, NULL, logger_main, NULL) == 0)
+        __atomic_store_n(&logger_running, 1, __ATOMIC_RELEASE);
+}
+
+// Write out the rest and log straight to stdout again
+static void stop_logger()
+{
+    if (!logger_running)
+        return;
+
+    pthread_mutex_lock(&logger_lock);
+    logger_stop = 1;
+    pthread_cond_signal(&logger_wakeup);
+    pthread_mutex_unlock(&logger_lock);
+
+    pthread_join(logger_thread, NULL);
+    logger_stop = 0;
+    __atomic_store_n(&logger_running, 0, __ATOMIC_RELEASE);
+    drain_log_rings();
+}
+
+////// STORAGE ///////
+
+// Where file bytes are read from and how the log gets to the disk, see libwfs.h
+static int storage = STORAGE_MMAP;
+static const char *storage_names[] = {"mmap", "uring"};
+
+void wfs_set_storage(int backend)
+{
+    storage = backend;
+}
+
+const char *wfs_storage_name(int backend)
+{
+    return backend >= STORAGE_MMAP && backend <= STORAGE_URING ? storage_names[backend] : NULL;
+}
+
+// A range of the image to write through to the disk
+struct sync_range {
+    char *start;
+    char *end;
+};
+
+// A range of the image to copy into memory
+struct storage_read {
+    char *to;
+    const char *from;
+    size_t length;
+};
+
+// What the engine leaves to a storage backend. Entries are always built and looked at in place in the
+// mapping of the image; a backend copies file bytes out of it for requests, is told when the head moves
+// past a segment and writes ranges of it through to the disk
+struct storage_backend {
+    const char *name;
+    int (*start)();             // 0, or a negative errno if it can't be used
+    void (*stop)();
+    int in_place;               // whether readers may be handed the mapping itself
+    void (*read)(struct storage_read *reads, unsigned int count);
+    void (*segment_done)(char *start, size_t length);
+    int (*sync)(struct sync_range *ranges, unsigned int count);     // 0 or -EIO
+};
+
+static int mmap_start()
+{
+    return 0;
+}
+
+static void mmap_stop()
+{
+}
+
+// Copy straight out of the mapping, faulting in whatever isn't in memory one page at a time
+static void mmap_read(struct storage_read *reads, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++)
+        memcpy(reads[i].to, reads[i].from, reads[i].length);
+}
+
+// The kernel's writeback decides when a finished segment goes out
+static void mmap_segment_done(char *start, size_t length)
+{
+}
+
+static int mmap_sync(struct sync_range *ranges, unsigned int count)
+{
+    // msync takes whole pages, the mapping starts on one
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    int result = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        char *start = base + (ranges[i].start - base) / page_size * page_size;
+        if (ranges[i].end > ranges[i].start && msync(start, ranges[i].end - start, MS_SYNC) == -1)
+        {
+            LOG(LEVEL_ERROR, "Syncing the image: %s\n", strerror(errno));
+            result = -EIO;
+        }
+    }
+    return result;
+}
+
+static struct storage_backend mmap_backend = {"mmap", mmap_start, mmap_stop, 1, mmap_read, mmap_segment_done, mmap_sync};
+
+// Requests a thread's io_uring has in flight at most
+#define URING_QUEUE_DEPTH 32
+// Longest read or sync of a single request, the kernel takes 32 bits
+#define URING_MAX_LENGTH (1U << 30)
+
+// A thread's io_uring, with its queues mapped from the kernel. Only the thread owning the statistics it
+// hangs off uses it, see own_uring()
+struct uring {
+    int fd;
+    void *rings;
+    size_t rings_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned int *sq_tail;
+    unsigned int sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned int tail;          // of the submission queue, with what was prepared since the last submission
+    unsigned int queued;        // prepared and not submitted yet
+    unsigned int in_flight;     // submitted and not reaped yet, segment writes included
+};
+
+static void close_uring(struct uring *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->rings, ring->rings_size);
+    close(ring->fd);
+    free(ring);
+}
+
+// Set up an io_uring with both queues in one mapping, NULL with errno set if the kernel has none
+static struct uring *open_uring()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, URING_QUEUE_DEPTH, &params);
+    if (fd == -1)
+        return NULL;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        close(fd);
+        errno = ENOSYS;
+        return NULL;
+    }
+
+    struct uring *ring = calloc(1, sizeof(struct uring));
+    if (ring == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    ring->fd = fd;
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->rings_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->rings == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        int error = errno;
+        if (ring->rings != MAP_FAILED)
+            munmap(ring->rings, ring->rings_size);
+        if (ring->sqes != MAP_FAILED)
+            munmap(ring->sqes, ring->sqes_size);
+        close(fd);
+        free(ring);
+        errno = error;
+        return NULL;
+    }
+
+    char *rings = ring->rings;
+    ring->sq_tail = (unsigned int *)(rings + params.sq_off.tail);
+    ring->tail = *ring->sq_tail;
+    ring->sq_mask = *(unsigned int *)(rings + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)(rings + params.sq_off.array);
+    ring->cq_head = (unsigned int *)(rings + params.cq_off.head);
+    ring->cq_tail = (unsigned int *)(rings + params.cq_off.tail);
+    ring->cq_mask = *(unsigned int *)(rings + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(rings + params.cq_off.cqes);
+    return ring;
+}
+
+// Get the calling thread's io_uring, setting it up on first use. NULL if that fails
+static struct uring *own_uring()
+{
+    struct thread_stats *stats = own_stats();
+
+    if (stats->uring == NULL)
+    {
+        stats->uring = open_uring();
+        if (stats->uring == NULL)
+            LOG(LEVEL_WARN, "No io_uring for a thread, it goes through the mapping: %s\n", strerror(errno));
+    }
+    return stats->uring;
+}
+
+// Take the next free entry of the submission queue, there has to be one
+static struct io_uring_sqe *uring_prepare(struct uring *ring)
+{
+    unsigned int index = ring->tail++ & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+    ring->queued++;
+    ring->in_flight++;
+    return sqe;
+}
+
+// Submit what was prepared and wait for wait_for completions, if any. Returns 0 or a negative errno,
+// with whatever the kernel didn't take still queued
+static int uring_enter(struct uring *ring, unsigned int wait_for)
+{
+    __atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+
+    int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->queued, wait_for, wait_for ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (submitted == -1)
+        return -errno;
+    ring->queued -= submitted;
+    return 0;
+}
+
+// Take back what the kernel didn't take, the entries last prepared. Returns how many
+static unsigned int uring_unqueue(struct uring *ring)
+{
+    unsigned int unqueued = ring->queued;
+
+    ring->tail -= unqueued;
+    ring->in_flight -= unqueued;
+    ring->queued = 0;
+    __atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+    return unqueued;
+}
+
+// Hand the completions in the queue to results, by the index user_data is one more than. Segment writes
+// carry no index, they only leave the queue
+static void uring_reap(struct uring *ring, int *results, unsigned int *done)
+{
+    unsigned int head = *ring->cq_head;
+    unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+        if (cqe->user_data != 0)
+        {
+            results[cqe->user_data - 1] = cqe->res;
+            (*done)++;
+        }
+        else if (cqe->res < 0)
+        {
+            LOG(LEVEL_WARN, "Writing out a segment: %s\n", strerror(-cqe->res));
+        }
+        ring->in_flight--;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Fills in the request for the index-th of a batch
+typedef void (*uring_request_t)(struct io_uring_sqe *sqe, void *batch, unsigned int index);
+
+// Run count requests on the calling thread's io_uring, as many at once as the queue takes, with their
+// results in results. Returns 0 once they have all completed, or a negative errno with none submitted
+static int uring_run(uring_request_t request, void *batch, unsigned int count, int *results)
+{
+    struct uring *ring = own_uring();
+    if (ring == NULL)
+        return -ENOSYS;
+
+    unsigned int next = 0, done = 0;
+    while (done < count)
+    {
+        while (next < count && ring->in_flight < URING_QUEUE_DEPTH)
+        {
+            struct io_uring_sqe *sqe = uring_prepare(ring);
+            request(sqe, batch, next);
+            sqe->user_data = ++next;
+        }
+
+        int result = uring_enter(ring, 1);
+        if (result < 0 && result != -EINTR && result != -EAGAIN && result != -EBUSY)
+        {
+            next -= uring_unqueue(ring);
+            if (next == done)
+                return result;
+
+            // the requests submitted write into memory the caller is about to let go of
+            LOG(LEVEL_ERROR, "io_uring failed with requests in flight: %s\n", strerror(-result));
+            exit(EXIT_FAILURE);
+        }
+        uring_reap(ring, results, &done);
+    }
+    return 0;
+}
+
+static void uring_read_request(struct io_uring_sqe *sqe, void *batch, unsigned int index)
+{
+    struct storage_read *read = &((struct storage_read *)batch)[index];
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = disk_fd;
+    sqe->addr = (uintptr_t)read->to;
+    sqe->len = read->length < URING_MAX_LENGTH ? read->length : URING_MAX_LENGTH;
+    sqe->off = read->from - base;
+}
+
+static int uring_start()
+{
+    return own_uring() == NULL ? -errno : 0;
+}
+
+// Close every thread's io_uring, with no requests coming in any more
+static void uring_stop()
+{
+    pthread_mutex_lock(&stats_lock);
+    for (struct thread_stats *stats = all_stats; stats != NULL; stats = stats->next)
+    {
+        if (stats->uring != NULL)
+            close_uring(stats->uring);
+        stats->uring = NULL;
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+// Read all the ranges at once through the page cache the mapping shares, so a cold read waits for the
+// disk once rather than once per page fault. Whatever a read comes back short of is copied from the mapping
+static void uring_read(struct storage_read *reads, unsigned int count)
+{
+    int *results = malloc(count * sizeof(int));
+    if (results == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    if (uring_run(uring_read_request, reads, count, results) < 0)
+        memset(results, 0, count * sizeof(int));
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        size_t got = results[i] > 0 ? results[i] : 0;
+        if (got < reads[i].length)
+            memcpy(reads[i].to + got, reads[i].from + got, reads[i].length - got);
+    }
+    free(results);
+}
+
+// Start writing a segment out as soon as the head moves past it, rather than whenever the kernel gets to
+// it, without waiting for it. Entries still being copied into it go out again with the next sync
+static void uring_segment_done(char *start, size_t length)
+{
+    struct uring *ring = own_uring();
+    if (ring == NULL)
+        return;
+
+    unsigned int done = 0;
+    uring_reap(ring, NULL, &done);
+    if (ring->in_flight >= URING_QUEUE_DEPTH)
+        return;
+
+    struct io_uring_sqe *sqe = uring_prepare(ring);
+    sqe->opcode = IORING_OP_SYNC_FILE_RANGE;
+    sqe->fd = disk_fd;
+    sqe->off = start - base;
+    sqe->len = length < URING_MAX_LENGTH ? length : URING_MAX_LENGTH;
+    sqe->sync_range_flags = SYNC_FILE_RANGE_WRITE;
+    if (uring_enter(ring, 0) < 0)
+        uring_unqueue(ring);
+}
+
+static void uring_sync_request(struct io_uring_sqe *sqe, void *batch, unsigned int index)
+{
+    struct sync_range *range = &((struct sync_range *)batch)[index];
+
+    sqe->opcode = IORING_OP_SYNC_FILE_RANGE;
+    sqe->fd = disk_fd;
+    sqe->off = range->start - base;
+    sqe->len = range->end - range->start;
+    sqe->sync_range_flags = SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER;
+}
+
+static void uring_barrier_request(struct io_uring_sqe *sqe, void *batch, unsigned int index)
+{
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = disk_fd;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+}
+
+// Write all the ranges out at once, each with a sync_file_range that waits for its pages, then make them
+// durable with one fdatasync -- sync_file_range alone neither flushes the disk's cache nor writes the
+// metadata that finds the pages. A request's length has only 32 bits, longer ranges go through msync
+static int uring_sync(struct sync_range *ranges, unsigned int count)
+{
+    struct sync_range *batch = malloc(count * sizeof(struct sync_range));
+    int *results = malloc(count * sizeof(int));
+    if (batch == NULL || results == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned int batch_count = 0;
+    int result = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (ranges[i].end <= ranges[i].start)
+            continue;
+        if ((size_t)(ranges[i].end - ranges[i].start) > URING_MAX_LENGTH)
+            result |= mmap_sync(&ranges[i], 1);
+        else
+            batch[batch_count++] = ranges[i];
+    }
+
+    // the barrier only goes out once every range has been written
+    int barrier = 0;
+    if (batch_count > 0 && (uring_run(uring_sync_request, batch, batch_count, results) < 0 ||
+                            uring_run(uring_barrier_request, NULL, 1, &barrier) < 0))
+    {
+        result |= mmap_sync(batch, batch_count);
+    }
+    else
+    {
+        for (unsigned int i = 0; i < batch_count; i++)
+        {
+            if (results[i] < 0)
+            {
+                LOG(LEVEL_ERROR, "Syncing the image: %s\n", strerror(-results[i]));
+                result = -EIO;
+            }
+        }
+        if (barrier < 0)
+        {
+            LOG(LEVEL_ERROR, "Syncing the image: %s\n", strerror(-barrier));
+            result = -EIO;
+        }
+    }
+
+    free(results);
+    free(batch);
+    return result;
+}
+
+static struct storage_backend uring_backend = {"uring", uring_start, uring_stop, 0, uring_read, uring_segment_done, uring_sync};
+
+static struct storage_backend *storage_backends[] = {&mmap_backend, &uring_backend};
+
+// The backend of the open image, mmap_backend if the one chosen couldn't start
+static struct storage_backend *backend = &mmap_backend;
+
+// Get the start of a segment
+static char *segment_start(unsigned int segment)
+{
+    return log_start + segment * segment_size;
+}
+
+// Get the segment a log offset falls in
+static unsigned int segment_of(size_t offset)
+{
+    return (offset - (log_start - base)) / segment_size;
+}
+
+// Count live bytes of a log entry in (or, with negative bytes, out of) its segment
+static void add_segment_live(size_t entry, long bytes)
+{
+    COUNT(segments[segment_of(entry)].live_bytes, bytes);
+}
+
+// Count the segments that are free to be started
+static unsigned int free_segments()
+{
+    return free_segment_count;
+}
+
+// Get the segment the log continues in after the one with the given sequence, NO_SEGMENT at the end of the log.
+// Only knows the segments found by the last load_segments()
+static unsigned int next_segment(uint32_t sequence)
+{
+    unsigned int low = 0, high = log_order_count;
+
+    while (low < high)
+    {
+        unsigned int middle = low + (high - low) / 2;
+        if (segments[log_order[middle]].sequence > sequence)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+
+    return low < log_order_count ? log_order[low] : NO_SEGMENT;
+}
+
+// Get the in-memory state of an inode, NULL if it has no live log entry
+static struct inode_state *get_inode_state(unsigned int inode_number)
+{
+    if (inode_number >= inode_map_capacity || inode_map[inode_number].entry == 0)
+        return NULL;
+
+    return &inode_map[inode_number];
+}
+
+// Get the latest live log entry of an inode through the inode map, NULL if it has none
+static struct wfs_log_entry *get_inode_entry(unsigned int inode_number)
+{
+    struct inode_state *state = get_inode_state(inode_number);
+
+    if (state == NULL)
+        return NULL;
+
+    return (struct wfs_log_entry *)(base + state->entry);
+}
+
+// Grow the inode map so it has a slot for the given inode number
+static void grow_inode_map(unsigned int inode_number)
+{
+    if (inode_number < inode_map_capacity)
+        return;
+
+    unsigned int new_capacity = inode_map_capacity ? inode_map_capacity : 64;
+    while (new_capacity <= inode_number)
+        new_capacity *= 2;
+
+    struct inode_state *new_map = realloc(inode_map, new_capacity * sizeof(struct inode_state));
+    if (new_map == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    // offset 0 is the superblock, so it doubles as "no entry"
+    memset(new_map + inode_map_capacity, 0, (new_capacity - inode_map_capacity) * sizeof(struct inode_state));
+    inode_map = new_map;
+    inode_map_capacity = new_capacity;
+}
+
+// Order log offsets for qsort
+static int compare_offsets(const void *a, const void *b)
+{
+    size_t first = *(const size_t *)a, second = *(const size_t *)b;
+
+    return (first > second) - (first < second);
+}
+
+// Upper bound on the number of log entries an inode uses
+static unsigned int inode_entry_bound(struct inode_state *state)
+{
+    return 2 + state->extent_count + state->dentry_count + state->removal_count;
+}
+
+// Gather the distinct log entries an inode uses, sorted by offset; offsets needs room for
+// inode_entry_bound() of them. Returns how many there are
+static unsigned int inode_live_entries(struct inode_state *state, size_t *offsets)
+{
+    unsigned int count = 0;
+
+    offsets[count++] = state->entry;
+    if (state->base != 0)
+        offsets[count++] = state->base;
+    for (unsigned int j = 0; j < state->extent_count; j++)
+        offsets[count++] = state->extents[j].entry;
+    for (unsigned int j = 0; j < state->dentry_count; j++)
+    {
+        if (state->dentries[j].entry != 0)
+            offsets[count++] = state->dentries[j].entry;
+    }
+    for (unsigned int j = 0; j < state->removal_count; j++)
+        offsets[count++] = state->removals[j];
+
+    // an entry can hold several extents or names of its inode, keep it once
+    qsort(offsets, count, sizeof(size_t), compare_offsets);
+    unsigned int unique = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (unique == 0 || offsets[i] != offsets[unique - 1])
+            offsets[unique++] = offsets[i];
+    }
+
+    return unique;
+}
+
+// Drop a write buffer and what it holds, the caller clears its inode's dirty
+static void remove_write_buffer(struct write_buffer *buffer)
+{
+    pthread_mutex_lock(&write_buffer_lock);
+    dirty_inodes[buffer->position] = dirty_inodes[--dirty_count];
+    dirty_inodes[buffer->position].buffer->position = buffer->position;
+    buffered_bytes -= sizeof(struct write_buffer);
+    pthread_mutex_unlock(&write_buffer_lock);
+
+    free(buffer);
+}
+
+// Free the in-memory state of an inode without looking at the log, buffered writes included
+static void clear_inode_state(struct inode_state *state)
+{
+    if (state->dirty != NULL)
+        remove_write_buffer(state->dirty);
+    free(state->extents);
+    free(state->dentries);
+    free(state->name_index);
+    free(state->removals);
+    memset(state, 0, sizeof(struct inode_state));
+}
+
+// Drop an inode from the inode map once it no longer has a live log entry
+static void remove_inode_entry(unsigned int inode_number)
+{
+    struct inode_state *state = get_inode_state(inode_number);
+
+    if (state != NULL)
+    {
+        COUNT(live_size, -state->live_size);
+        if (!replaying)
+            STAT(bytes_superseded, state->live_size);
+
+        // its entries become garbage in whichever segments hold them
+        size_t *entries = malloc(inode_entry_bound(state) * sizeof(size_t));
+        if (entries == NULL)
+        {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+        unsigned int entry_count = inode_live_entries(state, entries);
+        for (unsigned int i = 0; i < entry_count; i++)
+            add_segment_live(entries[i], -(long)((struct wfs_log_entry *)(base + entries[i]))->inode.size);
+        free(entries);
+
+        clear_inode_state(state);
+    }
+}
+
+static int name_position(struct inode_state *state, const char *name);
+
+// Check whether a log entry still holds the latest attributes, any bytes or any names of its inode
+static int entry_in_use(struct inode_state *state, size_t entry)
+{
+    if (state->entry == entry || state->base == entry)
+        return 1;
+
+    for (unsigned int i = 0; i < state->extent_count; i++)
+    {
+        if (state->extents[i].entry == entry)
+            return 1;
+    }
+
+    // names are held by the base entry or by add records of a single name each, the name index tells
+    // whether that is still the one in use
+    if (state->dentry_count > 0 && ((struct wfs_log_entry *)(base + entry))->inode.flags == WFS_ENTRY_DENTRY_ADD)
+    {
+        size_t dentry = entry + sizeof(struct wfs_log_entry);
+        int position = name_position(state, ((struct wfs_dentry *)(base + dentry))->name);
+        if (position < 0)
+            return 0;
+        if (state->dentries[position].dentry == dentry)
+            return 1;
+
+        // a replay can leave a name twice
+        for (unsigned int i = 0; i < state->dentry_count; i++)
+        {
+            if (state->dentries[i].entry == entry)
+                return 1;
+        }
+    }
+
+    for (unsigned int i = 0; i < state->removal_count; i++)
+    {
+        if (state->removals[i] == entry)
+            return 1;
+    }
+
+    return 0;
+}
+
+// Count a log entry as garbage once nothing of it is in use anymore
+static void release_entry(struct inode_state *state, size_t entry)
+{
+    if (!entry_in_use(state, entry))
+    {
+        unsigned int size = ((struct wfs_log_entry *)(base + entry))->inode.size;
+        state->live_size -= size;
+        COUNT(live_size, -(size_t)size);
+        if (!replaying)
+            STAT(bytes_superseded, size);
+        add_segment_live(entry, -(long)size);
+    }
+}
+
+// Make room for one more element in a growable array
+static void *reserve_slot(void *array, unsigned int count, unsigned int *capacity, size_t element_size)
+{
+    if (count < *capacity)
+        return array;
+
+    unsigned int new_capacity = *capacity ? *capacity * 2 : 4;
+    void *new_array = realloc(array, new_capacity * element_size);
+    if (new_array == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    *capacity = new_capacity;
+    return new_array;
+}
+
+// Hash a path for the dentry cache, or a name for a directory's name index (FNV-1a)
+static unsigned int hash_path(const char *path)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*path != '\0')
+    {
+        hash ^= (unsigned char)*path++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// Get the name a position of a directory's dentries holds
+static const char *dentry_name(struct inode_state *state, unsigned int position)
+{
+    return ((struct wfs_dentry *)(base + state->dentries[position].dentry))->name;
+}
+
+// Enter a name with its hash into a directory's name index
+static void index_name(struct inode_state *state, unsigned int position, unsigned int hash)
+{
+    unsigned int mask = state->name_index_size - 1;
+    unsigned int slot = hash & mask;
+
+    while (state->name_index[slot].position != 0)
+        slot = (slot + 1) & mask;
+    state->name_index[slot].position = position + 1;
+    state->name_index[slot].hash = hash;
+}
+
+// (Re)build a directory's name index over its names, at most half full. Growing an index moves the
+// hashes it holds, only a first build or one after the names moved reads them all from the log
+static void build_name_index(struct inode_state *state, int names_moved)
+{
+    unsigned int size = 16;
+    while (size < 2 * state->name_count + 2)
+        size *= 2;
+
+    struct indexed_name *name_index = calloc(size, sizeof(struct indexed_name));
+    if (name_index == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    struct indexed_name *old_index = state->name_index;
+    unsigned int old_size = state->name_index_size;
+    state->name_index = name_index;
+    state->name_index_size = size;
+    if (old_index != NULL && !names_moved)
+    {
+        for (unsigned int i = 0; i < old_size; i++)
+        {
+            if (old_index[i].position != 0)
+                index_name(state, old_index[i].position - 1, old_index[i].hash);
+        }
+    }
+    else
+    {
+        for (unsigned int i = 0; i < state->dentry_count; i++)
+        {
+            if (state->dentries[i].dentry != 0)
+                index_name(state, i, hash_path(dentry_name(state, i)));
+        }
+    }
+    free(old_index);
+}
+
+// Find the slot of a directory's name index holding a name, or the empty slot its probing ends at.
+// Builds the index on first use; lookups holding the log lock shared may get here side by side
+static unsigned int name_slot(struct inode_state *state, const char *name)
+{
+    struct indexed_name *name_index = __atomic_load_n(&state->name_index, __ATOMIC_ACQUIRE);
+    if (name_index == NULL)
+    {
+        pthread_mutex_lock(&name_index_lock);
+        if (state->name_index == NULL)
+        {
+            // build it aside and publish it whole, the others read it without the lock. Only the names are
+            // copied, access times change under a shared lock too
+            struct inode_state built = {.dentries = state->dentries, .dentry_count = state->dentry_count, .name_count = state->name_count};
+            build_name_index(&built, 1);
+            state->name_index_size = built.name_index_size;
+            __atomic_store_n(&state->name_index, built.name_index, __ATOMIC_RELEASE);
+        }
+        name_index = state->name_index;
+        pthread_mutex_unlock(&name_index_lock);
+    }
+
+    // probing compares the hashes kept in the index, a name in the log is only read when they match
+    unsigned int mask = state->name_index_size - 1;
+    unsigned int hash = hash_path(name);
+    unsigned int slot = hash & mask;
+    while (name_index[slot].position != 0 &&
+           (name_index[slot].hash != hash || strcmp(dentry_name(state, name_index[slot].position - 1), name) != 0))
+        slot = (slot + 1) & mask;
+
+    return slot;
+}
+
+// Get the position of a name in a directory's dentries, -1 if it has no such name
+static int name_position(struct inode_state *state, const char *name)
+{
+    unsigned int slot = name_slot(state, name);
+
+    return (int)state->name_index[slot].position - 1;
+}
+
+// Empty a slot of a directory's name index, moving later names of the same probe run back into it
+static void unindex_name(struct inode_state *state, unsigned int slot)
+{
+    unsigned int mask = state->name_index_size - 1;
+
+    state->name_index[slot].position = 0;
+    for (unsigned int next = (slot + 1) & mask; state->name_index[next].position != 0; next = (next + 1) & mask)
+    {
+        // a name can fill the hole unless it would then sit before the slot it hashes to
+        unsigned int home = state->name_index[next].hash & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask))
+        {
+            state->name_index[slot] = state->name_index[next];
+            state->name_index[next].position = 0;
+            slot = next;
+        }
+    }
+}
+
+// Add a name to a directory's in-memory view
+static void add_dentry(struct inode_state *state, size_t dentry, size_t entry)
+{
+    state->dentries = reserve_slot(state->dentries, state->dentry_count, &state->dentry_capacity, sizeof(struct dentry_ref));
+    state->dentries[state->dentry_count].dentry = dentry;
+    state->dentries[state->dentry_count].entry = entry;
+    state->dentry_count++;
+    state->name_count++;
+
+    // a name index that was built is kept up to date, and grows once half full
+    if (state->name_index != NULL)
+    {
+        if (2 * state->name_count + 2 > state->name_index_size)
+            build_name_index(state, 0);
+        index_name(state, state->dentry_count - 1, hash_path(dentry_name(state, state->dentry_count - 1)));
+    }
+}
+
+// Remove a name from a directory's in-memory view on behalf of the remove record at an offset
+static void remove_dentry(struct inode_state *state, const char *name, size_t remove_entry)
+{
+    unsigned int slot = name_slot(state, name);
+    if (state->name_index[slot].position == 0)
+        return;
+
+    unsigned int position = state->name_index[slot].position - 1;
+    struct dentry_ref removed = state->dentries[position];
+    unindex_name(state, slot);
+
+    // leave a hole so the names after it keep their positions, readdir offsets are positions. Once holes
+    // outnumber names they are squeezed out
+    state->dentries[position].dentry = 0;
+    state->dentries[position].entry = 0;
+    state->name_count--;
+    while (state->dentry_count > 0 && state->dentries[state->dentry_count - 1].dentry == 0)
+        state->dentry_count--;
+    if (state->dentry_count > 32 && state->name_count < state->dentry_count / 2)
+    {
+        unsigned int kept = 0;
+        for (unsigned int i = 0; i < state->dentry_count; i++)
+        {
+            if (state->dentries[i].dentry != 0)
+                state->dentries[kept++] = state->dentries[i];
+        }
+        state->dentry_count = kept;
+        build_name_index(state, 1);
+    }
+
+    if (removed.entry == state->base)
+    {
+        // the name is still in the base entry, so the remove record has to stay to hide it
+        state->removals = reserve_slot(state->removals, state->removal_count, &state->removal_capacity, sizeof(size_t));
+        state->removals[state->removal_count++] = remove_entry;
+    }
+    else
+    {
+        // an add record cancelled by a remove record leaves nothing behind
+        release_entry(state, removed.entry);
+    }
+}
+
+// Lay a newly written byte range over a file's extents, trimming whatever it overwrites
+static void overlay_extent(struct inode_state *state, struct extent new_extent)
+{
+    size_t new_end = new_extent.offset + new_extent.length;
+    unsigned int first = state->extent_count;
+
+    // find the first extent that ends after the new one starts -- sequential writes land at the end
+    while (first > 0 && state->extents[first - 1].offset + state->extents[first - 1].length > new_extent.offset)
+        first--;
+
+    // at most one extent can straddle the new range and need splitting in two
+    if (state->extent_count + 2 > state->extent_capacity)
+    {
+        unsigned int new_capacity = state->extent_capacity ? state->extent_capacity * 2 : 4;
+        struct extent *new_extents = realloc(state->extents, new_capacity * sizeof(struct extent));
+        if (new_extents == NULL)
+        {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+        state->extents = new_extents;
+        state->extent_capacity = new_capacity;
+    }
+
+    // collect the overwritten extents into [first, last) and keep the pieces that stick out
+    struct extent head_piece = {0}, tail_piece = {0};
+    unsigned int last = first;
+    while (last < state->extent_count && state->extents[last].offset < new_end)
+    {
+        struct extent *curr = &state->extents[last];
+        size_t curr_end = curr->offset + curr->length;
+
+        if (curr->offset < new_extent.offset)
+        {
+            head_piece = *curr;
+            head_piece.length = new_extent.offset - curr->offset;
+        }
+        if (curr_end > new_end)
+        {
+            tail_piece = *curr;
+            tail_piece.offset = new_end;
+            tail_piece.length = curr_end - new_end;
+            tail_piece.data = curr->data + (new_end - curr->offset);
+        }
+        last++;
+    }
+
+    // remember which entries lost bytes so they can be released afterwards
+    unsigned int removed_count = last - first;
+    size_t removed[removed_count + 1];
+    for (unsigned int i = 0; i < removed_count; i++)
+        removed[i] = state->extents[first + i].entry;
+
+    struct extent replacement[3];
+    unsigned int replacement_count = 0;
+    if (head_piece.length > 0)
+        replacement[replacement_count++] = head_piece;
+    replacement[replacement_count++] = new_extent;
+    if (tail_piece.length > 0)
+        replacement[replacement_count++] = tail_piece;
+
+    memmove(&state->extents[first + replacement_count], &state->extents[last], (state->extent_count - last) * sizeof(struct extent));
+    memcpy(&state->extents[first], replacement, replacement_count * sizeof(struct extent));
+    state->extent_count = state->extent_count - removed_count + replacement_count;
+    state->generation = COUNT(extent_generation, 1) + 1;
+
+    // entries are only garbage once they are fully overwritten -- pieces of one entry need not be
+    // next to each other, so sort them together to release each entry once
+    qsort(removed, removed_count, sizeof(size_t), compare_offsets);
+    for (unsigned int i = 0; i < removed_count; i++)
+    {
+        if (i == 0 || removed[i] != removed[i - 1])
+            release_entry(state, removed[i]);
+    }
+}
+
+// Apply the log entry at an offset to the in-memory inode map, whether it is being replayed or was just appended
+static void apply_log_entry(size_t offset)
+{
+    struct wfs_log_entry *log_entry = (struct wfs_log_entry *)(base + offset);
+    unsigned int inode_number = log_entry->inode.inode_number;
+
+    // checkpoints only summarize other entries, and padding holds nothing
+    if (log_entry->inode.flags == WFS_ENTRY_CHECKPOINT || log_entry->inode.flags == WFS_ENTRY_PADDING)
+        return;
+
+    if (inode_number > inode_count)
+        inode_count = inode_number;
+
+    // entries appended for an orphan are marked deleted, it lives on until the kernel forgets it but
+    // not past a remount. Legacy images also marked superseded or unlinked entries in place
+    if (log_entry->inode.deleted == 1 && (inode_number >= inode_map_capacity || !inode_map[inode_number].orphan))
+    {
+        remove_inode_entry(inode_number);
+        return;
+    }
+
+    grow_inode_map(inode_number);
+    struct inode_state *state = &inode_map[inode_number];
+
+    if (log_entry->inode.flags == WFS_ENTRY_EXTENT)
+    {
+        struct wfs_extent *extent = (struct wfs_extent *)log_entry->data;
+        size_t previous_entry = state->entry;
+
+        // the previous entry keeps the latest attributes until the new bytes are laid over, so it is
+        // released exactly once, below
+        state->live_size += log_entry->inode.size;
+        COUNT(live_size, log_entry->inode.size);
+        add_segment_live(offset, log_entry->inode.size);
+        state->file_size = extent->file_size;
+
+        if (extent->length > 0)
+        {
+            struct extent new_extent = {
+                .offset = extent->offset,
+                .length = extent->length,
+                .data = offset + sizeof(struct wfs_log_entry) + sizeof(struct wfs_extent),
+                .entry = offset,
+            };
+            overlay_extent(state, new_extent);
+        }
+
+        // the previous entry no longer holds the latest attributes
+        state->entry = offset;
+        if (previous_entry != 0)
+            release_entry(state, previous_entry);
+        return;
+    }
+
+    if (log_entry->inode.flags == WFS_ENTRY_DENTRY_ADD || log_entry->inode.flags == WFS_ENTRY_DENTRY_REMOVE)
+    {
+        struct wfs_dentry *dentry = (struct wfs_dentry *)log_entry->data;
+        size_t previous_entry = state->entry;
+
+        state->live_size += log_entry->inode.size;
+        COUNT(live_size, log_entry->inode.size);
+        add_segment_live(offset, log_entry->inode.size);
+
+        if (log_entry->inode.flags == WFS_ENTRY_DENTRY_ADD)
+            add_dentry(state, offset + sizeof(struct wfs_log_entry), offset);
+        else
+            remove_dentry(state, dentry->name, offset);
+
+        // the previous entry no longer holds the latest attributes
+        state->entry = offset;
+        if (previous_entry != 0)
+            release_entry(state, previous_entry);
+
+        // the remove record is what deletes the unlinked inode, nothing in its own entries changes --
+        // unless the kernel still holds it
+        if (log_entry->inode.flags == WFS_ENTRY_DENTRY_REMOVE && dentry->inode_number != inode_number)
+        {
+            struct inode_state *unlinked = get_inode_state(dentry->inode_number);
+            if (unlinked != NULL && !unlinked->orphan)
+                remove_inode_entry(dentry->inode_number);
+        }
+        return;
+    }
+
+    if (log_entry->inode.flags == WFS_ENTRY_ATTRIBUTES)
+    {
+        size_t previous_entry = state->entry;
+
+        state->live_size += log_entry->inode.size;
+        COUNT(live_size, log_entry->inode.size);
+        add_segment_live(offset, log_entry->inode.size);
+
+        // the previous entry no longer holds the latest attributes
+        state->entry = offset;
+        if (previous_entry != 0)
+            release_entry(state, previous_entry);
+        return;
+    }
+
+    // a full inode entry replaces everything logged for the inode before it, but not the kernel's references
+    // or the writes not logged yet
+    unsigned long lookups = state->lookups;
+    struct write_buffer *dirty = state->dirty;
+    state->dirty = NULL;
+    remove_inode_entry(inode_number);
+    state->lookups = lookups;
+    state->dirty = dirty;
+
+    state->entry = offset;
+    state->live_size = log_entry->inode.size;
+    COUNT(live_size, log_entry->inode.size);
+    add_segment_live(offset, log_entry->inode.size);
+
+    if (S_ISDIR(log_entry->inode.mode))
+    {
+        // the names in it stay visible until remove records hide them
+        state->base = offset;
+        for (char *data_addr = log_entry->data; data_addr < (char *)log_entry + log_entry->inode.size; data_addr += sizeof(struct wfs_dentry))
+            add_dentry(state, data_addr - base, offset);
+    }
+
+    if (S_ISREG(log_entry->inode.mode))
+    {
+        state->file_size = log_entry->inode.size - sizeof(struct wfs_log_entry);
+        if (state->file_size > 0)
+        {
+            struct extent base_extent = {
+                .offset = 0,
+                .length = state->file_size,
+                .data = offset + sizeof(struct wfs_log_entry),
+                .entry = offset,
+            };
+            overlay_extent(state, base_extent);
+        }
+    }
+}
+
+// Size of a file with the writes in its write buffer, with its inode's lock held
+static size_t buffered_file_size(struct inode_state *state)
+{
+    if (state->dirty != NULL && state->dirty->offset + state->dirty->length > state->file_size)
+        return state->dirty->offset + state->dirty->length;
+
+    return state->file_size;
+}
+
+// Size of an inode as reported by stat
+static size_t inode_size(struct wfs_log_entry *log_entry)
+{
+    struct inode_state *state = &inode_map[log_entry->inode.inode_number];
+
+    if (S_ISREG(log_entry->inode.mode))
+        return buffered_file_size(state);
+
+    return state->name_count * sizeof(struct wfs_dentry);
+}
+
+// Get the end of a segment
+static char *segment_end(unsigned int segment)
+{
+    return segment_start(segment) + segment_size;
+}
+
+// Check that a log entry lies within the segment ending at end -- the first one that doesn't marks
+// the end of the log in that segment
+static int valid_log_entry(char *curr, char *end)
+{
+    struct wfs_log_entry *curr_log_entry = (struct wfs_log_entry *)curr;
+
+    if (curr + sizeof(struct wfs_log_entry) > end)
+        return 0;
+
+    return curr_log_entry->inode.size >= sizeof(struct wfs_log_entry) &&
+           curr_log_entry->inode.size <= end - curr;
+}
+
+// Check whether a range of the image lies in a hole of a sparse image, where it reads as zeros without
+// having to be faulted in. next_data carries the start of the next data on from one call to the next
+static int in_hole(off_t offset, size_t length, off_t *next_data)
+{
+    if (*next_data <= offset)
+    {
+        *next_data = lseek(disk_fd, offset, SEEK_DATA);
+
+        // ENXIO means there is no data past offset, other errors that holes aren't reported
+        if (*next_data == -1)
+            *next_data = errno == ENXIO ? (off_t)disk_size : offset;
+    }
+
+    return *next_data >= offset + (off_t)length;
+}
+
+// Order segment indices by sequence for qsort
+static int compare_sequences(const void *a, const void *b)
+{
+    uint32_t first = segments[*(const unsigned int *)a].sequence;
+    uint32_t second = segments[*(const unsigned int *)b].sequence;
+
+    return (first > second) - (first < second);
+}
+
+// Read the segment table from the segment headers
+static void load_segments()
+{
+    free(segments);
+    free(log_order);
+
+    if (superblock->version == 0)
+    {
+        // legacy images are one segment without a header, running to the end of the image
+        segment_count = 1;
+        segment_size = base + disk_size - log_start;
+        segment_header_size = 0;
+    }
+    else
+    {
+        segment_count = superblock->segment_count;
+        segment_size = superblock->segment_size;
+        segment_header_size = sizeof(struct wfs_segment);
+    }
+
+    segments = calloc(segment_count, sizeof(struct segment));
+    log_order = malloc(segment_count * sizeof(unsigned int));
+    if (segments == NULL || log_order == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    next_sequence = 1;
+    free_segment_count = 0;
+    free_cursor = 0;
+    log_order_count = 0;
+    off_t next_data = 0;
+    for (unsigned int i = 0; i < segment_count; i++)
+    {
+        struct wfs_segment *header = (struct wfs_segment *)segment_start(i);
+
+        if (superblock->version == 0)
+        {
+            segments[i].sequence = 1;
+        }
+        else if (!in_hole((char *)header - base, segment_header_size, &next_data) && header->magic == WFS_SEGMENT_MAGIC)
+        {
+            segments[i].sequence = header->sequence;
+            segments[i].created = header->created;
+        }
+
+        if (segments[i].sequence >= next_sequence)
+            next_sequence = segments[i].sequence + 1;
+
+        if (segments[i].sequence == 0)
+            free_segment_count++;
+        else
+            log_order[log_order_count++] = i;
+    }
+
+    qsort(log_order, log_order_count, sizeof(unsigned int), compare_sequences);
+}
+
+// Replay the log from a position in a segment up to its end into the inode map and move the head there,
+// returns how many bytes were replayed
+static size_t roll_forward(unsigned int segment, char *curr)
+{
+    size_t replayed = 0;
+
+    while (1)
+    {
+        while (valid_log_entry(curr, segment_end(segment)))
+        {
+            apply_log_entry(curr - base);
+            replayed += ((struct wfs_log_entry *)curr)->inode.size;
+            replayed_entries++;
+            curr += ((struct wfs_log_entry *)curr)->inode.size;
+        }
+
+        // the log goes on in the segment started after this one, if any
+        unsigned int next = next_segment(segments[segment].sequence);
+        if (next == NO_SEGMENT)
+            break;
+
+        segment = next;
+        curr = segment_start(segment) + segment_header_size;
+    }
+
+    head = curr;
+    current_segment = segment;
+
+    // what was loaded is on the disk already as far as anyone can tell
+    synced_head = head;
+    synced_segment = segment;
+
+    // the superblock and every segment in use, up to the head in the last one
+    total_size = log_start - base + (segment_count - free_segments() - 1) * segment_size + (head - segment_start(segment));
+
+    return replayed;
+}
+
+// Get the checkpoint part stored at an offset, NULL unless it is intact
+static struct wfs_checkpoint *read_checkpoint_part(uint64_t offset)
+{
+    if (offset < log_start - base + segment_header_size || offset >= segment_end(segment_count - 1) - base ||
+        !valid_log_entry(base + offset, segment_end(segment_of(offset))))
+        return NULL;
+
+    struct wfs_log_entry *log_entry = (struct wfs_log_entry *)(base + offset);
+    struct wfs_checkpoint *checkpoint = (struct wfs_checkpoint *)log_entry->data;
+
+    if (log_entry->inode.flags != WFS_ENTRY_CHECKPOINT ||
+        log_entry->inode.size < sizeof(struct wfs_log_entry) + sizeof(struct wfs_checkpoint) ||
+        log_entry->inode.size != sizeof(struct wfs_log_entry) + sizeof(struct wfs_checkpoint) + checkpoint->entry_count * sizeof(uint64_t))
+        return NULL;
+
+    // the checksum is computed with its own field zeroed
+    uint32_t checksum = checkpoint->checksum;
+    checkpoint->checksum = 0;
+    uint32_t expected = wfs_checksum(log_entry, log_entry->inode.size);
+    checkpoint->checksum = checksum;
+
+    return checksum == expected ? checkpoint : NULL;
+}
+
+// Get the last part of the checkpoint it ends at an offset, NULL unless all its parts are intact
+static struct wfs_checkpoint *read_checkpoint(uint64_t offset)
+{
+    struct wfs_checkpoint *last = read_checkpoint_part(offset);
+    struct wfs_checkpoint *part = last;
+
+    while (part != NULL && part->part > 0)
+    {
+        struct wfs_checkpoint *previous = read_checkpoint_part(part->previous);
+        if (previous == NULL || previous->version != part->version || previous->part != part->part - 1)
+            return NULL;
+        part = previous;
+    }
+
+    return part != NULL ? last : NULL;
+}
+
+// Rebuild the segment table and the inode map, starting from the newest valid checkpoint when there is one
+static void build_inode_map()
+{
+    struct wfs_checkpoint *checkpoint = NULL;
+
+    replaying = 1;
+    replayed_entries = 0;
+    load_segments();
+
+    // legacy images have no room for checkpoint pointers in their superblock
+    if (superblock->version != 0)
+    {
+        struct wfs_checkpoint *first = read_checkpoint(superblock->checkpoint[0]);
+        struct wfs_checkpoint *second = read_checkpoint(superblock->checkpoint[1]);
+
+        checkpoint = first;
+        if (second != NULL && (first == NULL || second->version > first->version))
+            checkpoint = second;
+    }
+
+    if (checkpoint == NULL)
+    {
+        // no usable checkpoint, replay the whole log from its oldest segment
+        unsigned int first_segment = next_segment(0);
+        if (first_segment == NO_SEGMENT)
+        {
+            LOG(LEVEL_ERROR, "No log segments found\n");
+            exit(EXIT_FAILURE);
+        }
+
+        size_t replayed = roll_forward(first_segment, segment_start(first_segment) + segment_header_size);
+        __atomic_store_n(&appended_since_checkpoint, replayed, __ATOMIC_RELAXED);
+        entries_since_checkpoint = replayed / sizeof(struct wfs_log_entry);
+        replaying = 0;
+        return;
+    }
+
+    // find its parts, the last one links back to the first
+    checkpoint_part_count = checkpoint->part + 1;
+    checkpoint_part_capacity = checkpoint_part_count;
+    free(checkpoint_parts);
+    checkpoint_parts = malloc(checkpoint_part_count * sizeof(size_t));
+    if (checkpoint_parts == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t checkpoint_entry = (char *)checkpoint - sizeof(struct wfs_log_entry) - base;
+    for (unsigned int i = checkpoint_part_count; i > 0; i--)
+    {
+        checkpoint_parts[i - 1] = checkpoint_entry;
+        checkpoint_entry = ((struct wfs_checkpoint *)(base + checkpoint_entry + sizeof(struct wfs_log_entry)))->previous;
+    }
+
+    // replay just the entries that were live, in log order -- inodes unlinked after the checkpoint was
+    // taken drop out with the remove records rolled forward, the same way they do during a full replay
+    checkpoint_entry_count = 0;
+    size_t size = 0;
+    for (unsigned int i = 0; i < checkpoint_part_count; i++)
+    {
+        struct wfs_log_entry *log_entry = (struct wfs_log_entry *)(base + checkpoint_parts[i]);
+        struct wfs_checkpoint *part = (struct wfs_checkpoint *)log_entry->data;
+
+        for (unsigned int j = 0; j < part->entry_count; j++)
+        {
+            size_t entry = part->entries[j];
+            if (entry != 0 && valid_log_entry(base + entry, segment_end(segment_of(entry))))
+                apply_log_entry(entry);
+        }
+
+        checkpoint_entry_count += part->entry_count;
+        size += log_entry->inode.size;
+        live_size += log_entry->inode.size;
+        add_segment_live(checkpoint_parts[i], log_entry->inode.size);
+    }
+
+    if (checkpoint->inode_count > inode_count)
+        inode_count = checkpoint->inode_count;
+    __atomic_store_n(&checkpoint_size, size, __ATOMIC_RELAXED);
+    last_checkpoint = checkpoint;
+    checkpoint_entry = checkpoint_parts[checkpoint_part_count - 1];
+
+    // only the tail written after the checkpoint needs replaying
+    size_t replayed = roll_forward(segment_of(checkpoint_entry), base + checkpoint->head);
+    __atomic_store_n(&appended_since_checkpoint, replayed, __ATOMIC_RELAXED);
+    entries_since_checkpoint = replayed / sizeof(struct wfs_log_entry);
+    replaying = 0;
+
+    LOG(LEVEL_INFO, "Loaded checkpoint %u in %u parts, rolled forward %zu bytes\n", checkpoint->version, checkpoint_part_count, replayed);
+}
+
+// Check whether fsck.wfs compacted the log since the inode map was built
+static int log_compacted()
+{
+    return superblock->version != 0 && superblock->generation != mounted_generation;
+}
+
+// Drop everything held in memory about the log, before rebuilding it from another log or another image
+static void forget_log()
+{
+    // the offsets held in memory are meaningless now, so nothing of the old state is looked up
+    for (unsigned int i = 0; i < inode_map_capacity; i++)
+        clear_inode_state(&inode_map[i]);
+    memset(dcache, 0, sizeof(dcache));
+
+    inode_count = 0;
+    live_size = 0;
+    last_checkpoint = NULL;
+    checkpoint_part_count = 0;
+    checkpoint_entry_count = 0;
+    __atomic_store_n(&checkpoint_size, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&appended_since_checkpoint, 0, __ATOMIC_RELAXED);
+    entries_since_checkpoint = 0;
+    cleaning_segment = NO_SEGMENT;
+    unsynced_count = 0;
+}
+
+// Rebuild every in-memory structure if fsck.wfs compacted the log underneath the mount
+static void reload_if_compacted()
+{
+    if (!log_compacted())
+        return;
+
+    LOG(LEVEL_INFO, "Log compacted (generation %u -> %u), reloading\n", mounted_generation, superblock->generation);
+
+    // writes not logged yet outlive the reload, fsck.wfs keeps inode numbers
+    for (unsigned int i = 0; i < dirty_count; i++)
+        inode_map[dirty_inodes[i].inode_number].dirty = NULL;
+
+    forget_log();
+    build_inode_map();
+    mounted_generation = superblock->generation;
+
+    for (unsigned int i = dirty_count; i-- > 0;)
+    {
+        struct wfs_log_entry *log_entry = get_inode_entry(dirty_inodes[i].inode_number);
+        if (log_entry != NULL && S_ISREG(log_entry->inode.mode))
+            inode_map[dirty_inodes[i].inode_number].dirty = dirty_inodes[i].buffer;
+        else
+            remove_write_buffer(dirty_inodes[i].buffer);
+    }
+}
+
+// Order log offsets by their position in the log for qsort -- segments get reused, so the offsets alone don't tell
+static int compare_log_order(const void *a, const void *b)
+{
+    size_t first = *(const size_t *)a, second = *(const size_t *)b;
+    uint32_t first_sequence = segments[segment_of(first)].sequence;
+    uint32_t second_sequence = segments[segment_of(second)].sequence;
+
+    if (first_sequence != second_sequence)
+        return (first_sequence > second_sequence) - (first_sequence < second_sequence);
+
+    return (first > second) - (first < second);
+}
+
+// Collect the offsets of all live log entries in log order, returns how many there are
+static size_t collect_live_entries(size_t **entries)
+{
+    size_t count = 0, capacity = 64;
+    size_t *offsets = malloc(capacity * sizeof(size_t));
+
+    for (unsigned int i = 0; i < inode_map_capacity; i++)
+    {
+        // orphans don't outlive the mount
+        struct inode_state *state = &inode_map[i];
+        if (state->entry == 0 || state->orphan)
+            continue;
+
+        size_t needed = count + inode_entry_bound(state);
+        if (needed > capacity)
+        {
+            while (needed > capacity)
+                capacity *= 2;
+            offsets = realloc(offsets, capacity * sizeof(size_t));
+        }
+        if (offsets == NULL)
+        {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+
+        count += inode_live_entries(state, offsets + count);
+    }
+
+    qsort(offsets, count, sizeof(size_t), compare_log_order);
+
+    *entries = offsets;
+    return count;
+}
+
+// Check that entries adding up to size bytes, none of them larger than largest, can be appended
+// while leaving reserve free segments untouched
+static int log_fits(size_t size, size_t largest, unsigned int reserve)
+{
+    size_t payload = segment_size - segment_header_size;
+
+    unsigned int free_count = free_segments();
+
+    // once the reserve is in use, the rest of the current segment may be all the cleaner has left
+    if (largest > payload || free_count < reserve)
+        return 0;
+    if (head + size <= segment_end(current_segment))
+        return 1;
+
+    // a segment is only left behind once the next entry doesn't fit, so each one takes at least this much
+    size_t taken = payload - largest + 1;
+    size_t needed = (size + taken - 1) / taken;
+
+    return free_count >= reserve + needed;
+}
+
+static int clean_step();
+
+// Check whether cleaning still gains room: once another victim came free, the segments freed since the last
+// one did have to hold more than the cleaner took, or all that is left is live data and the padding around it
+static int cleaning_gains(struct cleaning_round *round)
+{
+    if (segments_released == round->released)
+        return 1;
+
+    int gained = (segments_released - round->released) * (segment_size - segment_header_size) > cleaner_taken - round->taken;
+    round->released = segments_released;
+    round->taken = cleaner_taken;
+    return gained;
+}
+
+// Check whether the log can be cleaned at all: the cleaner needs a segment to clean into besides the
+// one holding the head, and legacy images have nowhere to keep the checkpoints that free cleaned segments
+static int cleaner_possible()
+{
+    return superblock->version != 0 && segment_count > CLEANER_RESERVE + 1;
+}
+
+static size_t checkpoint_bound();
+
+// Free segments that unlinking leaves to the cleaner: enough to move out a victim and write the two
+// checkpoints that free it, which grow with the number of live entries
+static unsigned int cleaner_reserve()
+{
+    if (!cleaner_possible())
+        return 0;
+
+    size_t taken = segment_size - segment_header_size - CHECKPOINT_PART_SIZE + 1;
+    return CLEANER_RESERVE + (2 * checkpoint_bound() + taken - 1) / taken;
+}
+
+// Free segments that other handlers leave to the cleaner and to unlinking
+static unsigned int handler_reserve()
+{
+    return cleaner_possible() ? cleaner_reserve() + REMOVE_RESERVE : 0;
+}
+
+// log_fits() for handlers holding the log lock shared, while other writers move the head
+static int log_fits_shared(size_t size, size_t largest)
+{
+    pthread_mutex_lock(&head_lock);
+    int fits = log_fits(size, largest, handler_reserve());
+    pthread_mutex_unlock(&head_lock);
+
+    return fits;
+}
+
+// Number of entries a checkpoint part can list in room bytes
+static size_t checkpoint_part_entries(size_t room)
+{
+    return room < CHECKPOINT_PART_SIZE ? 0 : (room - CHECKPOINT_PART_SIZE) / sizeof(uint64_t);
+}
+
+// Upper bound on the size of the next checkpoint: every entry appended since the last one adds at most one live entry
+static size_t checkpoint_bound()
+{
+    size_t entry_count = checkpoint_entry_count + __atomic_load_n(&entries_since_checkpoint, __ATOMIC_RELAXED) + 1;
+    size_t full_count = checkpoint_part_entries(segment_size - segment_header_size);
+    size_t part_count = (full_count > 0 ? entry_count / full_count : 0) + 2;
+
+    return part_count * CHECKPOINT_PART_SIZE + entry_count * sizeof(uint64_t);
+}
+
+// Check that entries adding up to size bytes, none of them larger than largest, can be appended,
+// cleaning in the foreground if the background cleaner fell behind. Cleaning moves log entries,
+// so log entry pointers have to be looked up again afterwards
+static int log_has_room(size_t size, size_t largest)
+{
+    // relocation leaves room for the two checkpoints it takes to free the victim
+    size_t checkpoint = checkpoint_bound();
+    if (cleaning)
+    {
+        size += 2 * checkpoint;
+        largest = largest > CHECKPOINT_PART_SIZE ? largest : CHECKPOINT_PART_SIZE;
+    }
+
+    struct cleaning_round round = {segments_released, cleaner_taken};
+    while (!log_fits(size, largest, cleaning ? 0 : removing ? cleaner_reserve() : handler_reserve()))
+    {
+        if (cleaning || !clean_step() || !cleaning_gains(&round))
+            return 0;
+    }
+
+    return 1;
+}
+
+// Let the background cleaner know the head moved on to another segment
+static void wake_cleaner()
+{
+    pthread_mutex_lock(&cleaner_lock);
+    cleaner_kicked = 1;
+    pthread_cond_signal(&cleaner_wakeup);
+    pthread_mutex_unlock(&cleaner_lock);
+}
+
+// Have the next sync write a segment out whole, its header changed
+static void mark_unsynced(unsigned int segment)
+{
+    if (segments[segment].unsynced)
+        return;
+
+    unsynced_segments = reserve_slot(unsynced_segments, unsynced_count, &unsynced_capacity, sizeof(unsigned int));
+    unsynced_segments[unsynced_count++] = segment;
+    segments[segment].unsynced = 1;
+}
+
+// Count bytes taken at the head, those the cleaner takes also against what cleaning gains
+static void take_room(size_t size)
+{
+    total_size += size;
+    if (cleaning)
+        cleaner_taken += size;
+}
+
+// End of the bytes at the head that have to read as the end of the log: room for an entry header, or
+// whatever is left of the segment
+static char *log_end()
+{
+    char *end = head + sizeof(struct wfs_log_entry);
+    return end < segment_end(current_segment) ? end : segment_end(current_segment);
+}
+
+// Make the log end at the head. A reused segment still holds its old entries past it, which would read
+// as a continuation of the log -- clearing the next entry header is enough to stop a replay there
+static void end_log_at_head()
+{
+    memset(head, 0, log_end() - head);
+}
+
+// Move the head to the start of a free segment, returns 0 if there is none
+static int open_segment()
+{
+    if (free_segment_count == 0)
+        return 0;
+
+    // next fit, so finding a free segment doesn't cost a scan from the start on a large image
+    unsigned int segment = free_cursor;
+    while (segments[segment].sequence != 0 || segments[segment].reusable_at != 0)
+        segment = (segment + 1) % segment_count;
+    free_cursor = (segment + 1) % segment_count;
+    free_segment_count--;
+
+    struct wfs_segment *header = (struct wfs_segment *)segment_start(segment);
+    memset(header, 0, segment_header_size);
+    header->magic = WFS_SEGMENT_MAGIC;
+    header->sequence = next_sequence++;
+    header->created = time(NULL);
+
+    segments[segment].sequence = header->sequence;
+    segments[segment].created = header->created;
+    segments[segment].live_bytes = 0;
+    mark_unsynced(segment);
+
+    // the rest of the old segment stays unused
+    take_room(segment_end(current_segment) - head + segment_header_size);
+    backend->segment_done(segment_start(current_segment), segment_size);
+    current_segment = segment;
+    head = segment_start(segment) + segment_header_size;
+    end_log_at_head();
+
+    // every new segment is a chance for the cleaner to see it is running low, unless it is the cleaner's
+    if (!cleaning)
+        wake_cleaner();
+
+    return 1;
+}
+
+// Reserve room for a log entry of the given size at the head, moving on to a new segment if needed but
+// leaving reserve free segments untouched. The room holds padding until the entry is published over it,
+// so the log stays readable past entries other writers are still copying in. NULL if there is no room
+static struct wfs_log_entry *reserve_log_space(size_t size, unsigned int reserve)
+{
+    pthread_mutex_lock(&head_lock);
+
+    if (!log_fits(size, size, reserve) || (head + size > segment_end(current_segment) && !open_segment()))
+    {
+        pthread_mutex_unlock(&head_lock);
+        return NULL;
+    }
+
+    struct wfs_log_entry *reserved = (struct wfs_log_entry *)head;
+    memset(&reserved->inode, 0, sizeof(struct wfs_inode));
+    reserved->inode.inode_number = WFS_NO_INODE;
+    reserved->inode.flags = WFS_ENTRY_PADDING;
+    reserved->inode.size = size;
+
+    head += size;
+    take_room(size);
+    end_log_at_head();
+
+    pthread_mutex_unlock(&head_lock);
+    return reserved;
+}
+
+// Free the cleaned segments that no published checkpoint refers to anymore
+static void release_cleaned_segments(uint32_t version)
+{
+    for (unsigned int i = 0; i < segment_count; i++)
+    {
+        if (segments[i].reusable_at == 0 || segments[i].reusable_at > version)
+            continue;
+
+        // without a header a full replay doesn't read its stale entries either
+        memset(segment_start(i), 0, segment_header_size);
+        int unsynced = segments[i].unsynced;
+        memset(&segments[i], 0, sizeof(struct segment));
+        segments[i].unsynced = unsynced;
+        mark_unsynced(i);
+        free_segment_count++;
+        segments_released++;
+        total_size -= segment_size;
+    }
+}
+
+// Append a checkpoint of the live log entries and point the superblock at it
+static void write_checkpoint()
+{
+    // legacy images have no room for checkpoint pointers in their superblock, and a segment has
+    // to hold at least a part with one entry
+    size_t full_count = checkpoint_part_entries(segment_size - segment_header_size);
+    if (superblock->version == 0 || full_count == 0)
+        return;
+
+    size_t *entries;
+    size_t entry_count = collect_live_entries(&entries);
+
+    // the first part goes in what is left of the current segment if that holds anything, the others
+    // fill new segments
+    size_t first_count = checkpoint_part_entries(segment_end(current_segment) - head);
+    int first_here = segment_end(current_segment) - head >= CHECKPOINT_PART_SIZE && (first_count > 0 || entry_count == 0);
+    if (!first_here || first_count > entry_count)
+        first_count = first_here ? entry_count : 0;
+
+    unsigned int new_segments = (entry_count - first_count + full_count - 1) / full_count;
+    if (!first_here && new_segments == 0)
+        new_segments = 1;
+    unsigned int part_count = new_segments + first_here;
+    size_t size = part_count * CHECKPOINT_PART_SIZE + entry_count * sizeof(uint64_t);
+
+    // a missed checkpoint only costs a longer roll forward at the next mount, so one taken outside the
+    // cleaner leaves it the segments it needs
+    if (new_segments > 0 && free_segments() < new_segments + (cleaning ? 0 : cleaner_reserve()))
+    {
+        free(entries);
+        return;
+    }
+
+    // the previous checkpoint becomes garbage once this one is in place
+    for (unsigned int i = 0; i < checkpoint_part_count; i++)
+    {
+        unsigned int part_size = ((struct wfs_log_entry *)(base + checkpoint_parts[i]))->inode.size;
+        live_size -= part_size;
+        add_segment_live(checkpoint_parts[i], -(long)part_size);
+    }
+    live_size += size;
+
+    if (part_count > checkpoint_part_capacity)
+    {
+        checkpoint_parts = realloc(checkpoint_parts, part_count * sizeof(size_t));
+        if (checkpoint_parts == NULL)
+        {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+        checkpoint_part_capacity = part_count;
+    }
+    uint32_t version = last_checkpoint != NULL ? last_checkpoint->version + 1 : 1;
+    struct wfs_checkpoint *checkpoint = NULL;
+    size_t written = 0;
+
+    for (unsigned int part = 0; part < part_count; part++)
+    {
+        size_t count = checkpoint_part_entries(segment_end(current_segment) - head);
+        if (part > 0 || !first_here)
+        {
+            open_segment();
+            count = full_count;
+        }
+        if (count > entry_count - written)
+            count = entry_count - written;
+
+        unsigned int part_size = CHECKPOINT_PART_SIZE + count * sizeof(uint64_t);
+        struct wfs_log_entry *log_entry = (struct wfs_log_entry *)head;
+
+        memset(log_entry, 0, CHECKPOINT_PART_SIZE);
+        log_entry->inode.inode_number = WFS_NO_INODE;
+        log_entry->inode.flags = WFS_ENTRY_CHECKPOINT;
+        log_entry->inode.size = part_size;
+        log_entry->inode.atime = time(NULL);
+        log_entry->inode.mtime = log_entry->inode.atime;
+        log_entry->inode.ctime = log_entry->inode.atime;
+
+        checkpoint = (struct wfs_checkpoint *)log_entry->data;
+        checkpoint->version = version;
+        checkpoint->head = part == part_count - 1 ? head - base + part_size : 0;
+        checkpoint->live_size = live_size;
+        checkpoint->previous = part > 0 ? checkpoint_parts[part - 1] : 0;
+        checkpoint->inode_count = inode_count;
+        checkpoint->part = part;
+        checkpoint->entry_count = count;
+        for (size_t i = 0; i < count; i++)
+            checkpoint->entries[i] = entries[written + i];
+        checkpoint->checksum = wfs_checksum(log_entry, part_size);
+
+        checkpoint_parts[part] = head - base;
+        add_segment_live(head - base, part_size);
+        written += count;
+
+        head += part_size;
+        take_room(part_size);
+        STAT(bytes_appended, part_size);
+    }
+    end_log_at_head();
+    free(entries);
+    checkpoint_part_count = part_count;
+
+    // publish it in the slot of the older checkpoint so the newer one survives a torn write
+    superblock->checkpoint[version % 2] = checkpoint_parts[part_count - 1];
+    superblock->head = head - base;
+
+    last_checkpoint = checkpoint;
+    checkpoint_entry_count = entry_count;
+    __atomic_store_n(&checkpoint_size, size, __ATOMIC_RELAXED);
+    __atomic_store_n(&appended_since_checkpoint, 0, __ATOMIC_RELAXED);
+    entries_since_checkpoint = 0;
+
+    release_cleaned_segments(version);
+}
+
+// Check whether enough was appended since the last checkpoint to write another one
+static int checkpoint_due()
+{
+    size_t interval = CHECKPOINT_GROWTH * __atomic_load_n(&checkpoint_size, __ATOMIC_RELAXED);
+    if (interval < CHECKPOINT_INTERVAL)
+        interval = CHECKPOINT_INTERVAL;
+
+    return __atomic_load_n(&appended_since_checkpoint, __ATOMIC_RELAXED) >= interval;
+}
+
+// Publish a log entry whose data has been copied into reserved room: writing its inode over the padding
+// comes last, then it becomes the latest entry of its inode
+static void publish_log_entry(struct wfs_log_entry *reserved, struct wfs_inode *inode)
+{
+    reserved->inode = *inode;
+
+    // an access time kept in memory goes out with the inode's next entry
+    struct inode_state *state = get_inode_state(inode->inode_number);
+    unsigned int atime = state != NULL ? __atomic_load_n(&state->atime, __ATOMIC_RELAXED) : 0;
+    if (atime > reserved->inode.atime)
+        reserved->inode.atime = atime;
+
+    // what an orphan appends comes after its remove record, replay has to drop that too
+    if (state != NULL && state->orphan)
+        reserved->inode.deleted = 1;
+
+    apply_log_entry((char *)reserved - base);
+
+    COUNT(appended_since_checkpoint, inode->size);
+    COUNT(entries_since_checkpoint, 1);
+    STAT(bytes_appended, inode->size);
+}
+
+// Append a log entry at the head and make it the latest entry of its inode
+static struct wfs_log_entry *append_log_entry(struct wfs_log_entry *log_entry)
+{
+    // callers make sure there is room with log_has_room() first
+    struct wfs_log_entry *appended = reserve_log_space(log_entry->inode.size, 0);
+    if (appended == NULL)
+    {
+        LOG(LEVEL_DEBUG, "Log entry of %u bytes does not fit in the log\n", log_entry->inode.size);
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(appended->data, log_entry->data, log_entry->inode.size - sizeof(struct wfs_log_entry));
+    publish_log_entry(appended, &log_entry->inode);
+
+    if (checkpoint_due())
+        write_checkpoint();
+
+    return appended;
+}
+
+// Append a record that adds a name to or removes it from a directory, carrying the directory's attributes
+// over from its latest entry. modify updates its modify and change times
+static void append_dentry_entry(unsigned int dir, unsigned int kind, struct wfs_dentry *dentry, int modify)
+{
+    char buffer[DENTRY_ENTRY_SIZE];
+    struct wfs_log_entry *log_entry = (struct wfs_log_entry *)buffer;
+
+    log_entry->inode = get_inode_entry(dir)->inode;
+    log_entry->inode.flags = kind;
+    log_entry->inode.size = DENTRY_ENTRY_SIZE;
+
+    // update modify time
+    if (modify)
+    {
+        log_entry->inode.ctime = time(NULL);
+        log_entry->inode.mtime = time(NULL);
+    }
+
+    memcpy(log_entry->data, dentry, sizeof(struct wfs_dentry));
+
+    append_log_entry(log_entry);
+}
+
+// Write an extent entry holding the next length bytes of data, which it consumes, straight into reserved
+// room at the head, carrying the file's attributes over from its latest entry. modify, unless 0, is the
+// time its access, modify and change times are updated to. The caller holds the inode's lock exclusively, writers of other inodes copy
+// their bytes in at the same time. Returns 1 once written, 0 if there is no room without touching reserve
+// free segments, or -1 if fewer bytes could be taken from data -- the room is left as padding then
+static int write_extent(unsigned int inode_number, size_t offset, struct fuse_bufvec *data, size_t length, time_t modify, unsigned int reserve)
+{
+    unsigned int entry_size = sizeof(struct wfs_log_entry) + sizeof(struct wfs_extent) + length;
+
+    struct wfs_log_entry *log_entry = reserve_log_space(entry_size, reserve);
+    if (log_entry == NULL)
+        return 0;
+
+    struct wfs_extent *extent = (struct wfs_extent *)log_entry->data;
+    struct inode_state *state = get_inode_state(inode_number);
+
+    // the bytes go in with the only copy they get -- from the FUSE device's pipe if libfuse spliced them
+    if (length > 0)
+    {
+        struct fuse_bufvec room = FUSE_BUFVEC_INIT(length);
+        room.buf[0].mem = extent->data;
+        if (fuse_buf_copy(&room, data, 0) != (ssize_t)length)
+            return -1;
+    }
+
+    // the header fields follow once the bytes are in
+    extent->file_size = offset + length > state->file_size ? offset + length : state->file_size;
+    extent->offset = offset;
+    extent->length = length;
+
+    struct wfs_inode inode = get_inode_entry(inode_number)->inode;
+    inode.flags = WFS_ENTRY_EXTENT;
+    inode.size = entry_size;
+
+    if (modify)
+    {
+        inode.atime = modify;
+        inode.ctime = modify;
+        inode.mtime = modify;
+    }
+
+    // publish the log entry and lay it over the file's extents
+    publish_log_entry(log_entry, &inode);
+
+    return 1;
+}
+
+// Append an extent entry with the log to itself, see write_extent. Returns 0 if the log is out of room
+static int append_extent(unsigned int inode_number, size_t offset, const char *data, size_t length, int modify)
+{
+    unsigned int entry_size = sizeof(struct wfs_log_entry) + sizeof(struct wfs_extent) + length;
+
+    struct fuse_bufvec bytes = FUSE_BUFVEC_INIT(length);
+    bytes.buf[0].mem = (char *)data;
+
+    if (!log_has_room(entry_size, entry_size) || write_extent(inode_number, offset, &bytes, length, modify, 0) != 1)
+        return 0;
+
+    if (checkpoint_due())
+        write_checkpoint();
+
+    return 1;
+}
+
+// Append a record holding nothing but an inode's attributes, carried over from its latest entry along with
+// an access time kept in memory. Returns 0 if the log is out of room
+static int append_attributes(unsigned int inode_number)
+{
+    struct wfs_log_entry log_entry;
+
+    log_entry.inode = get_inode_entry(inode_number)->inode;
+    log_entry.inode.flags = WFS_ENTRY_ATTRIBUTES;
+    log_entry.inode.size = sizeof(struct wfs_log_entry);
+    if (!log_has_room(sizeof(struct wfs_log_entry), sizeof(struct wfs_log_entry)))
+        return 0;
+
+    append_log_entry(&log_entry);
+    return 1;
+}
+
+// Largest number of file bytes one extent entry carries: up to half a segment, so log_fits() can count
+// on a run of them filling each segment at least half way -- unless that leaves no room for bytes at all
+static size_t max_extent_length()
+{
+    size_t overhead = sizeof(struct wfs_log_entry) + sizeof(struct wfs_extent);
+    size_t payload = segment_size - segment_header_size;
+
+    return payload / 2 > overhead ? payload / 2 - overhead : payload - overhead;
+}
+
+////// SEGMENT CLEANER ///////
+
+// Check whether the log entry at an offset is still in use by anything
+static int entry_is_live(size_t offset)
+{
+    struct wfs_log_entry *log_entry = (struct wfs_log_entry *)(base + offset);
+
+    if (log_entry->inode.flags == WFS_ENTRY_CHECKPOINT)
+    {
+        for (unsigned int i = 0; i < checkpoint_part_count; i++)
+        {
+            if (checkpoint_parts[i] == offset)
+                return 1;
+        }
+        return 0;
+    }
+
+    struct inode_state *state = get_inode_state(log_entry->inode.inode_number);
+    return state != NULL && entry_in_use(state, offset);
+}
+
+// Rewrite a directory at the head as one full entry with all its names -- or, if that doesn't fit in
+// a segment, as an empty full entry followed by add records. Returns 0 if the log is out of room
+static int relocate_directory(unsigned int inode_number)
+{
+    struct inode_state *state = get_inode_state(inode_number);
+    unsigned int dentry_count = state->name_count;
+    size_t full_size = sizeof(struct wfs_log_entry) + dentry_count * sizeof(struct wfs_dentry);
+    int split = full_size > segment_size - segment_header_size;
+
+    if (split ? !log_has_room(sizeof(struct wfs_log_entry) + dentry_count * DENTRY_ENTRY_SIZE, DENTRY_ENTRY_SIZE)
+              : !log_has_room(full_size, full_size))
+        return 0;
+
+    // the full entry drops the names it is built from out of the inode map, so copy them first
+    struct wfs_log_entry *log_entry = (struct wfs_log_entry *)malloc(full_size);
+    if (log_entry == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    log_entry->inode = get_inode_entry(inode_number)->inode;
+    log_entry->inode.flags = WFS_ENTRY_INODE;
+    log_entry->inode.size = split ? sizeof(struct wfs_log_entry) : full_size;
+    unsigned int copied = 0;
+    for (unsigned int i = 0; i < state->dentry_count; i++)
+    {
+        if (state->dentries[i].dentry != 0)
+            memcpy(log_entry->data + copied++ * sizeof(struct wfs_dentry), base + state->dentries[i].dentry, sizeof(struct wfs_dentry));
+    }
+
+    append_log_entry(log_entry);
+    for (unsigned int i = 0; split && i < dentry_count; i++)
+        append_dentry_entry(inode_number, WFS_ENTRY_DENTRY_ADD, (struct wfs_dentry *)(log_entry->data + i * sizeof(struct wfs_dentry)), 0);
+
+    free(log_entry);
+    return 1;
+}
+
+// Copy whatever an inode still uses in the segment being cleaned to the head, returns 0 if the log is out of room
+static int relocate_inode(unsigned int inode_number)
+{
+    if (S_ISDIR(get_inode_entry(inode_number)->inode.mode))
+        return relocate_directory(inode_number);
+
+    // each copy replaces exactly the extent it was made from, a long one is copied piece by piece
+    struct inode_state *state = get_inode_state(inode_number);
+    for (unsigned int i = 0; i < state->extent_count; i++)
+    {
+        struct extent old = state->extents[i];
+        if (segment_of(old.entry) != cleaning_segment)
+            continue;
+
+        size_t length = old.length < max_extent_length() ? old.length : max_extent_length();
+        if (!append_extent(inode_number, old.offset, base + old.data, length, 0))
+            return 0;
+        state = get_inode_state(inode_number);
+    }
+
+    // the latest attributes may be all that is left in the segment
+    if (segment_of(state->entry) == cleaning_segment && !append_attributes(inode_number))
+        return 0;
+
+    return 1;
+}
+
+// Pick the segment to clean by LFS cost-benefit: the space freed times the age of the data, over the cost
+// of reading the segment and writing its live bytes back. NO_SEGMENT if none is worth cleaning
+static unsigned int pick_victim()
+{
+    unsigned int victim = NO_SEGMENT;
+    double best = 0;
+    double now = time(NULL);
+
+    size_t checkpoints = 2 * checkpoint_bound();
+    size_t payload = segment_size - segment_header_size;
+
+    for (unsigned int i = 0; i < segment_count; i++)
+    {
+        // a victim has to be moved out completely, leaving room for the checkpoints that free it, and
+        // cleaning it has to gain a good part of a segment or a log full of live data is cleaned in circles
+        if (segments[i].sequence == 0 || segments[i].reusable_at != 0 || i == current_segment ||
+            segments[i].live_bytes + checkpoints > payload - payload / CLEANER_MIN_GAIN ||
+            !log_fits(segments[i].live_bytes + checkpoints, CHECKPOINT_PART_SIZE, 0))
+            continue;
+
+        double utilization = (double)segments[i].live_bytes / (segment_size - segment_header_size);
+        double age = now - segments[i].created > 0 ? now - segments[i].created + 1 : 1;
+        double score = (1 - utilization) * age / (1 + utilization);
+
+        if (score > best)
+        {
+            best = score;
+            victim = i;
+        }
+    }
+
+    return victim;
+}
+
+// Do one bounded step of cleaning: move one inode out of the victim segment, finish the victim, or write a
+// checkpoint so cleaned segments come free. Returns 0 if there was nothing to do or the log is out of room
+static int clean_step()
+{
+    int progress = 1;
+
+    cleaning = 1;
+
+    // cleaned segments come free once both checkpoint slots have moved past them
+    if (cleaning_segment == NO_SEGMENT)
+    {
+        for (unsigned int i = 0; i < segment_count; i++)
+        {
+            if (segments[i].reusable_at == 0)
+                continue;
+
+            struct wfs_checkpoint *previous = last_checkpoint;
+            write_checkpoint();
+            if (last_checkpoint != previous)
+            {
+                cleaning = 0;
+                return 1;
+            }
+            break;
+        }
+
+        cleaning_segment = pick_victim();
+        if (cleaning_segment == NO_SEGMENT)
+        {
+            // a fresh checkpoint tightens checkpoint_bound(), which may let a victim fit
+            struct wfs_checkpoint *previous = last_checkpoint;
+            if (appended_since_checkpoint > 0)
+                write_checkpoint();
+
+            cleaning = 0;
+            return last_checkpoint != previous;
+        }
+        cleaning_pos = segment_start(cleaning_segment) + segment_header_size;
+    }
+
+    // skip the garbage up to the next entry that is still in use
+    char *end = segment_end(cleaning_segment);
+    STAT(cleaner_steps, 1);
+    while (valid_log_entry(cleaning_pos, end) && !entry_is_live(cleaning_pos - base))
+    {
+        STAT(cleaner_scanned, 1);
+        cleaning_pos += ((struct wfs_log_entry *)cleaning_pos)->inode.size;
+    }
+
+    if (valid_log_entry(cleaning_pos, end))
+    {
+        struct wfs_log_entry *log_entry = (struct wfs_log_entry *)cleaning_pos;
+
+        // a checkpoint is moved by writing a newer one, an inode by copying what it uses here
+        if (log_entry->inode.flags == WFS_ENTRY_CHECKPOINT)
+            write_checkpoint();
+        else
+            progress = relocate_inode(log_entry->inode.inode_number);
+
+        if (progress && entry_is_live(cleaning_pos - base))
+            progress = 0;
+        if (progress)
+        {
+            STAT(cleaner_scanned, 1);
+            cleaning_pos += log_entry->inode.size;
+        }
+    }
+    else
+    {
+        // everything in the victim has moved out, it is free once no checkpoint refers to it
+        if (segments[cleaning_segment].live_bytes == 0)
+            segments[cleaning_segment].reusable_at = (last_checkpoint != NULL ? last_checkpoint->version : 0) + 2;
+        else
+            LOG(LEVEL_WARN, "Segment %u still holds %zu live bytes after cleaning\n", cleaning_segment, segments[cleaning_segment].live_bytes);
+        cleaning_segment = NO_SEGMENT;
+    }
+
+    cleaning = 0;
+    return progress;
+}
+
+// Check whether the background cleaner has work: a victim half cleaned or too few free segments
+static int cleaning_needed()
+{
+    return cleaning_segment != NO_SEGMENT || free_segments() < handler_reserve() + CLEANER_MIN_FREE;
+}
+
+static pthread_rwlock_t *lock_log();
+static void unlock_guard(pthread_rwlock_t **lock);
+static void flush_buffers(int all);
+
+// Hold the log lock exclusively for the rest of the block, see lock_log
+#define LOCK_LOG() pthread_rwlock_t *log_guard __attribute__((cleanup(unlock_guard))) = lock_log()
+
+// Do one step of cleaning if the log needs it, returns 0 if there was nothing to do or nothing to gain
+static int clean_once(struct cleaning_round *round)
+{
+    LOCK_LOG();
+
+    return cleaning_needed() && clean_step() && cleaning_gains(round);
+}
+
+// Background cleaner, one step at a time with the log lock released in between so handlers stay responsive
+static void *cleaner_main(void *arg)
+{
+    struct cleaning_round round = {0, 0};
+
+    pthread_mutex_lock(&cleaner_lock);
+
+    while (!cleaner_stop)
+    {
+        cleaner_kicked = 0;
+        pthread_mutex_unlock(&cleaner_lock);
+
+        flush_buffers(0);
+        int progress = clean_once(&round);
+        if (progress)
+            sched_yield();
+
+        // nothing to do until the head moves on to another segment, or write buffers get old
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += WRITE_BUFFER_AGE;
+
+        pthread_mutex_lock(&cleaner_lock);
+        while (!progress && !cleaner_kicked && !cleaner_stop)
+            if (pthread_cond_timedwait(&cleaner_wakeup, &cleaner_lock, &deadline) == ETIMEDOUT)
+                break;
+    }
+
+    pthread_mutex_unlock(&cleaner_lock);
+    return NULL;
+}
+
+// Look a path up in the dentry cache; returns 1 on a hit and stores the cached inode number (WFS_NO_INODE for a
+// negative entry)
+static int dcache_lookup(const char *path, unsigned int *inode_number)
+{
+    struct dcache_entry *entry = &dcache[hash_path(path) % DCACHE_SIZE];
+    int hit;
+
+    pthread_mutex_lock(&dcache_lock);
+    hit = entry->valid && strcmp(entry->path, path) == 0;
+
+    // a name created or unlinked since may have left the entry stale
+    if (hit)
+        hit = entry->changes == (entry->inode_number == WFS_NO_INODE ? names_created : names_unlinked);
+
+    if (hit)
+    {
+        dcache_hits += 1;
+        *inode_number = entry->inode_number;
+    }
+    else
+    {
+        dcache_misses += 1;
+    }
+    pthread_mutex_unlock(&dcache_lock);
+
+    return hit;
+}
+
+// Cache the inode number of a path (WFS_NO_INODE records that the path does not exist), evicting whatever shared
+// its slot
+static void dcache_insert(const char *path, unsigned int inode_number)
+{
+    // paths that don't fit are simply not cached
+    if (strlen(path) >= MAX_PATH_LEN)
+        return;
+
+    struct dcache_entry *entry = &dcache[hash_path(path) % DCACHE_SIZE];
+
+    pthread_mutex_lock(&dcache_lock);
+    strcpy(entry->path, path);
+    entry->inode_number = inode_number;
+    entry->valid = 1;
+    entry->changes = inode_number == WFS_NO_INODE ? names_created : names_unlinked;
+    pthread_mutex_unlock(&dcache_lock);
+}
+
+// Find a name among the dentries of a directory log entry, -1 if it isn't there
+static int find_dentry(struct inode_state *dir, const char *name)
+{
+    int position = name_position(dir, name);
+    if (position < 0)
+        return -1;
+
+    return ((struct wfs_dentry *)(base + dir->dentries[position].dentry))->inode_number;
+}
+
+// Resolve the first length bytes of a path to an inode number, -1 if they don't name anything
+// Misses resolve the parent (itself usually cached) and scan only its dentries; prefixes too long for the
+// cache skip it and are walked a component at a time
+static int resolve_prefix(const char *path, size_t length)
+{
+    // base case -- either "" or "/"
+    if (length <= 1)
+        return 0;
+
+    char key[MAX_PATH_LEN];
+    int cacheable = length < MAX_PATH_LEN;
+    if (cacheable)
+    {
+        unsigned int cached;
+        memcpy(key, path, length);
+        key[length] = '\0';
+        if (dcache_lookup(key, &cached))
+            return cached == WFS_NO_INODE ? -1 : (int)cached;
+    }
+
+    const char *last_slash = memrchr(path, '/', length);
+    if (last_slash == NULL)
+        return -1;
+
+    // names that long can't be in any directory
+    int inode_number = -1;
+    char name[MAX_FILE_NAME_LEN];
+    size_t name_length = path + length - (last_slash + 1);
+    if (name_length < MAX_FILE_NAME_LEN)
+    {
+        memcpy(name, last_slash + 1, name_length);
+        name[name_length] = '\0';
+
+        int parent_inode_number = resolve_prefix(path, last_slash - path);
+        if (parent_inode_number >= 0)
+        {
+            struct wfs_log_entry *parent = get_inode_entry(parent_inode_number);
+            if (parent != NULL && S_ISDIR(parent->inode.mode))
+                inode_number = find_dentry(get_inode_state(parent_inode_number), name);
+        }
+    }
+
+    if (cacheable)
+        dcache_insert(key, inode_number < 0 ? WFS_NO_INODE : (unsigned int)inode_number);
+    return inode_number;
+}
+
+// Resolve a path to its inode number, -1 if it doesn't exist
+static int resolve_path(const char *path)
+{
+    return path == NULL ? 0 : resolve_prefix(path, strlen(path));
+}
+
+////// BELOW IS FOR FUSE ///////
+
+// Take the log lock exclusively, reloading first if fsck.wfs compacted the log, see LOCK_LOG
+static pthread_rwlock_t *lock_log()
+{
+    pthread_rwlock_wrlock(&log_lock);
+    reload_if_compacted();
+
+    return &log_lock;
+}
+
+// Take the log lock shared, see LOCK_LOG_SHARED. Reloading rebuilds everything, so that happens
+// with the lock held exclusively before settling for shared
+static pthread_rwlock_t *lock_log_shared()
+{
+    pthread_rwlock_rdlock(&log_lock);
+
+    while (log_compacted())
+    {
+        pthread_rwlock_unlock(&log_lock);
+        pthread_rwlock_wrlock(&log_lock);
+        reload_if_compacted();
+        pthread_rwlock_unlock(&log_lock);
+        pthread_rwlock_rdlock(&log_lock);
+    }
+
+    return &log_lock;
+}
+
+// Take the lock of an inode, shared or exclusively, see LOCK_INODE
+static pthread_rwlock_t *lock_inode(unsigned int inode_number, int exclusive)
+{
+    pthread_rwlock_t *lock = &inode_locks[inode_number % INODE_LOCK_COUNT];
+
+    if (exclusive)
+        pthread_rwlock_wrlock(lock);
+    else
+        pthread_rwlock_rdlock(lock);
+
+    return lock;
+}
+
+// Release a lock when the block holding it ends
+static void unlock_guard(pthread_rwlock_t **lock)
+{
+    pthread_rwlock_unlock(*lock);
+}
+
+// Hold the log lock shared for the rest of the handler: the cleaner never moves entries under it and
+// the namespace stays put, but writers to other inodes append at the same time
+#define LOCK_LOG_SHARED() pthread_rwlock_t *log_guard __attribute__((cleanup(unlock_guard))) = lock_log_shared()
+
+// Hold an inode's lock for the rest of the block, exclusively to append for it or shared to read it
+#define LOCK_INODE(inode_number) pthread_rwlock_t *inode_guard __attribute__((cleanup(unlock_guard))) = lock_inode(inode_number, 1)
+#define LOCK_INODE_SHARED(inode_number) pthread_rwlock_t *inode_guard __attribute__((cleanup(unlock_guard))) = lock_inode(inode_number, 0)
+
+// Read-only file in the root reporting the statistics, generated when opened. It is never listed and
+// goes by an inode number no inode gets
+#define STATS_NAME ".wfs_stats"
+#define STATS_INODE (WFS_NO_INODE - 1)
+
+// Check whether a name in a directory is the statistics file
+static int is_stats_name(unsigned int dir_inode, const char *name)
+{
+    return dir_inode == 0 && strcmp(name, STATS_NAME) == 0;
+}
+
+// Fill in what stat reports for the statistics file. Like a /proc file it has no size, it is read
+// with direct I/O until a read comes back short
+static void stats_stat(struct stat *stbuf)
+{
+    memset(stbuf, 0, sizeof(struct stat));
+    stbuf->st_ino = WFS_INO(STATS_INODE);
+    stbuf->st_uid = getuid();
+    stbuf->st_gid = getgid();
+    stbuf->st_atime = time(NULL);
+    stbuf->st_mtime = stbuf->st_atime;
+    stbuf->st_mode = S_IFREG | 0444;
+    stbuf->st_nlink = 1;
+}
+
+// Access time of an inode with its latest entry, newer in memory than in the log until it is written out
+static unsigned int inode_atime(struct wfs_log_entry *log_entry)
+{
+    struct inode_state *state = get_inode_state(log_entry->inode.inode_number);
+    unsigned int atime = state != NULL ? __atomic_load_n(&state->atime, __ATOMIC_RELAXED) : 0;
+
+    return atime > log_entry->inode.atime ? atime : log_entry->inode.atime;
+}
+
+// Record an access to the inode of an entry as atime_mode asks. Only in memory, so reads and stats leave
+// the log's pages clean; readers holding its inode's lock shared do it side by side
+static void touch_atime(struct wfs_log_entry *log_entry)
+{
+    struct inode_state *state = get_inode_state(log_entry->inode.inode_number);
+    unsigned int now = time(NULL);
+
+    if (state == NULL || atime_mode == ATIME_NONE)
+        return;
+
+    // relatime only records the first access after a change, or one a day
+    unsigned int atime = inode_atime(log_entry);
+    if (atime_mode == ATIME_RELATIVE && atime > log_entry->inode.mtime && atime > log_entry->inode.ctime && now - atime < RELATIME_INTERVAL)
+        return;
+
+    __atomic_store_n(&state->atime, now, __ATOMIC_RELAXED);
+}
+
+// Append the access times only kept in memory before unmounting, an attributes record for each inode
+// that has one. Times that no longer fit in the log are lost
+static void write_atimes()
+{
+    for (unsigned int i = 0; i < inode_map_capacity; i++)
+    {
+        struct wfs_log_entry *log_entry = get_inode_entry(i);
+        if (log_entry == NULL || inode_map[i].orphan || inode_map[i].atime <= log_entry->inode.atime)
+            continue;
+
+        if (!append_attributes(i))
+            return;
+    }
+}
+
+// Fill in what stat reports for an inode from its latest entry, with its inode's lock held
+static void fill_stat(struct wfs_log_entry *log_entry, struct stat *stbuf)
+{
+    struct inode_state *state = get_inode_state(log_entry->inode.inode_number);
+
+    stbuf->st_ino = WFS_INO(log_entry->inode.inode_number);
+    stbuf->st_uid = log_entry->inode.uid;
+    stbuf->st_gid = log_entry->inode.gid;
+    stbuf->st_atime = inode_atime(log_entry);
+    stbuf->st_mtime = log_entry->inode.mtime;
+    if (state != NULL && state->dirty != NULL && state->dirty->mtime > stbuf->st_mtime)
+        stbuf->st_mtime = state->dirty->mtime;
+    stbuf->st_mode = log_entry->inode.mode;
+    stbuf->st_nlink = state != NULL && state->orphan ? 0 : log_entry->inode.links;
+    stbuf->st_size = inode_size(log_entry);
+}
+
+// Get the attributes of an inode with the log lock held shared, returns 0 or -ENOENT
+static int getattr_inode(unsigned int inode_number, struct stat *stbuf)
+{
+    if (inode_number == STATS_INODE)
+    {
+        stats_stat(stbuf);
+        return 0;
+    }
+
+    // its latest entry moves on whenever a writer appends for it
+    LOCK_INODE_SHARED(inode_number);
+    struct wfs_log_entry *log_entry = get_inode_entry(inode_number);
+
+    if(log_entry == NULL) {
+        LOG(LEVEL_DEBUG, "Inode Does Not Exist.\nInode: %u\n", inode_number);
+        return -ENOENT;
+    }
+
+    // Update time of last access
+    touch_atime(log_entry);
+
+    memset(stbuf, 0, sizeof(struct stat));
+    fill_stat(log_entry, stbuf);
+
+    return 0;
+}
+
+// Create a file or directory (type S_IFREG or S_IFDIR) under a name in a directory, with the log lock
+// held exclusively. Returns its inode number or a negative errno
+static int create_inode(unsigned int parent_inode, const char *name, mode_t type)
+{
+    // Get parent directory log entry
+    struct wfs_log_entry *parent_log_entry = get_inode_entry(parent_inode);
+
+    if(parent_log_entry == NULL || !S_ISDIR(parent_log_entry->inode.mode)) {
+        LOG(LEVEL_DEBUG, "Parent Directory Does Not Exist.\nInode: %u\n", parent_inode);
+        return -ENOENT;
+    }
+
+    if (strlen(name) >= MAX_FILE_NAME_LEN)
+    {
+        LOG(LEVEL_DEBUG, "Name Too Long.\nName: %s\n", name);
+        return -ENAMETOOLONG;
+    }
+
+    // Verify the name isn't in use in the parent dir yet
+    if (find_dentry(get_inode_state(parent_inode), name) >= 0 || is_stats_name(parent_inode, name))
+    {
+        LOG(LEVEL_DEBUG, "Name Already In Use Locally.\nName: %s\n", name);
+        return -EEXIST;
+    }
+
+    // perform size bounds checking
+    // current size + dentry record for the parent + size of new log entry
+    if (!log_has_room(DENTRY_ENTRY_SIZE + sizeof(struct wfs_log_entry), DENTRY_ENTRY_SIZE)) {
+        LOG(LEVEL_DEBUG, "Insufficient Disk Space to Perform Operation.\n");
+        return -ENOSPC;
+    }
+
+    // Create a log entry for a new inode
+    struct wfs_log_entry new_log_entry;
+    inode_count += 1;
+
+    new_log_entry.inode.inode_number = inode_count;
+    new_log_entry.inode.deleted = 0;
+    new_log_entry.inode.mode = type;
+    new_log_entry.inode.uid = getuid();
+    new_log_entry.inode.gid = getgid();
+    new_log_entry.inode.flags = 0;
+    new_log_entry.inode.size = sizeof(struct wfs_inode);
+    new_log_entry.inode.atime = time(NULL);
+    new_log_entry.inode.mtime = time(NULL);
+    new_log_entry.inode.ctime = time(NULL);
+    new_log_entry.inode.links = 1;
+
+    // append the log entry and point the inode map at it
+    append_log_entry(&new_log_entry);
+    names_created++;
+
+    // only then link it into its parent, with a small record instead of a copy of the parent
+    struct wfs_dentry new_dentry;
+    memset(&new_dentry, 0, sizeof(struct wfs_dentry));
+    strcpy(new_dentry.name, name);
+    new_dentry.inode_number = new_log_entry.inode.inode_number;
+    append_dentry_entry(parent_inode, WFS_ENTRY_DENTRY_ADD, &new_dentry, 1);
+
+    return new_dentry.inode_number;
+}
+
+// Unlink a name from a directory with the log lock held exclusively. An inode the kernel still holds
+// references to lives on as an orphan until it forgets the last of them. Returns 0 or a negative errno
+static int unlink_name(unsigned int parent_inode, const char *name)
+{
+    // get parent log entry
+    struct wfs_log_entry *parent_log_entry = get_inode_entry(parent_inode);
+
+    if(parent_log_entry == NULL || !S_ISDIR(parent_log_entry->inode.mode)) {
+        LOG(LEVEL_DEBUG, "Parent Directory Does Not Exist.\nInode: %u\n", parent_inode);
+        return -ENOENT;
+    }
+
+    if (is_stats_name(parent_inode, name))
+        return -EPERM;
+
+    touch_atime(parent_log_entry);
+
+    // perform size bounds checking
+    // current size + dentry remove record for the parent, which may dip into the remove reserve
+    removing = 1;
+    int room = log_has_room(DENTRY_ENTRY_SIZE, DENTRY_ENTRY_SIZE);
+    removing = 0;
+    if (!room) {
+        LOG(LEVEL_DEBUG, "Insufficient Disk Space to Perform Operation.\n");
+        return -ENOSPC;
+    }
+
+    // get target log entry
+    int inode_number = find_dentry(get_inode_state(parent_inode), name);
+    struct wfs_log_entry *log_entry = inode_number < 0 ? NULL : get_inode_entry(inode_number);
+
+    if(log_entry == NULL) {
+        LOG(LEVEL_DEBUG, "Name Does Not Exist.\nName: %s\n", name);
+        return -ENOENT;
+    }
+
+    // the kernel may still hold the inode, then its entries stay live until the last reference is forgotten
+    struct inode_state *state = get_inode_state(inode_number);
+    if (state->lookups > 0)
+        state->orphan = 1;
+
+    // unlink the name from its parent with a small record instead of a copy of the parent. Applying it
+    // drops the inode from the inode map, and replay does the same, so the inode's own entries stay as
+    // they were written
+    struct wfs_dentry old_dentry;
+    memset(&old_dentry, 0, sizeof(struct wfs_dentry));
+    strncpy(old_dentry.name, name, MAX_FILE_NAME_LEN - 1);
+    old_dentry.inode_number = inode_number;
+    append_dentry_entry(parent_inode, WFS_ENTRY_DENTRY_REMOVE, &old_dentry, 1);
+    names_unlinked++;
+
+    return 0;
+}
+
+// Add a buffer to a vector being built by map_file, growing it as needed
+static struct fuse_bufvec *add_buffer(struct fuse_bufvec *bufv, size_t *capacity, struct fuse_buf buf)
+{
+    if (bufv->count == *capacity)
+    {
+        *capacity *= 2;
+        bufv = realloc(bufv, sizeof(struct fuse_bufvec) + (*capacity - 1) * sizeof(struct fuse_buf));
+        if (bufv == NULL)
+        {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    bufv->buf[bufv->count++] = buf;
+    return bufv;
+}
+
+// Whether a piece of a vector built by map_file is in place in the image
+static int in_image(const void *mem)
+{
+    return (const char *)mem >= base && (const char *)mem < base + disk_size;
+}
+
+// Copy the pieces of a vector built by map_file into buf, those in the image through the storage backend
+static void copy_pieces(struct fuse_bufvec *bufv, char *buf)
+{
+    struct storage_read *reads = malloc(bufv->count * sizeof(struct storage_read));
+    if (reads == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned int read_count = 0;
+    size_t done = 0;
+    for (size_t i = 0; i < bufv->count; i++)
+    {
+        const char *from = bufv->buf[i].mem;
+        if (in_image(from))
+            reads[read_count++] = (struct storage_read){buf + done, from, bufv->buf[i].size};
+        else
+            memcpy(buf + done, from, bufv->buf[i].size);
+        done += bufv->buf[i].size;
+    }
+
+    if (read_count > 0)
+        backend->read(reads, read_count);
+    free(reads);
+}
+
+// Copy the pieces of a vector built by map_file into one buffer. Returns the new vector, freed the same
+// way, in place of the old one
+static struct fuse_bufvec *flatten_buffers(struct fuse_bufvec *bufv)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < bufv->count; i++)
+        size += bufv->buf[i].size;
+
+    struct fuse_bufvec *flat = malloc(sizeof(struct fuse_bufvec) + size);
+    if (flat == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    copy_pieces(bufv, (char *)(flat + 1));
+    free(bufv);
+
+    *flat = FUSE_BUFVEC_INIT(size);
+    flat->buf[0].mem = flat + 1;
+    return flat;
+}
+
+// Flatten a vector built by map_file, see flatten_buffers, and lay the range of a write buffer over it
+static struct fuse_bufvec *overlay_write_buffer(struct fuse_bufvec *bufv, struct write_buffer *buffer, size_t size, off_t offset)
+{
+    struct fuse_bufvec *flat = flatten_buffers(bufv);
+    char *bytes = flat->buf[0].mem;
+
+    size_t start = buffer->offset > (size_t)offset ? buffer->offset : offset;
+    size_t end = buffer->offset + buffer->length < offset + size ? buffer->offset + buffer->length : offset + size;
+    memcpy(bytes + (start - offset), buffer->data + (start - buffer->offset), end - start);
+    return flat;
+}
+
+// Describe up to size bytes of a file from offset as buffers in place in the log, one per extent piece,
+// with holes read from zero_block -- as the image file at each piece's offset if by_fd, so libfuse can
+// splice them, or as the mapping otherwise. With the log lock held shared, which keeps the cleaner from
+// moving the bytes until it is released. handle, if not NULL, is the open file read through, whose cursor
+// is used and moved on. Writes still in the file's write buffer are copied over the pieces, which come
+// back as one buffer in memory then. Returns a malloc'd vector or NULL if the inode doesn't exist
+static struct fuse_bufvec *map_file(unsigned int inode_number, size_t size, off_t offset, int by_fd, struct wfs_file *handle)
+{
+    // writers to the file wait until its extents have been looked up
+    LOCK_INODE_SHARED(inode_number);
+
+    // Grab log entry for desired file
+    struct wfs_log_entry *f = get_inode_entry(inode_number);
+
+    if(f == NULL) {
+        LOG(LEVEL_DEBUG, "Inode Does Not Exist.\nInode: %u\n", inode_number);
+        return NULL;
+    }
+
+    struct inode_state *state = get_inode_state(inode_number);
+
+    size_t capacity = 4;
+    struct fuse_bufvec *bufv = malloc(sizeof(struct fuse_bufvec) + (capacity - 1) * sizeof(struct fuse_buf));
+    if (bufv == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    *bufv = FUSE_BUFVEC_INIT(0);
+    bufv->count = 0;
+
+    touch_atime(f);
+
+    // Check if offset is too large
+    size_t file_size = buffered_file_size(state);
+    if (offset >= file_size)
+        return bufv;
+
+    // Don't read past the end of the file
+    if (offset + size > file_size)
+        size = file_size - offset;
+
+    // bytes not logged yet have to be copied out of the write buffer
+    struct write_buffer *buffer = state->dirty;
+    if (buffer != NULL && (buffer->offset >= offset + size || buffer->offset + buffer->length <= (size_t)offset))
+        buffer = NULL;
+    if (buffer != NULL)
+        by_fd = 0;
+
+    // Find the first extent that ends after the offset -- a read carrying on from the last one through
+    // the same handle starts where that one stopped, unless the extents changed since
+    unsigned int low = 0, high = state->extent_count;
+    if (handle != NULL)
+    {
+        pthread_mutex_lock(&handle->cursor_lock);
+        if (handle->generation == state->generation && handle->next_offset == (size_t)offset)
+            low = high = handle->extent;
+        pthread_mutex_unlock(&handle->cursor_lock);
+    }
+    while (low < high)
+    {
+        unsigned int mid = (low + high) / 2;
+        if (state->extents[mid].offset + state->extents[mid].length <= offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    // Walk the extents over the requested range, holes read as zeros
+    size_t done = 0;
+    unsigned int i = low;
+    while (done < size)
+    {
+        size_t position = offset + done;
+        struct fuse_buf buf = {.fd = -1};
+
+        if (i == state->extent_count || state->extents[i].offset > position)
+        {
+            size_t hole_end = i == state->extent_count || state->extents[i].offset >= offset + size ? offset + size : state->extents[i].offset;
+            buf.size = hole_end - position < sizeof(zero_block) ? hole_end - position : sizeof(zero_block);
+            buf.mem = zero_block;
+        }
+        else
+        {
+            struct extent *curr = &state->extents[i++];
+            size_t available = curr->offset + curr->length - position;
+
+            buf.size = available < size - done ? available : size - done;
+            if (by_fd)
+            {
+                buf.flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+                buf.fd = disk_fd;
+                buf.pos = curr->data + (position - curr->offset);
+            }
+            else
+            {
+                buf.mem = base + curr->data + (position - curr->offset);
+            }
+        }
+
+        bufv = add_buffer(bufv, &capacity, buf);
+        done += buf.size;
+    }
+
+    if (handle != NULL)
+    {
+        // the last extent read from may go on past the range
+        unsigned int next = i;
+        if (next > 0 && state->extents[next - 1].offset + state->extents[next - 1].length > offset + size)
+            next--;
+
+        pthread_mutex_lock(&handle->cursor_lock);
+        handle->generation = state->generation;
+        handle->next_offset = offset + size;
+        handle->extent = next;
+        pthread_mutex_unlock(&handle->cursor_lock);
+    }
+
+    if (buffer != NULL)
+        bufv = overlay_write_buffer(bufv, buffer, size, offset);
+
+    return bufv;
+}
+
+// Copy up to size bytes of a file from offset into buf with the log lock held shared, holes read as
+// zeros, see map_file. Returns the number of bytes read or -ENOENT
+static int read_file(unsigned int inode_number, char *buf, size_t size, off_t offset, struct wfs_file *handle)
+{
+    struct fuse_bufvec *bufv = map_file(inode_number, size, offset, 0, handle);
+
+    if (bufv == NULL)
+        return -ENOENT;
+
+    size_t done = 0;
+    for (size_t i = 0; i < bufv->count; i++)
+        done += bufv->buf[i].size;
+
+    copy_pieces(bufv, buf);
+    free(bufv);
+    return done;
+}
+
+// Write out the statistics added up over all threads, with the log lock held shared. Returns the text
+// in a new buffer and its length in length
+static char *render_stats(size_t *length)
+{
+    struct thread_stats sum;
+    memset(&sum, 0, sizeof(struct thread_stats));
+
+    // the counters go on moving meanwhile, each one is read whole
+    pthread_mutex_lock(&stats_lock);
+    for (struct thread_stats *stats = all_stats; stats != NULL; stats = stats->next)
+    {
+        for (int op = 0; op < OP_COUNT; op++)
+        {
+            sum.calls[op] += __atomic_load_n(&stats->calls[op], __ATOMIC_RELAXED);
+            sum.errors[op] += __atomic_load_n(&stats->errors[op], __ATOMIC_RELAXED);
+            sum.nanoseconds[op] += __atomic_load_n(&stats->nanoseconds[op], __ATOMIC_RELAXED);
+            for (int i = 0; i < LATENCY_BUCKETS; i++)
+                sum.latency[op][i] += __atomic_load_n(&stats->latency[op][i], __ATOMIC_RELAXED);
+        }
+        sum.bytes_appended += __atomic_load_n(&stats->bytes_appended, __ATOMIC_RELAXED);
+        sum.bytes_superseded += __atomic_load_n(&stats->bytes_superseded, __ATOMIC_RELAXED);
+        sum.bytes_written += __atomic_load_n(&stats->bytes_written, __ATOMIC_RELAXED);
+        sum.buffers_flushed += __atomic_load_n(&stats->buffers_flushed, __ATOMIC_RELAXED);
+        sum.syncs += __atomic_load_n(&stats->syncs, __ATOMIC_RELAXED);
+        sum.cleaner_steps += __atomic_load_n(&stats->cleaner_steps, __ATOMIC_RELAXED);
+        sum.cleaner_scanned += __atomic_load_n(&stats->cleaner_scanned, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    // writers move the head and take segments with the log lock shared
+    pthread_mutex_lock(&head_lock);
+    size_t used = total_size;
+    unsigned int free_count = free_segment_count;
+    pthread_mutex_unlock(&head_lock);
+
+    pthread_mutex_lock(&dcache_lock);
+    unsigned long hits = dcache_hits, misses = dcache_misses;
+    pthread_mutex_unlock(&dcache_lock);
+
+    char *text;
+    FILE *out = open_memstream(&text, length);
+    if (out == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(out, "uptime_seconds %ld\n", (long)(time(NULL) - stats_since));
+    fprintf(out, "log_bytes_used %zu\n", used);
+    fprintf(out, "log_bytes_live %zu\n", __atomic_load_n(&live_size, __ATOMIC_RELAXED));
+    fprintf(out, "log_bytes_appended %lu\n", sum.bytes_appended);
+    fprintf(out, "log_bytes_superseded %lu\n", sum.bytes_superseded);
+    fprintf(out, "file_bytes_written %lu\n", sum.bytes_written);
+    fprintf(out, "write_buffers_flushed %lu\n", sum.buffers_flushed);
+    fprintf(out, "log_syncs %lu\n", sum.syncs);
+    fprintf(out, "segments_free %u\n", free_count);
+    fprintf(out, "segments_total %u\n", segment_count);
+    fprintf(out, "replayed_entries %zu\n", replayed_entries);
+    fprintf(out, "cleaner_steps %lu\n", sum.cleaner_steps);
+    fprintf(out, "cleaner_scanned_entries %lu\n", sum.cleaner_scanned);
+    fprintf(out, "dentry_cache_hits %lu\n", hits);
+    fprintf(out, "dentry_cache_misses %lu\n", misses);
+
+    // one line per operation, then its latency histogram: calls under each power of two nanoseconds
+    for (int op = 0; op < OP_COUNT; op++)
+    {
+        fprintf(out, "%s calls %lu errors %lu mean_ns %lu\n", op_names[op], sum.calls[op], sum.errors[op],
+                sum.calls[op] > 0 ? sum.nanoseconds[op] / sum.calls[op] : 0);
+        if (sum.calls[op] == 0)
+            continue;
+
+        fprintf(out, "%s latency_ns", op_names[op]);
+        for (int i = 0; i < LATENCY_BUCKETS; i++)
+        {
+            if (sum.latency[op][i] == 0)
+                continue;
+            if (i == LATENCY_BUCKETS - 1)
+                fprintf(out, " >=%lu:%lu", 1UL << i, sum.latency[op][i]);
+            else
+                fprintf(out, " <%lu:%lu", 1UL << (i + 1), sum.latency[op][i]);
+        }
+        fprintf(out, "\n");
+    }
+
+    fclose(out);
+    return text;
+}
+
+// Open the statistics file: the statistics are taken now, reads go through the snapshot in the handle.
+// Returns 0 or -EACCES if it was opened for writing
+static int open_stats(int flags, struct wfs_file **file)
+{
+    if ((flags & O_ACCMODE) != O_RDONLY)
+        return -EACCES;
+
+    struct wfs_file *handle = calloc(1, sizeof(struct wfs_file));
+    if (handle == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    handle->inode_number = STATS_INODE;
+    pthread_mutex_init(&handle->cursor_lock, NULL);
+    handle->snapshot = render_stats(&handle->snapshot_length);
+
+    *file = handle;
+    return 0;
+}
+
+// Get the part of an open statistics file's snapshot a read asks for, shortening size to what is there
+static const char *read_snapshot(struct wfs_file *handle, size_t *size, off_t offset)
+{
+    if (offset >= (off_t)handle->snapshot_length)
+    {
+        *size = 0;
+        return handle->snapshot;
+    }
+    if (*size > handle->snapshot_length - offset)
+        *size = handle->snapshot_length - offset;
+
+    return handle->snapshot + offset;
+}
+
+// Open a regular file, or the statistics file, with the log lock held. Returns 0 with the new handle
+// in file, -ENOENT, -EISDIR or -EACCES
+static int open_inode(unsigned int inode_number, int flags, struct wfs_file **file)
+{
+    if (inode_number == STATS_INODE)
+        return open_stats(flags, file);
+
+    LOCK_INODE_SHARED(inode_number);
+    struct wfs_log_entry *log_entry = get_inode_entry(inode_number);
+
+    if(log_entry == NULL) {
+        LOG(LEVEL_DEBUG, "Inode Does Not Exist.\nInode: %u\n", inode_number);
+        return -ENOENT;
+    }
+    if (S_ISDIR(log_entry->inode.mode))
+        return -EISDIR;
+
+    struct wfs_file *handle = calloc(1, sizeof(struct wfs_file));
+    if (handle == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    handle->inode_number = inode_number;
+    pthread_mutex_init(&handle->cursor_lock, NULL);
+
+    *file = handle;
+    return 0;
+}
+
+// Free the handle of a file no longer open
+static void close_file(struct wfs_file *handle)
+{
+    pthread_mutex_destroy(&handle->cursor_lock);
+    free(handle->snapshot);
+    free(handle);
+}
+
+// Clean in the foreground, with the log to itself, until entries adding up to size bytes fit
+static int make_room(size_t size, size_t largest)
+{
+    LOCK_LOG();
+
+    return log_has_room(size, largest);
+}
+
+// Write a checkpoint if one is due, writers holding the log lock shared leave that to this
+static void checkpoint_if_due()
+{
+    if (!checkpoint_due())
+        return;
+
+    LOCK_LOG();
+    if (checkpoint_due())
+        write_checkpoint();
+}
+
+// Append what is left of a written range past written bytes, taking them from buf, with the log lock held
+// shared and the inode's lock exclusively. modify is the time the file was written. Returns the number of
+// bytes written once all of them are, or -ENOSPC with the room still needed in needed and largest if the
+// head is out of room
+static int append_range(unsigned int inode_number, struct fuse_bufvec *buf, size_t size, off_t offset, time_t modify, size_t *written, size_t *needed, size_t *largest)
+{
+    // only the written range is appended, split into entries that fit in a segment
+    size_t chunk = size < max_extent_length() ? size : max_extent_length();
+    size_t entry_size = sizeof(struct wfs_log_entry) + sizeof(struct wfs_extent) + chunk;
+
+    do
+    {
+        *needed = (chunk > 0 ? (size - *written + chunk - 1) / chunk : 1) * entry_size;
+        *largest = entry_size;
+
+        // Check if write would exceed disk space
+        if (*written == 0 && !log_fits_shared(*needed, *largest))
+            return -ENOSPC;
+
+        // other writers may have taken the room in the meantime
+        size_t length = size - *written < chunk ? size - *written : chunk;
+        int result = write_extent(inode_number, offset + *written, buf, length, modify, handler_reserve());
+        if (result == 0)
+            return -ENOSPC;
+        if (result < 0)
+            return *written > 0 ? (int)*written : -EIO;
+        *written += length;
+    } while (*written < size);
+
+    return size;
+}
+
+// Most bytes a write buffer takes: what one extent entry carries, so it goes to the log in one
+static size_t write_buffer_capacity()
+{
+    size_t longest = max_extent_length();
+
+    return longest < WRITE_BUFFER_SIZE ? longest : WRITE_BUFFER_SIZE;
+}
+
+// Give a file an empty write buffer starting at offset, unless the write buffers already take all the
+// memory they may. Returns NULL then, with the cleaner woken up to flush them
+static struct write_buffer *start_write_buffer(unsigned int inode_number, size_t offset)
+{
+    pthread_mutex_lock(&write_buffer_lock);
+
+    if (buffered_bytes + sizeof(struct write_buffer) > WRITE_BUFFER_LIMIT)
+    {
+        pthread_mutex_unlock(&write_buffer_lock);
+        wake_cleaner();
+        return NULL;
+    }
+
+    struct write_buffer *buffer = malloc(sizeof(struct write_buffer));
+    if (buffer == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    buffer->offset = offset;
+    buffer->length = 0;
+    buffer->started = time(NULL);
+    buffer->mtime = buffer->started;
+    buffer->position = dirty_count;
+
+    dirty_inodes = reserve_slot(dirty_inodes, dirty_count, &dirty_capacity, sizeof(struct dirty_inode));
+    dirty_inodes[dirty_count++] = (struct dirty_inode){.inode_number = inode_number, .buffer = buffer};
+    buffered_bytes += sizeof(struct write_buffer);
+
+    pthread_mutex_unlock(&write_buffer_lock);
+    return buffer;
+}
+
+// Append the writes in a file's write buffer as one extent entry and drop the buffer, with the log lock
+// held shared and the inode's lock exclusively. Returns 0, also if there was nothing to flush, or -ENOSPC
+// with the room needed in needed and largest if the head is out of room
+static int flush_write_buffer(unsigned int inode_number, size_t *needed, size_t *largest)
+{
+    struct inode_state *state = get_inode_state(inode_number);
+    struct write_buffer *buffer = state->dirty;
+
+    if (buffer == NULL)
+        return 0;
+
+    *needed = *largest = sizeof(struct wfs_log_entry) + sizeof(struct wfs_extent) + buffer->length;
+    if (!log_fits_shared(*needed, *largest))
+        return -ENOSPC;
+
+    // the bytes are in memory, they can't come up short
+    struct fuse_bufvec bytes = FUSE_BUFVEC_INIT(buffer->length);
+    bytes.buf[0].mem = buffer->data;
+    if (write_extent(inode_number, buffer->offset, &bytes, buffer->length, buffer->mtime, handler_reserve()) == 0)
+        return -ENOSPC;
+
+    STAT(buffers_flushed, 1);
+    remove_write_buffer(buffer);
+    state->dirty = NULL;
+    return 0;
+}
+
+// Take a write into the file's write buffer if it is small and carries on from, or lands inside, what
+// the buffer holds. Anything else flushes the buffer first, so the file's writes reach the log in the
+// order they were made. With the log lock held shared and the inode's lock exclusively. Returns size once
+// buffered, 0 if the write is to be appended straight away, or a negative errno
+static int buffer_write(unsigned int inode_number, struct fuse_bufvec *buf, size_t size, off_t offset, size_t *needed, size_t *largest)
+{
+    struct inode_state *state = get_inode_state(inode_number);
+    struct write_buffer *buffer = state->dirty;
+    size_t capacity = write_buffer_capacity();
+
+    if (buffer != NULL && (offset < buffer->offset || offset > buffer->offset + buffer->length ||
+                           offset + size - buffer->offset > capacity || time(NULL) >= buffer->started + WRITE_BUFFER_AGE))
+    {
+        int result = flush_write_buffer(inode_number, needed, largest);
+        if (result < 0)
+            return result;
+        buffer = NULL;
+    }
+
+    if (size >= capacity)
+        return 0;
+
+    // a buffer is only started while it can be flushed without cleaning first
+    if (buffer == NULL)
+    {
+        size_t entry_size = sizeof(struct wfs_log_entry) + sizeof(struct wfs_extent) + capacity;
+        if (!log_fits_shared(entry_size, entry_size) || (buffer = start_write_buffer(inode_number, offset)) == NULL)
+            return 0;
+        state->dirty = buffer;
+    }
+
+    struct fuse_bufvec room = FUSE_BUFVEC_INIT(size);
+    room.buf[0].mem = buffer->data + (offset - buffer->offset);
+    if (fuse_buf_copy(&room, buf, 0) != (ssize_t)size)
+        return -EIO;
+
+    if (offset + size - buffer->offset > buffer->length)
+        buffer->length = offset + size - buffer->offset;
+    buffer->mtime = time(NULL);
+
+    return size;
+}
+
+// Write what is left of a range past written bytes, see append_range, with the log lock held shared, so
+// lookups and writes to other files go on meanwhile. Small writes only go as far as the file's write buffer
+static int write_range(unsigned int inode_number, struct fuse_bufvec *buf, size_t size, off_t offset, size_t *written, size_t *needed, size_t *largest)
+{
+    LOCK_LOG_SHARED();
+
+    // entries of the file reach the log in the order they are laid over its extents
+    LOCK_INODE(inode_number);
+
+    if(get_inode_entry(inode_number) == NULL) {
+        LOG(LEVEL_DEBUG, "Inode Does Not Exist.\nInode: %u\n", inode_number);
+        return -ENOENT;
+    }
+
+    if (*written == 0 && size > 0)
+    {
+        int result = buffer_write(inode_number, buf, size, offset, needed, largest);
+        if (result != 0)
+            return result;
+    }
+
+    return append_range(inode_number, buf, size, offset, time(NULL), written, needed, largest);
+}
+
+// Write the bytes of buf to a file, cleaning in the foreground whenever the head runs out of room.
+// Returns the number of bytes written or a negative errno
+static int write_file(unsigned int inode_number, struct fuse_bufvec *buf, off_t offset)
+{
+    size_t size = fuse_buf_size(buf);
+    size_t written = 0, needed, largest;
+    int result;
+
+    while ((result = write_range(inode_number, buf, size, offset, &written, &needed, &largest)) == -ENOSPC)
+    {
+        // cleaning moves entries around, so it waits for the log to itself
+        if (!make_room(needed, largest))
+        {
+            LOG(LEVEL_DEBUG, "Insufficient disk space\n");
+            return written > 0 ? written : -ENOSPC;
+        }
+    }
+
+    if (result > 0)
+        STAT(bytes_written, result);
+
+    checkpoint_if_due();
+    return result;
+}
+
+// Flush a file's write buffer with the log lock held shared, see flush_write_buffer
+static int flush_range(unsigned int inode_number, size_t *needed, size_t *largest)
+{
+    LOCK_LOG_SHARED();
+    LOCK_INODE(inode_number);
+
+    if (get_inode_state(inode_number) == NULL)
+        return 0;
+
+    return flush_write_buffer(inode_number, needed, largest);
+}
+
+// Append the writes in a file's write buffer, cleaning in the foreground if the head is out of room.
+// Returns 0, or -ENOSPC if they don't fit in the log, where they stay buffered
+static int flush_inode(unsigned int inode_number)
+{
+    size_t needed, largest;
+    int result;
+
+    while ((result = flush_range(inode_number, &needed, &largest)) == -ENOSPC)
+    {
+        if (!make_room(needed, largest))
+        {
+            LOG(LEVEL_DEBUG, "Insufficient disk space to flush inode %u\n", inode_number);
+            return -ENOSPC;
+        }
+    }
+
+    checkpoint_if_due();
+    return result;
+}
+
+// Flush the write buffers that got old, or all of them if all or if they take half the memory they may
+static void flush_buffers(int all)
+{
+    time_t now = time(NULL);
+    unsigned int count = 0;
+
+    pthread_mutex_lock(&write_buffer_lock);
+    unsigned int *due = malloc((dirty_count + 1) * sizeof(unsigned int));
+    if (due == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    int pressed = buffered_bytes > WRITE_BUFFER_LIMIT / 2;
+    for (unsigned int i = 0; i < dirty_count; i++)
+        if (all || pressed || now >= dirty_inodes[i].buffer->started + WRITE_BUFFER_AGE)
+            due[count++] = dirty_inodes[i].inode_number;
+    pthread_mutex_unlock(&write_buffer_lock);
+
+    // the files may have been flushed, written again or removed since, flushing goes by what is there then
+    for (unsigned int i = 0; i < count; i++)
+        flush_inode(due[i]);
+    free(due);
+}
+
+////// SYNCING ///////
+
+// Write the log through to the disk as far as the head, and the cleared header that ends it there: the
+// segments started or freed since the last sync, the rest of the one the head was in then, and the
+// superblock, pointed at the new head, last.
+// Entries are only complete while nobody holds the log lock shared, so the ranges are taken with it held
+// exclusively and written after letting it go. Returns 0 or -EIO
+static int sync_ranges()
+{
+    struct sync_range *ranges;
+    unsigned int range_count = 0;
+    {
+        LOCK_LOG();
+
+        ranges = malloc((unsynced_count + 1) * sizeof(struct sync_range));
+        if (ranges == NULL)
+        {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+
+        if (!segments[synced_segment].unsynced)
+            ranges[range_count++] = (struct sync_range){synced_head, synced_segment == current_segment ? log_end() : segment_end(synced_segment)};
+
+        // a segment freed since only has its header cleared
+        for (unsigned int i = 0; i < unsynced_count; i++)
+        {
+            unsigned int segment = unsynced_segments[i];
+            char *end = segment == current_segment ? log_end() : segments[segment].sequence == 0 ? segment_start(segment) + segment_header_size : segment_end(segment);
+            ranges[range_count++] = (struct sync_range){segment_start(segment), end};
+            segments[segment].unsynced = 0;
+        }
+        unsynced_count = 0;
+
+        synced_head = head;
+        synced_segment = current_segment;
+        if (superblock->version != 0)
+            superblock->head = head - base;
+    }
+
+    int result = backend->sync(ranges, range_count);
+    free(ranges);
+
+    // the superblock's head only once the entries before it are on the disk
+    struct sync_range superblock_range = {base, base + sizeof(struct wfs_sb)};
+    if (backend->sync(&superblock_range, 1) < 0)
+        result = -EIO;
+
+    STAT(syncs, 1);
+    return result;
+}
+
+// Sync the log, see sync_ranges, sharing the sync with every caller waiting at the same time: the first
+// one in does it, the others wait for it and then do one more for them all. Returns 0 or -EIO
+static int sync_log()
+{
+    pthread_mutex_lock(&sync_lock);
+
+    // one already running may have taken its ranges before the caller's entries went in
+    uint64_t needed = syncs_started + 1;
+    while (syncs_finished < needed)
+    {
+        if (sync_running)
+        {
+            pthread_cond_wait(&sync_done, &sync_lock);
+            continue;
+        }
+
+        sync_running = 1;
+        uint64_t sync = ++syncs_started;
+        pthread_mutex_unlock(&sync_lock);
+
+        int result = sync_ranges();
+
+        pthread_mutex_lock(&sync_lock);
+        sync_running = 0;
+        syncs_finished = sync;
+        sync_result = result;
+        pthread_cond_broadcast(&sync_done);
+    }
+
+    int result = sync_result;
+    pthread_mutex_unlock(&sync_lock);
+    return result;
+}
+
+// Periodic syncs, with the writes still buffered: what a crash loses is bounded by sync_interval
+static void *syncer_main(void *arg)
+{
+    pthread_mutex_lock(&syncer_lock);
+
+    while (!syncer_stop)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += sync_interval / 1000;
+        deadline.tv_nsec += (sync_interval % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        int timed_out = 0;
+        while (!syncer_stop && !timed_out)
+            timed_out = pthread_cond_timedwait(&syncer_wakeup, &syncer_lock, &deadline) == ETIMEDOUT;
+        if (syncer_stop)
+            break;
+        pthread_mutex_unlock(&syncer_lock);
+
+        flush_buffers(1);
+        sync_log();
+
+        pthread_mutex_lock(&syncer_lock);
+    }
+
+    pthread_mutex_unlock(&syncer_lock);
+    return NULL;
+}
+
+////// IN-PROCESS API ///////
+
+// The open image, see wfs_open_image
+struct wfs {
+    int fd;
+    size_t mapped_size;
+};
+
+static struct wfs loaded_image;
+static int image_open;
+static int image_loaded;       // set once an image was loaded, whatever it left in memory goes before the next one
+
+// Fill in the attributes of an inode, with the log lock held, and take a reference on it if hold.
+// Returns 0 or -ENOENT
+static int lookup_inode(unsigned int inode_number, struct stat *stbuf, int hold)
+{
+    LOCK_INODE_SHARED(inode_number);
+    struct wfs_log_entry *log_entry = get_inode_entry(inode_number);
+
+    if(log_entry == NULL) {
+        LOG(LEVEL_DEBUG, "Inode Does Not Exist.\nInode: %u\n", inode_number);
+        return -ENOENT;
+    }
+
+    memset(stbuf, 0, sizeof(struct stat));
+    fill_stat(log_entry, stbuf);
+
+    if (hold)
+        COUNT(get_inode_state(inode_number)->lookups, 1);
+    return 0;
+}
+
+// Resolve the directory holding the last name of a path, -1 if it doesn't exist
+static int resolve_parent(const char *path)
+{
+    const char *last_slash = strrchr(path, '/');
+
+    if (last_slash == NULL)
+        return -1;
+
+    return resolve_prefix(path, last_slash - path);
+}
+
+struct wfs *wfs_open_image(const char *disk_path)
+{
+    if (image_open)
+    {
+        errno = EBUSY;
+        return NULL;
+    }
+
+    int fd = open(disk_path, O_RDWR, 0666);
+    if (fd == -1)
+        return NULL;
+
+    // Get file info (for file size)
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    base = mmap(NULL, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    // Cast superblock
+    superblock = (struct wfs_sb *)base;
+
+    // Check magic number, only legacy images and the current format can be read
+    int usable = 0;
+    if (superblock->magic != WFS_MAGIC)
+        LOG(LEVEL_ERROR, "%s is not a wfs image\n", disk_path);
+    else if (superblock->version != 0 && superblock->version != WFS_VERSION)
+        LOG(LEVEL_ERROR, "Unsupported format version %u, recreate the image with mkfs.wfs\n", superblock->version);
+    // The segments cover the size the image was made for, which a truncated file no longer holds
+    else if (superblock->version != 0 && superblock->disk_size > (uint64_t)file_stat.st_size)
+        LOG(LEVEL_ERROR, "Image is %zu bytes but was made for %llu bytes\n", (size_t)file_stat.st_size, (unsigned long long)superblock->disk_size);
+    else
+        usable = 1;
+
+    if (!usable)
+    {
+        munmap(base, file_stat.st_size);
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    disk_fd = fd;
+    disk_size = file_stat.st_size;
+
+    // the mapping serves reads and syncs itself if the backend chosen can't start
+    backend = storage_backends[storage];
+    int started = backend->start();
+    if (started < 0)
+    {
+        LOG(LEVEL_WARN, "No %s storage, going through the mapping: %s\n", backend->name, strerror(-started));
+        backend = &mmap_backend;
+    }
+
+    // Store head global
+    head = base + (superblock->version == 0 ? superblock->legacy_head : superblock->head);
+    log_start = base + (superblock->version == 0 ? WFS_LEGACY_SB_SIZE : sizeof(struct wfs_sb));
+
+    if (image_loaded)
+    {
+        forget_log();
+    }
+    else
+    {
+        // Namespace changes and the cleaner would starve behind a steady stream of lookups otherwise
+        pthread_rwlockattr_t lock_attributes;
+        pthread_rwlockattr_init(&lock_attributes);
+        pthread_rwlockattr_setkind_np(&lock_attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        pthread_rwlock_init(&log_lock, &lock_attributes);
+        pthread_rwlockattr_destroy(&lock_attributes);
+        for (unsigned int i = 0; i < INODE_LOCK_COUNT; i++)
+            pthread_rwlock_init(&inode_locks[i], NULL);
+    }
+
+    // Index the latest live log entry of every inode so lookups don't rescan the log
+    build_inode_map();
+    stats_since = time(NULL);
+    if (superblock->version != 0)
+        mounted_generation = superblock->generation;
+
+    loaded_image.fd = fd;
+    loaded_image.mapped_size = file_stat.st_size;
+    image_open = 1;
+    image_loaded = 1;
+    return &loaded_image;
+}
+
+void wfs_close_image(struct wfs *fs)
+{
+    wfs_stop_background(fs);
+
+    flush_buffers(1);
+    if (dirty_count > 0)
+        LOG(LEVEL_WARN, "Writes to %u files lost, the log is out of room\n", dirty_count);
+
+    // Save the inode map so the next mount doesn't have to replay the log
+    write_atimes();
+    write_checkpoint();
+    if (durability != DURABILITY_NONE)
+        sync_log();
+
+    backend->stop();
+    backend = &mmap_backend;
+    munmap(base, fs->mapped_size);
+    close(fs->fd);
+    image_open = 0;
+}
+
+void wfs_start_background(struct wfs *fs)
+{
+    start_logger();
+    if (!cleaner_running && cleaner_possible() && pthread_create(&cleaner_thread, NULL, cleaner_main, NULL) == 0)
+        cleaner_running = 1;
+    if (!syncer_running && durability == DURABILITY_PERIODIC && pthread_create(&syncer_thread, NULL, syncer_main, NULL) == 0)
+        syncer_running = 1;
+}
+
+void wfs_stop_background(struct wfs *fs)
+{
+    stop_logger();
+
+    if (syncer_running)
+    {
+        pthread_mutex_lock(&syncer_lock);
+        syncer_stop = 1;
+        pthread_cond_signal(&syncer_wakeup);
+        pthread_mutex_unlock(&syncer_lock);
+
+        pthread_join(syncer_thread, NULL);
+        syncer_stop = 0;
+        syncer_running = 0;
+    }
+
+    if (!cleaner_running)
+        return;
+
+    pthread_mutex_lock(&cleaner_lock);
+    cleaner_stop = 1;
+    pthread_cond_signal(&cleaner_wakeup);
+    pthread_mutex_unlock(&cleaner_lock);
+
+    pthread_join(cleaner_thread, NULL);
+    cleaner_stop = 0;
+    cleaner_running = 0;
+}
+
+int wfs_lookup(struct wfs *fs, unsigned int dir_inode, const char *name, struct stat *stbuf, int flags)
+{
+    // the statistics file takes no reference, there is nothing to forget about it
+    if (is_stats_name(dir_inode, name))
+    {
+        stats_stat(stbuf);
+        return 0;
+    }
+
+    LOCK_LOG_SHARED();
+
+    // names only come and go with the log lock held exclusively
+    struct wfs_log_entry *dir_log_entry = get_inode_entry(dir_inode);
+
+    if(dir_log_entry == NULL)
+        return -ENOENT;
+    if (!S_ISDIR(dir_log_entry->inode.mode))
+        return -ENOTDIR;
+
+    int inode_number = find_dentry(get_inode_state(dir_inode), name);
+    if (inode_number < 0)
+        return -ENOENT;
+
+    return lookup_inode(inode_number, stbuf, flags & WFS_HOLD);
+}
+
+int wfs_getattr(struct wfs *fs, unsigned int inode_number, struct stat *stbuf)
+{
+    LOCK_LOG_SHARED();
+
+    return getattr_inode(inode_number, stbuf);
+}
+
+int wfs_create(struct wfs *fs, unsigned int dir_inode, const char *name, mode_t mode, struct stat *stbuf, int flags)
+{
+    LOCK_LOG();
+
+    int inode_number = create_inode(dir_inode, name, S_ISDIR(mode) ? S_IFDIR : S_IFREG);
+    if (inode_number < 0)
+        return inode_number;
+
+    // nothing can unlink it before the reference is taken, the log is still held
+    return lookup_inode(inode_number, stbuf, flags & WFS_HOLD);
+}
+
+int wfs_unlink(struct wfs *fs, unsigned int dir_inode, const char *name)
+{
+    LOCK_LOG();
+
+    return unlink_name(dir_inode, name);
+}
+
+// An orphaned inode goes along with the last of its references
+void wfs_forget(struct wfs *fs, unsigned int inode_number, unsigned long count)
+{
+    int last;
+    {
+        LOCK_LOG_SHARED();
+        LOCK_INODE(inode_number);
+        struct inode_state *state = get_inode_state(inode_number);
+
+        if (state == NULL)
+            return;
+
+        // a reload after fsck.wfs starts counting from zero again
+        state->lookups = state->lookups > count ? state->lookups - count : 0;
+        last = state->lookups == 0 && state->orphan;
+    }
+
+    if (!last)
+        return;
+
+    // its entries become garbage, which takes the log to itself
+    LOCK_LOG();
+    struct inode_state *state = get_inode_state(inode_number);
+    if (state != NULL && state->orphan && state->lookups == 0)
+        remove_inode_entry(inode_number);
+}
+
+ssize_t wfs_pread(struct wfs *fs, unsigned int inode_number, void *buf, size_t size, off_t offset)
+{
+    LOCK_LOG_SHARED();
+
+    return read_file(inode_number, buf, size, offset, NULL);
+}
+
+ssize_t wfs_pwrite(struct wfs *fs, unsigned int inode_number, const void *buf, size_t size, off_t offset)
+{
+    struct fuse_bufvec bytes = FUSE_BUFVEC_INIT(size);
+    bytes.buf[0].mem = (void *)buf;
+
+    return write_file(inode_number, &bytes, offset);
+}
+
+ssize_t wfs_write_buf(struct wfs *fs, unsigned int inode_number, struct fuse_bufvec *bufv, off_t offset)
+{
+    return write_file(inode_number, bufv, offset);
+}
+
+// fill is called with the log lock held shared, it must not call back into the image
+int wfs_readdir(struct wfs *fs, unsigned int dir_inode, off_t offset, wfs_fill_dir_t fill, void *context)
+{
+    LOCK_LOG_SHARED();
+
+    // names only come and go with the log lock held exclusively
+    struct wfs_log_entry *dir_log_entry = get_inode_entry(dir_inode);
+
+    if(dir_log_entry == NULL)
+        return -ENOENT;
+    if (!S_ISDIR(dir_log_entry->inode.mode))
+        return -ENOTDIR;
+
+    touch_atime(dir_log_entry);
+
+    struct inode_state *dir = get_inode_state(dir_inode);
+
+    // the offset is the position of the next name, so a listing resumes where the last call stopped. Each
+    // name carries its inode number, the attributes come straight from the inode map without a path lookup
+    for (unsigned int i = offset / sizeof(struct wfs_dentry); i < dir->dentry_count; i++)
+    {
+        if (dir->dentries[i].dentry == 0)
+            continue;
+        struct wfs_dentry *curr_dentry = (struct wfs_dentry *)(base + dir->dentries[i].dentry);
+
+        struct stat stbuf;
+        memset(&stbuf, 0, sizeof(struct stat));
+        stbuf.st_ino = WFS_INO(curr_dentry->inode_number);
+        {
+            LOCK_INODE_SHARED(curr_dentry->inode_number);
+            struct wfs_log_entry *curr_log_entry = get_inode_entry(curr_dentry->inode_number);
+            if (curr_log_entry != NULL)
+                fill_stat(curr_log_entry, &stbuf);
+        }
+
+        if (fill(context, curr_dentry->name, &stbuf, (i + 1) * sizeof(struct wfs_dentry)) != 0)
+            break;
+    }
+
+    return 0;
+}
+
+int wfs_open(struct wfs *fs, unsigned int inode_number, int flags, struct wfs_file **file)
+{
+    LOCK_LOG_SHARED();
+
+    return open_inode(inode_number, flags, file);
+}
+
+// What close can't report on goes unreported, see wfs_flush
+void wfs_release(struct wfs *fs, struct wfs_file *file)
+{
+    if (file->snapshot == NULL)
+        flush_inode(file->inode_number);
+    close_file(file);
+}
+
+int wfs_flush(struct wfs *fs, unsigned int inode_number)
+{
+    return flush_inode(inode_number);
+}
+
+int wfs_fsync(struct wfs *fs, unsigned int inode_number)
+{
+    int result = flush_inode(inode_number);
+
+    if (result == 0 && durability == DURABILITY_FSYNC)
+        result = sync_log();
+    return result;
+}
+
+int wfs_sync(struct wfs *fs)
+{
+    flush_buffers(1);
+    return sync_log();
+}
+
+unsigned int wfs_file_inode(struct wfs_file *file)
+{
+    return file->inode_number;
+}
+
+int wfs_direct_io(struct wfs_file *file)
+{
+    return file->snapshot != NULL;
+}
+
+ssize_t wfs_read(struct wfs *fs, struct wfs_file *file, void *buf, size_t size, off_t offset)
+{
+    if (file->snapshot != NULL)
+    {
+        const char *bytes = read_snapshot(file, &size, offset);
+        memcpy(buf, bytes, size);
+        return size;
+    }
+
+    LOCK_LOG_SHARED();
+
+    return read_file(file->inode_number, buf, size, offset, file);
+}
+
+struct fuse_bufvec *wfs_map(struct wfs *fs, struct wfs_file *file, size_t size, off_t offset, int by_fd)
+{
+    // the buffers point into the log, which the cleaner can't move until wfs_unmap lets go of the lock
+    lock_log_shared();
+
+    struct fuse_bufvec *bufv;
+    if (file->snapshot != NULL)
+    {
+        bufv = malloc(sizeof(struct fuse_bufvec));
+        if (bufv == NULL)
+        {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+        const char *bytes = read_snapshot(file, &size, offset);
+        *bufv = FUSE_BUFVEC_INIT(size);
+        bufv->buf[0].mem = (char *)bytes;
+        bufv->count = size > 0;
+    }
+    else
+    {
+        bufv = map_file(file->inode_number, size, offset, by_fd, file);
+
+        // a backend with reads of its own copies the pieces out rather than have them faulted in
+        if (bufv != NULL && !by_fd && !backend->in_place && bufv->count > 0 && (bufv->count > 1 || in_image(bufv->buf[0].mem)))
+            bufv = flatten_buffers(bufv);
+    }
+
+    if (bufv == NULL)
+        pthread_rwlock_unlock(&log_lock);
+    return bufv;
+}
+
+void wfs_unmap(struct wfs *fs, struct fuse_bufvec *bufv)
+{
+    free(bufv);
+    pthread_rwlock_unlock(&log_lock);
+}
+
+int wfs_resolve(struct wfs *fs, const char *path, unsigned int *inode_number)
+{
+    if (strcmp(path, "/" STATS_NAME) == 0)
+    {
+        *inode_number = STATS_INODE;
+        return 0;
+    }
+
+    LOCK_LOG_SHARED();
+
+    int found = resolve_path(path);
+    if (found < 0)
+    {
+        LOG(LEVEL_DEBUG, "Log Entry Associated With Path Does Not Exist.\nPath: %s\n", path);
+        return -ENOENT;
+    }
+
+    *inode_number = found;
+    return 0;
+}
+
+int wfs_create_path(struct wfs *fs, const char *path, mode_t mode)
+{
+    LOCK_LOG();
+
+    // Verify file doesn't exist in its intended parent dir, answered from the dentry cache when possible
+    if (resolve_path(path) >= 0)
+    {
+        LOG(LEVEL_DEBUG, "Name Already In Use Locally.\nPath: %s\n", path);
+        return -EEXIST;
+    }
+
+    // Get parent directory inode
+    int parent_inode = resolve_parent(path);
+
+    if(parent_inode < 0) {
+        LOG(LEVEL_DEBUG, "Log Entry Associated With Path Does Not Exist.\nPath: %s\n", path);
+        return -ENOENT;
+    }
+
+    int inode_number = create_inode(parent_inode, strrchr(path, '/') + 1, S_ISDIR(mode) ? S_IFDIR : S_IFREG);
+    if (inode_number < 0)
+        return inode_number;
+
+    // replace any negative dentry cache entry for the new path
+    dcache_insert(path, inode_number);
+
+    return 0;
+}
+
+int wfs_unlink_path(struct wfs *fs, const char *path)
+{
+    LOCK_LOG();
+
+    // get parent inode
+    int parent_inode = resolve_parent(path);
+
+    if(parent_inode < 0) {
+        LOG(LEVEL_DEBUG, "Log Entry Associated With Path Does Not Exist.\nPath: %s\n", path);
+        return -ENOENT;
+    }
+
+    int result = unlink_name(parent_inode, strrchr(path, '/') + 1);
+
+    // the path is gone from the dentry cache as well
+    if (result == 0)
+        dcache_insert(path, WFS_NO_INODE);
+
+    return result;
+}
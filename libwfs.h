@@ -0,0 +1,184 @@
+#ifndef LIBWFS_H_
+#define LIBWFS_H_
+
+// libwfs: the log-structured filesystem behind mount.wfs, served in-process. mount.wfs adapts FUSE
+// requests to these calls; benchmarks and tools can make them directly without a kernel round trip.
+//
+// The engine keeps its state in globals, so one image is open at a time. Calls may come from any
+// number of threads once it is open. Only the wfs_ calls below are exported, the state and the
+// helpers behind them are private to libwfs.c.
+
+#ifndef FUSE_USE_VERSION
+#define FUSE_USE_VERSION 30
+#endif
+#include <fuse_common.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// An open image
+struct wfs;
+
+// An open file, from wfs_open to wfs_release
+struct wfs_file;
+
+// Inodes are known by number, the root directory is WFS_ROOT. struct stat reports them one higher in
+// st_ino, so none is 0 and the root is FUSE_ROOT_ID the way the kernel numbers nodes
+#define WFS_ROOT 0
+#define WFS_INO(inode_number) ((ino_t)(inode_number) + 1)
+#define WFS_INODE(ino) ((unsigned int)((ino) - 1))
+
+// Take a reference on the inode found or created, the way the kernel does for every node it is told
+// about. An unlinked inode stays readable until wfs_forget drops the last of its references
+#define WFS_HOLD 1
+
+// Called by wfs_readdir for every name in turn, with the offset to carry on from after it.
+// Returns nonzero to stop the listing there
+typedef int (*wfs_fill_dir_t)(void *context, const char *name, const struct stat *stbuf, off_t next_offset);
+
+// Open an image made by mkfs.wfs and load its inode map. Returns NULL with errno set if it can't be
+// opened, isn't a wfs image, or another image is open
+struct wfs *wfs_open_image(const char *disk_path);
+
+// Write out the access times and a checkpoint and close the image, stopping the background threads
+void wfs_close_image(struct wfs *fs);
+
+// Start and stop the background cleaner, and the logger thread if debug or trace messages are on.
+// Without the cleaner, writers clean in the foreground when they run out of room
+void wfs_start_background(struct wfs *fs);
+void wfs_stop_background(struct wfs *fs);
+
+// Calls taking an inode number return 0 or a negative errno unless said otherwise
+
+// Look a name up in a directory, filling in its attributes. flags is 0 or WFS_HOLD
+int wfs_lookup(struct wfs *fs, unsigned int dir_inode, const char *name, struct stat *stbuf, int flags);
+
+int wfs_getattr(struct wfs *fs, unsigned int inode_number, struct stat *stbuf);
+
+// Create a file, or a directory if mode says S_IFDIR, under a name in a directory and fill in its
+// attributes. flags is 0 or WFS_HOLD
+int wfs_create(struct wfs *fs, unsigned int dir_inode, const char *name, mode_t mode, struct stat *stbuf, int flags);
+
+int wfs_unlink(struct wfs *fs, unsigned int dir_inode, const char *name);
+
+// Drop count references taken with WFS_HOLD
+void wfs_forget(struct wfs *fs, unsigned int inode_number, unsigned long count);
+
+// Read and write a file by inode number. Return the number of bytes read or written, or a negative errno
+ssize_t wfs_pread(struct wfs *fs, unsigned int inode_number, void *buf, size_t size, off_t offset);
+ssize_t wfs_pwrite(struct wfs *fs, unsigned int inode_number, const void *buf, size_t size, off_t offset);
+
+// List a directory from offset, 0 or a next_offset handed to fill
+int wfs_readdir(struct wfs *fs, unsigned int dir_inode, off_t offset, wfs_fill_dir_t fill, void *context);
+
+// Open a file for reading or writing (O_RDONLY, O_WRONLY or O_RDWR in flags) into file. Reads through
+// it carry on from where the last one stopped without searching the file's extents again
+int wfs_open(struct wfs *fs, unsigned int inode_number, int flags, struct wfs_file **file);
+void wfs_release(struct wfs *fs, struct wfs_file *file);
+unsigned int wfs_file_inode(struct wfs_file *file);
+
+// Whether reads of a file should bypass the page cache, as the statistics file's have to
+int wfs_direct_io(struct wfs_file *file);
+
+ssize_t wfs_read(struct wfs *fs, struct wfs_file *file, void *buf, size_t size, off_t offset);
+
+// Path calls, for paths from the root like "/dir/file". Resolving goes through a dentry cache
+
+// Find the inode number of a path
+int wfs_resolve(struct wfs *fs, const char *path, unsigned int *inode_number);
+
+// Create a file or directory, see wfs_create, or unlink one by its path
+int wfs_create_path(struct wfs *fs, const char *path, mode_t mode);
+int wfs_unlink_path(struct wfs *fs, const char *path);
+
+// Buffer calls, for FUSE to move file bytes without copying them
+
+// Describe up to size bytes of a file from offset as buffers in place in the image, as its file
+// descriptor at each buffer's offset if by_fd -- or copied out of it into one buffer, with a storage
+// backend other than STORAGE_MMAP. The buffers stay valid until wfs_unmap, which has to come soon as it
+// holds off cleaning. Returns NULL if the file is gone
+struct fuse_bufvec *wfs_map(struct wfs *fs, struct wfs_file *file, size_t size, off_t offset, int by_fd);
+void wfs_unmap(struct wfs *fs, struct fuse_bufvec *bufv);
+
+// Write the bytes of a buffer vector, see wfs_pwrite
+ssize_t wfs_write_buf(struct wfs *fs, unsigned int inode_number, struct fuse_bufvec *bufv, off_t offset);
+
+// Small writes to a file gather in memory and reach the log as one entry when it is flushed, released,
+// or the image closed, or after a second. Reads and attributes see them all along. Returns 0 or a
+// negative errno, -ENOSPC if there is no room for them in the log
+int wfs_flush(struct wfs *fs, unsigned int inode_number);
+
+// Flush a file and, with DURABILITY_FSYNC, write the log through to the disk before returning
+int wfs_fsync(struct wfs *fs, unsigned int inode_number);
+
+// Flush every file and write the log through to the disk now, whatever the durability mode
+int wfs_sync(struct wfs *fs);
+
+// Settings, taken from mount options before the image is opened. The names are those of the mount
+// options, NULL for a value past the last one
+
+// How accesses update access times: strictatime (the default), relatime or noatime.
+// Either way they are only kept in memory until the inode's next entry or the image is closed
+#define ATIME_STRICT 0
+#define ATIME_RELATIVE 1
+#define ATIME_NONE 2
+void wfs_set_atime_mode(int mode);
+
+// How writes reach the disk: DURABILITY_NONE leaves it to the kernel's writeback, DURABILITY_PERIODIC
+// flushes and syncs every sync interval (1000 milliseconds by default) in the background, DURABILITY_FSYNC syncs before
+// wfs_fsync returns -- fsyncs coming in together share one sync of the log written since the last
+#define DURABILITY_NONE 0
+#define DURABILITY_PERIODIC 1
+#define DURABILITY_FSYNC 2
+void wfs_set_durability(int mode);
+void wfs_set_sync_interval(unsigned int milliseconds);
+const char *wfs_durability_name(int mode);
+
+// How file bytes are read out of the image and the log written to the disk, entries are built and read
+// in place in a mapping of it either way. STORAGE_MMAP copies out of the mapping and leaves writing to
+// the kernel and msync. STORAGE_URING reads and syncs through an io_uring of each thread, a batch of
+// requests in flight at once, and starts writing every segment out as soon as the head moves past it.
+// An image is opened with STORAGE_MMAP if the kernel has no io_uring
+#define STORAGE_MMAP 0
+#define STORAGE_URING 1
+void wfs_set_storage(int backend);
+const char *wfs_storage_name(int backend);
+
+// Log levels. Messages above WFS_LOG_LEVEL are compiled out (build with -DWFS_LOG_LEVEL=LEVEL_INFO to
+// leave out the tracing), those above wfs_log_level() are skipped
+#define LEVEL_ERROR 0
+#define LEVEL_WARN 1
+#define LEVEL_INFO 2
+#define LEVEL_DEBUG 3       // why a request failed
+#define LEVEL_TRACE 4       // every request and the steps taken for it
+#ifndef WFS_LOG_LEVEL
+#define WFS_LOG_LEVEL LEVEL_TRACE
+#endif
+void wfs_set_log_level(int level);
+int wfs_log_level();
+const char *wfs_level_name(int level);
+
+#define LOG(level, ...) do { if ((level) <= WFS_LOG_LEVEL && (level) <= wfs_log_level()) wfs_log_message(__VA_ARGS__); } while (0)
+
+void wfs_log_message(const char *format, ...);
+
+// Operations the statistics file reports on, timed by whoever serves them
+#define OP_LOOKUP 0
+#define OP_GETATTR 1
+#define OP_MKNOD 2
+#define OP_MKDIR 3
+#define OP_CREATE 4
+#define OP_OPEN 5
+#define OP_READ 6
+#define OP_WRITE 7
+#define OP_READDIR 8
+#define OP_UNLINK 9
+#define OP_FSYNC 10
+#define OP_COUNT 11
+
+// Current time in nanoseconds for timing operations
+unsigned long wfs_stats_clock();
+
+// Count an operation that started at start (from wfs_stats_clock) and ended with result, negative on an error
+void wfs_count_op(int op, unsigned long start, int result);
+
+#endif
@@ -31,11 +31,17 @@ int main(int argc, char** argv) {
     return FAIL;
   }
 
-  if (sb.head != sizeof(sb) + sizeof(struct wfs_log_entry)) {
-    printf("Wrong head (0x%x)\n", sb.head);
+  if (sb.head != sizeof(sb) + sizeof(struct wfs_segment) + sizeof(struct wfs_log_entry)) {
+    printf("Wrong head (0x%llx)\n", (unsigned long long)sb.head);
     return FAIL;
   }
 
+  struct wfs_segment segment;
+  if (read(fd, &segment, sizeof(segment)) != sizeof(segment)) {
+    perror("read");
+    return INTERNAL_ERR;
+  }
+
   struct wfs_log_entry root;
   if (read(fd, &root, sizeof(root)) != sizeof(root)) {
     perror("read");
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include "common/test.h"
+
+#define FILE_COUNT 16
+#define FILE_SIZE (32 * 1024)
+#define TAIL_COUNT 8
+
+// Write a file through the mount and fsync it, so it is in the image whatever happens to mount.wfs
+int write_file(const char* path, char fill, int size) {
+  char buffer[FILE_SIZE];
+  memset(buffer, fill, size);
+
+  int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror(path);
+    return FAIL;
+  }
+  if (write(fd, buffer, size) != size || fsync(fd) != 0) {
+    perror(path);
+    close(fd);
+    return FAIL;
+  }
+  close(fd);
+  return PASS;
+}
+
+int check_file(const char* path, char fill, int size) {
+  char buffer[FILE_SIZE + 1];
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("%s is missing after the remount\n", path);
+    return FAIL;
+  }
+  int bytes_read = read(fd, buffer, sizeof(buffer));
+  close(fd);
+  if (bytes_read != size) {
+    printf("%s has %d bytes after the remount, %d expected\n", path, bytes_read, size);
+    return FAIL;
+  }
+  for (int i = 0; i < size; i++) {
+    if (buffer[i] != fill) {
+      printf("%s has different content after the remount\n", path);
+      return FAIL;
+    }
+  }
+  return PASS;
+}
+
+int main() {
+  char path[64];
+
+  // enough data for at least one checkpoint
+  for (int i = 0; i < FILE_COUNT; i++) {
+    snprintf(path, sizeof(path), "mnt/checkpointed%d", i);
+    if (write_file(path, 'a' + i, FILE_SIZE) != PASS) return FAIL;
+  }
+
+  int fd = open("disk", O_RDONLY);
+  struct wfs_sb sb;
+  if (fd < 0 || read(fd, &sb, sizeof(sb)) != sizeof(sb)) {
+    perror("disk");
+    return INTERNAL_ERR;
+  }
+  close(fd);
+  if (sb.checkpoint[0] == 0 && sb.checkpoint[1] == 0) {
+    printf("No checkpoint after writing %d bytes\n", FILE_COUNT * FILE_SIZE);
+    return FAIL;
+  }
+
+  // a tail too small to be checkpointed: new names in a new directory, an overwrite and an unlink
+  if (mkdir("mnt/tail", 0755) != 0) {
+    perror("mkdir");
+    return FAIL;
+  }
+  for (int i = 0; i < TAIL_COUNT; i++) {
+    snprintf(path, sizeof(path), "mnt/tail/file%d", i);
+    if (write_file(path, 'A' + i, 100 + i) != PASS) return FAIL;
+  }
+  if (write_file("mnt/checkpointed0", 'z', 1000) != PASS) return FAIL;
+  if (unlink("mnt/checkpointed1") != 0) {
+    perror("unlink");
+    return FAIL;
+  }
+
+  // crash: nothing gets a chance to checkpoint or unmount cleanly
+  if (system("pkill -KILL -x mount.wfs") != 0) {
+    printf("Failed to kill mount.wfs\n");
+    return INTERNAL_ERR;
+  }
+  sleep(1);
+  if (system("fusermount -u mnt") != 0) {
+    printf("Failed to unmount the dead mount\n");
+    return INTERNAL_ERR;
+  }
+  if (system("./mount.wfs -s disk mnt") != 0) {
+    printf("Failed to mount the image again\n");
+    return FAIL;
+  }
+
+  // the tail is rolled forward on top of the checkpoint
+  for (int i = 2; i < FILE_COUNT; i++) {
+    snprintf(path, sizeof(path), "mnt/checkpointed%d", i);
+    if (check_file(path, 'a' + i, FILE_SIZE) != PASS) return FAIL;
+  }
+  for (int i = 0; i < TAIL_COUNT; i++) {
+    snprintf(path, sizeof(path), "mnt/tail/file%d", i);
+    if (check_file(path, 'A' + i, 100 + i) != PASS) return FAIL;
+  }
+  if (check_file("mnt/checkpointed0", 'z', 1000) != PASS) return FAIL;
+  struct stat st;
+  if (stat("mnt/checkpointed1", &st) == 0) {
+    printf("Unlinked file is back after the remount\n");
+    return FAIL;
+  }
+
+  unsigned long replayed = 0;
+  char line[256];
+  FILE* stats = fopen("mnt/.wfs_stats", "r");
+  if (stats == NULL) {
+    perror("mnt/.wfs_stats");
+    return FAIL;
+  }
+  while (fgets(line, sizeof(line), stats) != NULL)
+    if (sscanf(line, "replayed_entries %lu", &replayed) == 1) break;
+  fclose(stats);
+  if (replayed == 0) {
+    printf("Nothing was replayed past the checkpoint\n");
+    return FAIL;
+  }
+
+  return PASS;
+}
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "common/test.h"
+
+#define FILE_COUNT 16
+#define BLOCK_SIZE 4096
+#define ROUNDS 3
+
+// Write blocks to the files in turn until the disk is full, returns the bytes written or -1
+long fill_disk() {
+  char buffer[BLOCK_SIZE];
+  char path[64];
+  int fds[FILE_COUNT];
+  long written = 0;
+  int full = 0;
+
+  memset(buffer, 'f', sizeof(buffer));
+  for (int i = 0; i < FILE_COUNT; i++) {
+    snprintf(path, sizeof(path), "mnt/fill%d", i);
+    fds[i] = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fds[i] < 0) {
+      perror(path);
+      return -1;
+    }
+  }
+
+  while (!full) {
+    for (int i = 0; i < FILE_COUNT && !full; i++) {
+      // fsync so a write held back in memory can't hide the disk being full
+      if (write(fds[i], buffer, sizeof(buffer)) != sizeof(buffer) || fsync(fds[i]) != 0) {
+        if (errno != ENOSPC) {
+          perror("write");
+          return -1;
+        }
+        full = 1;
+      } else {
+        written += sizeof(buffer);
+      }
+    }
+  }
+
+  for (int i = 0; i < FILE_COUNT; i++) close(fds[i]);
+  return written;
+}
+
+int main() {
+  char path[64];
+  long first = 0;
+
+  for (int round = 0; round < ROUNDS; round++) {
+    long written = fill_disk();
+    if (written < 0) return FAIL;
+    if (round == 0) first = written;
+
+    // what the files deleted in the last round took has to be reusable
+    if (written < first / 2) {
+      printf("Only %ld bytes fit after deleting, %ld did at first\n", written, first);
+      return FAIL;
+    }
+    // deleting has to work on a full disk
+    for (int i = 0; i < FILE_COUNT; i++) {
+      snprintf(path, sizeof(path), "mnt/fill%d", i);
+      if (unlink(path) != 0) {
+        printf("Unlink of %s failed on a full disk with errno %d\n", path, errno);
+        return FAIL;
+      }
+    }
+  }
+
+  return PASS;
+}
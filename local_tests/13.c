@@ -0,0 +1,45 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "common/test.h"
+
+#define DEPTH 10
+
+int main() {
+  char path[512] = "mnt";
+  char name[32];
+
+  // every level adds 21 bytes, so the deeper paths are well past 128
+  for (int i = 0; i < DEPTH; i++) {
+    snprintf(name, sizeof(name), "/longdirectoryname%03d", i);
+    strcat(path, name);
+    if (mkdir(path, S_IRWXU) != 0) {
+      printf("Unable to create %zu byte directory path: ", strlen(path));
+      perror(path);
+      return FAIL;
+    }
+  }
+
+  strcat(path, "/file");
+  int fd = open(path, O_CREAT | O_WRONLY, 0644);
+  if (fd < 0 || write(fd, "long", 4) != 4) {
+    perror(path);
+    return FAIL;
+  }
+  close(fd);
+
+  struct stat st;
+  if (stat(path, &st) != 0 || st.st_size != 4) {
+    printf("File at the end of a %zu byte path can't be found\n", strlen(path));
+    return FAIL;
+  }
+  if (unlink(path) != 0 || stat(path, &st) == 0) {
+    printf("File at the end of a %zu byte path can't be unlinked\n", strlen(path));
+    return FAIL;
+  }
+
+  return PASS;
+}
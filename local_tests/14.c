@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include "common/test.h"
+
+#define FILE_COUNT 5
+
+int main() {
+  char path[64];
+
+  for (int i = 0; i < FILE_COUNT; i++) {
+    snprintf(path, sizeof(path), "mnt/old%d", i);
+    int fd = open(path, O_CREAT | O_WRONLY, 0644);
+    if (fd < 0 || write(fd, "old", 3) != 3) {
+      perror(path);
+      return FAIL;
+    }
+    close(fd);
+  }
+
+  // format the used image again
+  sleep(1);
+  if (system("fusermount -u mnt") != 0) {
+    printf("Failed to unmount the image\n");
+    return INTERNAL_ERR;
+  }
+  if (system("./mkfs.wfs disk > /dev/null") != 0) {
+    printf("mkfs.wfs failed on a used image\n");
+    return FAIL;
+  }
+  if (system("./mount.wfs -s disk mnt") != 0) {
+    printf("Failed to mount the image again\n");
+    return FAIL;
+  }
+
+  // nothing of the old filesystem may come back
+  DIR* dir = opendir("mnt");
+  if (dir == NULL) {
+    perror("mnt");
+    return FAIL;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+      printf("%s is back after formatting the image again\n", entry->d_name);
+      closedir(dir);
+      return FAIL;
+    }
+  }
+  closedir(dir);
+
+  int fd = open("mnt/old0", O_CREAT | O_EXCL | O_WRONLY, 0644);
+  if (fd < 0) {
+    perror("mnt/old0");
+    return FAIL;
+  }
+  close(fd);
+
+  return PASS;
+}
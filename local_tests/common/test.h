@@ -7,7 +7,19 @@
 #define WFS_MAGIC 0xdeadbeef
 struct wfs_sb {
   uint32_t magic;
-  uint32_t head;
+  uint32_t legacy_head;
+  uint32_t version;
+  uint32_t generation;
+  uint64_t head;
+  uint64_t disk_size;
+  uint64_t checkpoint[2];
+  uint32_t segment_size;
+  uint32_t segment_count;
+};
+struct wfs_segment {
+  uint32_t magic;
+  uint32_t sequence;
+  uint32_t created;
 };
 struct wfs_inode {
   unsigned int inode_number;
@@ -22,7 +22,10 @@ MOUNT_POINT = os.path.abspath('mnt')
 readonly_tests = [0]
 
 # tests on new image
-new_image_tests = list(range(2, 10))
+new_image_tests = list(range(2, 10)) + [13]
+
+# tests on a new image of their own, and its size: crash and remount, delete from a full disk, format again
+own_image_tests = [(11, 4*1024*1024), (12, 1024*1024), (14, 1024*1024)]
 
 
 passed_tests, total_tests = 0, 0
@@ -142,6 +145,18 @@ def main():
     time.sleep(1)
     umount()
 
+    # Tests that take a new image of their own
+    for test_num, image_size in own_image_tests:
+        create_image(image_size)
+        run_command(f'./mkfs.wfs {NEW_DISK_PATH}', './mkfs.wfs returned non-zero exit code')
+        run_command(f'./mount.wfs -s {NEW_DISK_PATH} {MOUNT_POINT}', './mount.wfs returned non-zero exit code')
+        if not is_mounted():
+            print('Failed to mount the empty file system')
+            return
+        run_tests([test_num])
+        time.sleep(1)
+        umount()
+
     if 'fsck.wfs.c' in os.listdir():
         create_image(1024)
         run_command(f'./mkfs.wfs {NEW_DISK_PATH}', './mkfs.wfs returned non-zero exit code')
@@ -9,18 +9,41 @@
 #include <time.h>
 #include "wfs.h"
 
-int total_size = 0;
+size_t total_size = 0;
 
-void initialize_filesystem(const char *disk_path) {
+// Parse a size like 4096, 64K, 100M or 10G, returns 0 if it isn't one
+size_t parse_size(const char *text) {
+    char *end;
+    unsigned long long size = strtoull(text, &end, 10);
+
+    switch (*end) {
+    case 'T': case 't': size *= 1024;   // fall through
+    case 'G': case 'g': size *= 1024;   // fall through
+    case 'M': case 'm': size *= 1024;   // fall through
+    case 'K': case 'k': size *= 1024; end++; break;
+    }
+
+    return *end == '\0' ? size : 0;
+}
+
+// disk_size is the size to make the image, 0 to use the file as it is. segment_size 0 picks one
+void initialize_filesystem(const char *disk_path, size_t disk_size, size_t segment_size) {
     int fd;
 
-    // Open file descriptor for file to init system with
-    fd = open(disk_path, O_RDWR, 0666);
+    // Open file descriptor for file to init system with, creating it if a size was given
+    fd = open(disk_path, O_RDWR | (disk_size > 0 ? O_CREAT : 0), 0666);
     if (fd == -1) {
         perror("Error opening file");
         exit(EXIT_FAILURE);
     }
 
+    // Sparse, so even a large image only takes the space the log uses
+    if (disk_size > 0 && ftruncate(fd, disk_size) == -1) {
+        perror("ftruncate");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+
     // Get file info (for file size)
     struct stat file_stat;
     if (fstat(fd, &file_stat) == -1) {
@@ -28,6 +51,11 @@ void initialize_filesystem(const char *disk_path) {
         close(fd);
         exit(EXIT_FAILURE);
     }
+    if (file_stat.st_size <= sizeof(struct wfs_sb)) {
+        fprintf(stderr, "%s is too small for a filesystem\n", disk_path);
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
 
     // Memory map file
     char* base = mmap(NULL, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
@@ -43,7 +71,45 @@ void initialize_filesystem(const char *disk_path) {
     struct wfs_sb* superblock = (struct wfs_sb*)base;
 
     superblock->magic = WFS_MAGIC;
+    superblock->legacy_head = 0;
     superblock->head = sizeof(struct wfs_sb);
+    superblock->version = WFS_VERSION;
+    superblock->disk_size = file_stat.st_size;
+    superblock->checkpoint[0] = 0;
+    superblock->checkpoint[1] = 0;
+    superblock->generation = 0;
+
+    // split the space after the superblock into segments, a small image gets a single one and a
+    // large one larger segments, so the segment table mount keeps in memory stays small
+    size_t log_size = file_stat.st_size - sizeof(struct wfs_sb);
+    if (segment_size == 0) {
+        segment_size = WFS_SEGMENT_SIZE;
+        while (log_size / segment_size > WFS_MAX_SEGMENTS)
+            segment_size *= 2;
+    }
+    if (segment_size > log_size)
+        segment_size = log_size;
+    if (segment_size < sizeof(struct wfs_segment) + sizeof(struct wfs_log_entry) || segment_size > UINT32_MAX) {
+        fprintf(stderr, "Segment size %zu does not fit a %zu byte image\n", segment_size, (size_t)file_stat.st_size);
+        exit(EXIT_FAILURE);
+    }
+    superblock->segment_size = segment_size;
+    superblock->segment_count = log_size / segment_size;
+
+    // segments left over from an earlier filesystem on the image would read as part of the log. Only
+    // the ones that have a header are written, the others may be holes of a sparse image
+    for (size_t i = 1; i < superblock->segment_count; i++) {
+        struct wfs_segment* stale = (struct wfs_segment*)(base + sizeof(struct wfs_sb) + i * segment_size);
+        if (stale->magic == WFS_SEGMENT_MAGIC)
+            stale->magic = 0;
+    }
+
+    // the log starts in the first segment
+    struct wfs_segment* segment = (struct wfs_segment*)(base + sizeof(struct wfs_sb));
+    segment->magic = WFS_SEGMENT_MAGIC;
+    segment->sequence = 1;
+    segment->created = time(NULL);
+    superblock->head += sizeof(struct wfs_segment);
 
     // printf("%p %p\n", base, superblock->head);
  
@@ -55,7 +121,7 @@ void initialize_filesystem(const char *disk_path) {
     root_inode.mode = S_IFDIR;        // Set to S_IFDIR for a directory
     root_inode.uid = getuid();        // Set to the user id of the process
     root_inode.gid = getgid();        // Set to the group id of the process
-    root_inode.flags = 0;             // You can set flags based on your requirements
+    root_inode.flags = WFS_ENTRY_INODE;   // Regular inode log entry (not a checkpoint)
     root_inode.size = sizeof(struct wfs_inode);           // Set to an appropriate size for a directory (e.g., 4 KB)
     root_inode.atime = time(NULL);    // Set to the current time
     root_inode.mtime = time(NULL);    // Set to the current time
@@ -71,7 +137,13 @@ void initialize_filesystem(const char *disk_path) {
     // Update the head to be after the added root log entry
     superblock->head += root_log_entry->inode.size;
     // update total size
-    total_size += root_log_entry->inode.size + sizeof(struct wfs_sb);
+    total_size += root_log_entry->inode.size + sizeof(struct wfs_sb) + sizeof(struct wfs_segment);
+
+    // the log ends right after the root entry, even if an earlier filesystem left entries there. Clearing
+    // the next entry header, or what fits of it in the segment, is enough to stop a replay
+    char* log_end = base + superblock->head;
+    char* segment_end = base + sizeof(struct wfs_sb) + segment_size;
+    memset(log_end, 0, log_end + sizeof(struct wfs_log_entry) < segment_end ? sizeof(struct wfs_log_entry) : (size_t)(segment_end - log_end));
 
     // printf("%p %p\n", base, superblock->head);
  
@@ -83,13 +155,39 @@ void initialize_filesystem(const char *disk_path) {
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <disk_path>\n", argv[0]);
+    size_t disk_size = 0;
+    size_t segment_size = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:S:")) != -1) {
+        switch (opt) {
+        case 's':
+            disk_size = parse_size(optarg);
+            if (disk_size <= sizeof(struct wfs_sb)) {
+                fprintf(stderr, "Invalid image size %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'S':
+            segment_size = parse_size(optarg);
+            if (segment_size == 0) {
+                fprintf(stderr, "Invalid segment size %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            optind = argc;
+            break;
+        }
+    }
+
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-s image_size] [-S segment_size] <disk_path>\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    const char *disk_path = argv[1];
-    initialize_filesystem(disk_path);
+    const char *disk_path = argv[optind];
+    initialize_filesystem(disk_path, disk_size, segment_size);
     
     return 0;
 }
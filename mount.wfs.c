@@ -1,241 +1,89 @@
 #define FUSE_USE_VERSION 30
+#define _GNU_SOURCE
 #include <fuse.h>
+#include <fuse_lowlevel.h>
+#include <fuse_opt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
-#include <unistd.h>
-
-#include <fcntl.h>
-#include <dirent.h>
-
+#include <stdint.h>
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/mman.h>
-#include <time.h>
-#include "wfs.h"
+#include "libwfs.h"
 
-int inode_count = 0;
-int total_size;
+// mount.wfs serves an image through FUSE, adapting requests to the in-process calls of libwfs
 
 char *disk_path;
 char *mount_point;
 
-char *head;
-char *base;
-struct wfs_sb *superblock;
+// The image being served
+struct wfs *image;
 
-// Remove the top-most (left most) extension of a path
-char *snip_top_level(const char *path)
-{
-    if (path == NULL || strlen(path) == 0)
-    {
-        // Handle invalid input
-        return NULL;
-    }
+// Reads reply with the image's pages spliced straight into the FUSE device when the kernel allows
+int splice_reads;
 
-    // Find the first occurrence of '/'
-    const char *first_slash = strchr(path, '/');
-    if (first_slash == NULL)
-    {
-        // No top-level part found, return an empty string or a copy of the input path
-        return strdup("");
-    }
+// The open file behind fi, as set up by wfs_open
+#define FILE_OF(fi) ((struct wfs_file *)(uintptr_t)(fi)->fh)
 
-    // Find the second occurrence of '/' starting from the position after the first slash
-    const char *second_slash = strchr(first_slash + 1, '/');
-    if (second_slash == NULL)
-    {
-        // No second slash found, return an empty string or a copy of the input path
-        return strdup("");
-    }
-
-    // Calculate the length of the remaining path
-    size_t remaining_length = strlen(second_slash);
-
-    // Allocate memory for the remaining path
-    char *remaining_path = (char *)malloc((remaining_length + 1) * sizeof(char));
-    if (remaining_path == NULL)
-    {
-        // Memory allocation failed
-        perror("Memory allocation error");
-        exit(EXIT_FAILURE);
-    }
-
-    // Copy the remaining path into the new string
-    strcpy(remaining_path, second_slash);
-
-    return remaining_path;
+// Keep an open file in fi for the kernel, and bypass the page cache if its reads have to
+void set_open_file(struct fuse_file_info *fi, struct wfs_file *file)
+{
+    fi->fh = (uintptr_t)file;
+    fi->direct_io = wfs_direct_io(file);
 }
 
-// Remove the bottom-most (right most) extension of a path
-char *snip_bottom_level(const char *path)
+// Let go of the file behind fi, the kernel no longer has it open
+void close_open_file(struct fuse_file_info *fi)
 {
-   if (path == NULL || mount_point == NULL || strlen(path) == 0 || strlen(mount_point) == 0)
-    {
-        // Handle invalid input
-        return NULL;
-    }
-
-    // Find the last dot (.) in the path, representing the start of the extension
-    const char* last_slash = strrchr(path, '/');
-
-    // Calculate the length of the remaining path without the extension
-    size_t remaining_length = last_slash - path;
-
-    // Allocate memory for the remaining path
-    char* remaining_path = malloc(remaining_length + 1);
-
-    // Copy the remaining path to the result string
-    strncpy(remaining_path, path, remaining_length);
-
-    // Null-terminate the result string
-    remaining_path[remaining_length] = '\0';
-
-    return remaining_path;
+    wfs_release(image, FILE_OF(fi));
+    fi->fh = 0;
 }
 
-// Same as snip_bottom_level, just returns the final part of the path instead of the path itself
-// Get bottom-level (right most) extention of a path
-char *get_bottom_level(const char *path)
+// Start the background cleaner and logger once FUSE is up, after it forked into the background
+static void *wfs_init(struct fuse_conn_info *conn)
 {
-    if (path == NULL || strlen(path) == 0)
-    {
-        // Handle invalid input
-        return NULL;
-    }
-
-    // Find the last occurrence of '/'
-    const char *last_slash = strrchr(path, '/');
-
-    // Move the pointer after the last slash
-    last_slash += 1;
-
-    // Calculate the length of the filename
-    size_t last_part_length = strlen(last_slash);
-
-    // Allocate memory for the filename
-    char *last_part = (char *)malloc((last_part_length + 1) * sizeof(char));
-    if (last_part == NULL)
-    {
-        // Memory allocation failed
-        perror("Memory allocation error");
-        exit(EXIT_FAILURE);
-    }
-
-    // Copy the filename into the new string
-    strcpy(last_part, last_slash);
+    wfs_start_background(image);
 
-    return last_part;
+    return NULL;
 }
 
-// Get the log entry of the bottom-level (right most) extension of a path recursively
-struct wfs_log_entry *get_log_entry(const char *path, int inode_number)
+// Stop the background cleaner and logger before unmounting
+static void wfs_destroy(void *private_data)
 {
-    char *curr = base;
+    wfs_stop_background(image);
+}
 
-    // iterate past the superblock
-    curr += sizeof(struct wfs_sb);
+////// HIGH-LEVEL (PATH) API ///////
 
-    printf("141\n");
-    while (curr != head)
-    {
-        printf("144\n");
-        struct wfs_log_entry *curr_log_entry = (struct wfs_log_entry *)curr;
-        printf("146\n");
-        // if the thing is not deleted
-        if (curr_log_entry->inode.deleted != 1)
-        {
-            printf("150\n");
-            // we found the log entry of the inode we need
-            if (curr_log_entry->inode.inode_number == inode_number)
-            {
-                printf("154\n");
-                // base case -- either "" or "/"
-                if (path == NULL || strlen(path) == 1 || strlen(path) == 0)
-                {
-                    printf("158\n");
-                    return curr_log_entry;
-                }
-                else
-                {
-                    printf("163\n");
-                    char path_copy[100];
-                    strcpy(path_copy, path);
-
-                    // Use strtok to get the first token
-                    char *ancestor = strtok(path_copy, "/");
-
-                    char *data_addr = curr_log_entry->data;
-
-                    printf("172\n");
-                    // iterate over all dentries
-                    while (data_addr != (char *)(curr_log_entry) + curr_log_entry->inode.size)
-                    {
-                        printf("176\n");
-                        printf("curr_log_entry (%p) :: crl+size (%p) :: data_addr (%p) :: base (%p) :: head (%p)\n", (char *) curr_log_entry,(char *)(curr_log_entry) + curr_log_entry->inode.size, data_addr, base, head);
-                        printf("curr_log_entry->inode_number: %d\n", curr_log_entry->inode.inode_number);
-                        printf("curr_log_entry->deleted: %d\n", curr_log_entry->inode.deleted);
-                        printf("curr_log_entry->mode: %d\n", curr_log_entry->inode.mode);
-                        printf("curr_log_entry->uid: %d\n", curr_log_entry->inode.uid);
-                        printf("curr_log_entry->gid: %d\n", curr_log_entry->inode.gid);
-                        printf("curr_log_entry->flags: %d\n", curr_log_entry->inode.flags);
-                        printf("curr_log_entry->size: %d\n", curr_log_entry->inode.size);
-                        printf("curr_log_entry->atime: %d\n", curr_log_entry->inode.atime);
-                        printf("curr_log_entry->mtime: %d\n", curr_log_entry->inode.mtime);
-                        printf("curr_log_entry->ctime: %d\n", curr_log_entry->inode.ctime);
-                        printf("curr_log_entry->links: %d\n", curr_log_entry->inode.links);
-                        if (strcmp(((struct wfs_dentry *)data_addr)->name, ancestor) == 0)
-                        {
-                            printf("179\n");
-                            return get_log_entry(snip_top_level(path), ((struct wfs_dentry *)data_addr)->inode_number);
-                        }
-                        printf("182\n");
-                        data_addr += sizeof(struct wfs_dentry);
-                        // TODO REMOVE
-                        // break;
-                    }
-                }
-            }
-        }
-        printf("189\n");
-        // we design the inode's size to be updated with size of data member of log entry struct
-        curr += curr_log_entry->inode.size;
-        // TODO REMOVE
-        // break;
-    }
-    printf("193\n");
-    return NULL;
-}
+// Mounts are served through the low-level API below; build with -DWFS_PATH_API to serve them
+// through fuse_main and these path-based handlers instead
+#ifdef WFS_PATH_API
 
 // Remove any pre-mount portion (including the mount point) of a path
 char *remove_pre_mount(const char *path)
 {
-    printf(">>remove pre mount: %s\n", path);
+    LOG(LEVEL_TRACE, ">>remove pre mount: %s\n", path);
     if (path == NULL || mount_point == NULL || strlen(path) == 0 || strlen(mount_point) == 0)
     {
         // Handle invalid input
         return NULL;
     }
 
-    printf("rmmount>>207\n");
     if(strncmp(path, "/", strlen(path)) == 0) {
         return strdup(path);
     }
 
-    printf("rmmount>>212\n");
     // Find the mount point in the path
     const char *mount_point_pos = strstr(path, mount_point);
     if (mount_point_pos == NULL)
     {
-        printf("rmmount>>217\n");
         // Mount point not found, move mount point back to start of path and continue
         return strdup(path);
         // mount_point_pos = path;
     }
 
-    printf("rmmount>>222\n");
     // Move the pointer after the mount point
     mount_point_pos += strlen(mount_point);
 
@@ -243,7 +91,6 @@ char *remove_pre_mount(const char *path)
     // size_t remaining_length = last_slash - mount_point_pos;
     size_t remaining_length = path+strlen(path) - mount_point_pos;
 
-    printf("rmmount>>231");
     // Allocate memory for the remaining path
     char *remaining_path = (char *)malloc((remaining_length + 1) * sizeof(char));
     if (remaining_path == NULL)
@@ -253,12 +100,10 @@ char *remove_pre_mount(const char *path)
         exit(EXIT_FAILURE);
     }
 
-    printf("rmmount>>241\n");
     // Copy the remaining path into the new string
     strncpy(remaining_path, mount_point_pos, remaining_length);
     remaining_path[remaining_length] = '\0';
 
-    printf("rmmount>>246\n");
     return remaining_path;
 }
 
@@ -266,7 +111,7 @@ char *remove_pre_mount(const char *path)
 // TODO length check as well against macro
 int valid_name(const char *entry_name)
 {
-    printf(">>valid_name: %s\n", entry_name);
+    LOG(LEVEL_TRACE, ">>valid_name: %s\n", entry_name);
 
     // Find the last dot in the filename
     const char *last_dot = NULL;
@@ -294,639 +139,742 @@ int valid_name(const char *entry_name)
     return 1;
 }
 
-// Check if file/subdir can be created -- validate name and (local) uniqueness
-int can_create(const char *path)
+
+// Function to get attributes of a file or directory
+static int wfs_path_getattr(const char *path, struct stat *stbuf)
 {
-    printf(">>can create: %s\n", path);
-    char *last_part = get_bottom_level(path);
+    LOG(LEVEL_TRACE, ">>getattr: %s\n", path);
+    // clean path (remove pre mount + mount)
+    path = remove_pre_mount(path);
 
-    // Check if filename is unique in directory
-    struct wfs_log_entry *parent = get_log_entry(snip_bottom_level(path), 0);
+    unsigned int inode_number;
+    int result = wfs_resolve(image, path, &inode_number);
+    if (result < 0)
+        return result;
 
-    if(parent == NULL) {
-        printf("Log Entry Associated With Path Does Not Exist.\nPath: %s\n", path);
-        return -ENOENT;
-    }
+    return wfs_getattr(image, inode_number, stbuf);
+}
 
-    char *data_addr = parent->data;
+// Function to create a regular file
+static int wfs_path_mknod(const char *path, mode_t mode, dev_t rdev)
+{
+    LOG(LEVEL_TRACE, ">>mknod: %s\n", path);
+    path = remove_pre_mount(path);
 
-    // iterate over all dentry's of parent
-    while (data_addr != (char *)(parent) + parent->inode.size)
+    // Verify filename
+    if (!valid_name(strrchr(path, '/') + 1))
     {
-        // check if current dentry matches desired filename
-        if (strcmp(((struct wfs_dentry *)data_addr)->name, last_part) == 0)
-            return 0;
-        data_addr += sizeof(struct wfs_dentry);
+        LOG(LEVEL_DEBUG, "Invalid File Name\n");
+        return 0;
     }
 
-    // file/subdir name is valid for its targeted parent directory
-    return 1;
+    return wfs_create_path(image, path, S_IFREG);
 }
 
-////// BELOW IS FOR FUSE ///////
-
-// Function to get attributes of a file or directory
-static int wfs_getattr(const char *path, struct stat *stbuf)
+// Function to create a directory
+static int wfs_path_mkdir(const char *path, mode_t mode)
 {
-    printf(">>getattr: %s\n", path);
-    // clean path (remove pre mount + mount)
+    LOG(LEVEL_TRACE, ">>mkdir: %s\n", path);
     path = remove_pre_mount(path);
 
-    struct wfs_log_entry *log_entry = get_log_entry(path, 0);
-
-    if(log_entry == NULL) {
-        printf("Log Entry Associated With Path Does Not Exist.\nPath: %s\n", path);
-        return -ENOENT;
+    // Verify dir name
+    if (!valid_name(strrchr(path, '/') + 1))
+    {
+        LOG(LEVEL_DEBUG, "Invalid Directory Name\n");
+        return 0;
     }
 
-    // Update time of last access
-    log_entry->inode.atime = time(NULL);
-
-    stbuf->st_uid = log_entry->inode.uid;
-    stbuf->st_gid = log_entry->inode.gid;
-    stbuf->st_atime = log_entry->inode.atime;
-    stbuf->st_mtime = log_entry->inode.mtime;
-    stbuf->st_mode = log_entry->inode.mode;
-    stbuf->st_nlink = log_entry->inode.links;
-    stbuf->st_size = log_entry->inode.size;
-
-    return 0;
+    return wfs_create_path(image, path, S_IFDIR);
 }
 
-// Function to create a regular file
-static int wfs_mknod(const char *path, mode_t mode, dev_t rdev)
+// Function to open a file, its path is only resolved here
+static int wfs_path_open(const char *path, struct fuse_file_info *fi)
 {
-    printf(">>mknod: %s\n", path);
+    LOG(LEVEL_TRACE, ">>open: %s\n", path);
     path = remove_pre_mount(path);
 
-    // Verify filename
-    if (!valid_name(get_bottom_level(path)))
-    {
-        printf("Invalid File Name\n");
-        return 0;
-    }
+    unsigned int inode_number;
+    int result = wfs_resolve(image, path, &inode_number);
+    if (result < 0)
+        return result;
 
-    // Verify file doesn't exist in its intended parent dir
-    if (!can_create(path))
-    {
-        printf("File Name Already In Use Locally.\n");
-        return -EEXIST;
-    }
+    struct wfs_file *file;
+    result = wfs_open(image, inode_number, fi->flags, &file);
+    if (result == 0)
+        set_open_file(fi, file);
 
-    // printf("mknod>>342\n");
-    // Create a new inode for the file
-    struct wfs_inode new_inode;
-    inode_count += 1;
-
-    new_inode.inode_number = inode_count;
-    new_inode.deleted = 0;
-    new_inode.mode = S_IFREG;
-    new_inode.uid = getuid();
-    new_inode.gid = getgid();
-    new_inode.flags = 0;
-    new_inode.size = sizeof(struct wfs_inode);
-    new_inode.atime = time(NULL);
-    new_inode.mtime = time(NULL);
-    new_inode.ctime = time(NULL);
-    new_inode.links = 1;
-
-    // printf("mknod>>359\n");
-    // Create a new dentry for the file
-    struct wfs_dentry *new_dentry = (struct wfs_dentry *)malloc(sizeof(struct wfs_dentry));
-    if (new_dentry != NULL)
-    {
-        // Copy the filename to the new_dentry->name using a function like strncpy
-        strncpy(new_dentry->name, get_bottom_level(path), MAX_FILE_NAME_LEN - 1);
-        new_dentry->name[MAX_FILE_NAME_LEN - 1] = '\0'; // Ensure null-termination
-        new_dentry->inode_number = new_inode.inode_number;
-    }
-    else
-    {
-        // Handle allocation failure
-    }
+    return result;
+}
 
-    // printf("mknod>>374\n");
-    // Get parent directory log entry
-    struct wfs_log_entry *old_log_entry = get_log_entry(snip_bottom_level(path), 0);
+// Function to create and open a regular file
+static int wfs_path_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    LOG(LEVEL_TRACE, ">>create: %s\n", path);
+    int result = wfs_path_mknod(path, mode, 0);
+    if (result < 0)
+        return result;
 
-    if(old_log_entry == NULL) {
-        printf("Log Entry Associated With Path Does Not Exist.\nPath: %s\n", path);
-        return -ENOENT;
-    }
+    return wfs_path_open(path, fi);
+}
 
-    // perform size bounds checking
-    // current size + size of copy of parent + size of new log entry
-    if ((total_size + old_log_entry->inode.size + sizeof(struct wfs_dentry) + sizeof(struct wfs_log_entry)) > MAX_SIZE) {
-        printf("Insufficient Disk Space to Perform Operation.\n");
-        return -ENOSPC;
-    }
+// Function to hand a file's buffered writes to the log, on every close of a descriptor
+static int wfs_path_flush(const char *path, struct fuse_file_info *fi)
+{
+    LOG(LEVEL_TRACE, ">>flush: %s\n", path);
 
-    // printf("mknod>>390\n");
-    // Make a copy of the old log entry and add the created dentry to its data field
-    struct wfs_log_entry *log_entry_copy = (struct wfs_log_entry *)malloc(old_log_entry->inode.size + sizeof(struct wfs_dentry));
-    if (log_entry_copy != NULL)
-    {
-        // printf("mknod>>395\n");
-        // copy the entire old log entry (including it's data field) to the new log entry
-        memcpy(log_entry_copy, old_log_entry, old_log_entry->inode.size);
+    return wfs_flush(image, wfs_file_inode(FILE_OF(fi)));
+}
 
-        // printf("dentry name: %s\n", new_dentry->name);
-        // printf("dentry inode number: %ld\n", new_dentry->inode_number);
-        // printf("base (%p) :: log_entry_copy (%p) :: log_entry_copy + size (%p) :: size of dentry (%ld) :: head (%p)\n", base, (char *)(log_entry_copy), (char *)(log_entry_copy) + log_entry_copy->inode.size, sizeof((char *)new_dentry), head);
+// Function to sync a file, as far as the durability mode goes
+static int wfs_path_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    LOG(LEVEL_TRACE, ">>fsync: %s\n", path);
 
-        // add the dentry to log_entry_copy's data and update new log entry's size
-        memcpy((char *)(log_entry_copy) + log_entry_copy->inode.size, new_dentry, sizeof(struct wfs_dentry));
-        log_entry_copy->inode.size += sizeof(struct wfs_dentry);
+    return wfs_fsync(image, wfs_file_inode(FILE_OF(fi)));
+}
 
-        // write the log entry copy to the log
-        memcpy(head, log_entry_copy, log_entry_copy->inode.size);
+// Function to close a file
+static int wfs_path_release(const char *path, struct fuse_file_info *fi)
+{
+    LOG(LEVEL_TRACE, ">>release: %s\n", path);
+    close_open_file(fi);
 
-        // update total size count
-        total_size += log_entry_copy->inode.size;
+    return 0;
+}
 
-        // update the head
-        head += log_entry_copy->inode.size;
-    }
-    else
-    {
-        // Handle allocation failure
-    }
+// Function to read data from an open file
+static int wfs_path_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    LOG(LEVEL_TRACE, ">>read: %s\n", path);
 
-    // Mark old log entry as deleted
-    old_log_entry->inode.deleted = 1;
+    return wfs_read(image, FILE_OF(fi), buf, size, offset);
+}
 
-    // Create a log entry for the file itself
-    struct wfs_log_entry *new_log_entry = (struct wfs_log_entry *)malloc(sizeof(struct wfs_log_entry));
-    if (new_log_entry != NULL)
-    {
-        // point the log entry at the created inode
-        // TODO should I use memcpy?
-        // memccpy(new_log_entry, &new_inode, new_inode.size);
-        new_log_entry->inode = new_inode;
+// Function to write data to an open file
+static int wfs_path_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    LOG(LEVEL_TRACE, ">>write: %s\n", path);
 
-        // add log entry to the log
-        memcpy(head, new_log_entry, new_log_entry->inode.size);
+    return wfs_pwrite(image, wfs_file_inode(FILE_OF(fi)), buf, size, offset);
+}
 
-        // update total size count
-        total_size += new_log_entry->inode.size;
+// Where wfs_path_readdir hands the names on to
+struct path_listing {
+    void *buf;
+    fuse_fill_dir_t filler;
+};
 
-        // update the head
-        head += new_log_entry->inode.size;
-    }
-    else
-    {
-        // Handle allocation failure
-    }
+static int fill_path_listing(void *context, const char *name, const struct stat *stbuf, off_t next_offset)
+{
+    struct path_listing *listing = context;
 
-    return 0;
+    return listing->filler(listing->buf, name, stbuf, next_offset);
 }
 
-// Function to create a directory
-static int wfs_mkdir(const char *path, mode_t mode)
+// Function to read directory entries
+static int wfs_path_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
 {
-    printf(">>mkdir: %s\n", path);
+    LOG(LEVEL_TRACE, ">>readdir: %s\n", path);
     path = remove_pre_mount(path);
 
+    unsigned int inode_number;
+    int result = wfs_resolve(image, path, &inode_number);
+    if (result < 0)
+        return result;
 
-    // Verify dir name
-    if (!valid_name(get_bottom_level(path)))
-    {
-        printf("Invalid Directory Name\n");
-        return 0;
-    }
+    struct path_listing listing = {buf, filler};
+    return wfs_readdir(image, inode_number, offset, fill_path_listing, &listing);
+}
 
-    // Verify file doesn't exist in its intended parent dir
-    if (!can_create(path))
-    {
-        printf("Directory Name Already In Use Locally.\n");
-        return -EEXIST;
-    }
+// Function to unlink (delete) a file
+static int wfs_path_unlink(const char *path)
+{
+    LOG(LEVEL_TRACE, ">>unlink: %s\n", path);
+    path = remove_pre_mount(path);
 
-    // create a new inode for the subdirectory
-    struct wfs_inode new_inode;
-    inode_count += 1;
-
-    new_inode.inode_number = inode_count;
-    new_inode.deleted = 0;
-    new_inode.mode = S_IFDIR;
-    new_inode.uid = getuid();
-    new_inode.gid = getgid();
-    new_inode.flags = 0;
-    new_inode.size = sizeof(struct wfs_inode);
-    new_inode.atime = time(NULL);
-    new_inode.mtime = time(NULL);
-    new_inode.ctime = time(NULL);
-    new_inode.links = 1;
-
-    // Create a new dentry for the directory
-    struct wfs_dentry *new_dentry = (struct wfs_dentry *)malloc(sizeof(struct wfs_dentry));
-    if (new_dentry != NULL)
-    {
-        // Copy the dirname to the new_dentry->name using a function like strncpy
-        strncpy(new_dentry->name, get_bottom_level(path), MAX_FILE_NAME_LEN - 1);
-        new_dentry->name[MAX_FILE_NAME_LEN - 1] = '\0'; // Ensure null-termination
-        new_dentry->inode_number = new_inode.inode_number;
-    }
-    else
-    {
-        // Handle allocation failure
-    }
+    return wfs_unlink_path(image, path);
+}
 
-    // Get parent directory log entry
-    struct wfs_log_entry *old_log_entry = get_log_entry(snip_bottom_level(path), 0);
+// The handlers as fuse_main calls them, timed for the statistics file
 
-    if(old_log_entry == NULL) {
-        printf("Log Entry Associated With Path Does Not Exist.\nPath: %s\n", path);
-        return -ENOENT;
-    }
+static int wfs_path_getattr_timed(const char *path, struct stat *stbuf)
+{
+    unsigned long start = wfs_stats_clock();
+    int result = wfs_path_getattr(path, stbuf);
 
+    wfs_count_op(OP_GETATTR, start, result);
+    return result;
+}
 
-    // perform size bounds checking
-    // current size + size of copy of parent + size of new log entry
-    if ((total_size + old_log_entry->inode.size + sizeof(struct wfs_dentry) + sizeof(struct wfs_log_entry)) > MAX_SIZE) {
-        printf("Insufficient Disk Space to Perform Operation.\n");
-        return -ENOSPC;
-    }
+static int wfs_path_mknod_timed(const char *path, mode_t mode, dev_t rdev)
+{
+    unsigned long start = wfs_stats_clock();
+    int result = wfs_path_mknod(path, mode, rdev);
 
-    // Make a copy of the old log entry and add the created dentry to its data field
-    struct wfs_log_entry *log_entry_copy = (struct wfs_log_entry *)malloc(old_log_entry->inode.size + sizeof(struct wfs_dentry));
-    if (log_entry_copy != NULL)
-    {
-        // copy the entire old log entry (including it's data field) to the new log entry
-        memcpy(log_entry_copy, old_log_entry, old_log_entry->inode.size);
+    wfs_count_op(OP_MKNOD, start, result);
+    return result;
+}
 
-        // add the dentry to log_entry_copy's data and update new log entry's size
-        memcpy((char *)(log_entry_copy) + log_entry_copy->inode.size, new_dentry, sizeof(struct wfs_dentry));
-        log_entry_copy->inode.size += sizeof(struct wfs_dentry);
+static int wfs_path_mkdir_timed(const char *path, mode_t mode)
+{
+    unsigned long start = wfs_stats_clock();
+    int result = wfs_path_mkdir(path, mode);
 
-        // write the log entry copy to the log
-        memcpy(head, log_entry_copy, log_entry_copy->inode.size);
+    wfs_count_op(OP_MKDIR, start, result);
+    return result;
+}
 
-        // update total size count
-        total_size += log_entry_copy->inode.size;
+static int wfs_path_open_timed(const char *path, struct fuse_file_info *fi)
+{
+    unsigned long start = wfs_stats_clock();
+    int result = wfs_path_open(path, fi);
 
-        // update the head
-        head += log_entry_copy->inode.size;
-    }
-    else
-    {
-        // Handle allocation failure
-    }
+    wfs_count_op(OP_OPEN, start, result);
+    return result;
+}
 
-    // Mark old log entry as deleted
-    old_log_entry->inode.deleted = 1;
+static int wfs_path_create_timed(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    unsigned long start = wfs_stats_clock();
+    int result = wfs_path_create(path, mode, fi);
 
-    // Create a log entry for the file itself
-    struct wfs_log_entry *new_log_entry = (struct wfs_log_entry *)malloc(sizeof(struct wfs_log_entry));
-    if (new_log_entry != NULL)
-    {
-        // point the log entry at the created inode -- this will create a shallow copy of values (not a problem)
-        new_log_entry->inode = new_inode;
+    wfs_count_op(OP_CREATE, start, result);
+    return result;
+}
 
-        // add log entry to the log
-        memcpy(head, new_log_entry, new_log_entry->inode.size);
+static int wfs_path_read_timed(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    unsigned long start = wfs_stats_clock();
+    int result = wfs_path_read(path, buf, size, offset, fi);
 
-        // update total size count
-        total_size += new_log_entry->inode.size;
+    wfs_count_op(OP_READ, start, result);
+    return result;
+}
 
-        // update the head
-        head += new_log_entry->inode.size;
-    }
-    else
-    {
-        // Handle allocation failure
-    }
+static int wfs_path_write_timed(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    unsigned long start = wfs_stats_clock();
+    int result = wfs_path_write(path, buf, size, offset, fi);
 
-    return 0;
+    wfs_count_op(OP_WRITE, start, result);
+    return result;
 }
 
-// Function to read data from a file
-static int wfs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+static int wfs_path_readdir_timed(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
 {
-    printf(">>read: %s\n", path);
-    path = remove_pre_mount(path);
+    unsigned long start = wfs_stats_clock();
+    int result = wfs_path_readdir(path, buf, filler, offset, fi);
 
-    // Grab log entry for desired file
-    struct wfs_log_entry *f = get_log_entry(path, 0);
+    wfs_count_op(OP_READDIR, start, result);
+    return result;
+}
 
-    if(f == NULL) {
-        printf("Log Entry Associated With Path Does Not Exist.\nPath: %s\n", path);
-        return -ENOENT;
-    }
+static int wfs_path_unlink_timed(const char *path)
+{
+    unsigned long start = wfs_stats_clock();
+    int result = wfs_path_unlink(path);
 
-    int data_size = f->inode.size - sizeof(struct wfs_log_entry);
+    wfs_count_op(OP_UNLINK, start, result);
+    return result;
+}
 
-    // Check if offset is too large
-    if (offset >= data_size)
-        return 0;
+static int wfs_path_fsync_timed(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    unsigned long start = wfs_stats_clock();
+    int result = wfs_path_fsync(path, datasync, fi);
 
-    // Read file data into buffer
-    memcpy(buf, f->data + offset, size);
-    f->inode.atime = time(NULL);
-    return size;
+    wfs_count_op(OP_FSYNC, start, result);
+    return result;
 }
 
-// Function to write data to a file
-static int wfs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
-{
-    printf(">>write: %s\n", path);
-    path = remove_pre_mount(path);
+static struct fuse_operations my_operations = {
+    .init = wfs_init,
+    .destroy = wfs_destroy,
+    .getattr = wfs_path_getattr_timed,
+    .mknod = wfs_path_mknod_timed,
+    .mkdir = wfs_path_mkdir_timed,
+    .open = wfs_path_open_timed,
+    .create = wfs_path_create_timed,
+    .flush = wfs_path_flush,
+    .release = wfs_path_release,
+    .fsync = wfs_path_fsync_timed,
+    .read = wfs_path_read_timed,
+    .write = wfs_path_write_timed,
+    .readdir = wfs_path_readdir_timed,
+    .unlink = wfs_path_unlink_timed,
+};
 
-    // Grab log entry for desired file
-    struct wfs_log_entry *f = get_log_entry(path, 0);
+#else
 
-    if(f == NULL) {
-        printf("Log Entry Associated With Path Does Not Exist.\nPath: %s\n", path);
-        return -ENOENT;
-    }
+////// LOW-LEVEL API ///////
 
-    // end of log entry - start of data field
-    int data_size = f->inode.size - sizeof(struct wfs_log_entry);
-    f->inode.atime = time(NULL);
+// The kernel knows inodes by node IDs, which are the st_ino libwfs reports: FUSE_ROOT_ID for the root
+#define NODE_INODE(node) WFS_INODE(node)
 
-    // Check if write exceeds current size of file data
-    if ((f->data + offset + size) >= (f->data + data_size))
-    {
-        // Set data_size to incorporate extra data
-        ptrdiff_t diff = (f->data + offset + size) - f->data;
-        data_size = (int)diff;
-    }
+// Seconds the kernel may cache names and attributes, nothing but this process changes them while mounted
+#define WFS_TIMEOUT 1.0
 
-    // Check if write wwould exceed disk space
-    if ((total_size + sizeof(struct wfs_log_entry) + data_size) > MAX_SIZE){
-        printf("Insufficient disk space\n");
-        return -ENOSPC;
-    }
+// Describe an inode found or created with a reference for the kernel in an entry
+void fill_entry(struct fuse_entry_param *entry, const struct stat *stbuf)
+{
+    memset(entry, 0, sizeof(struct fuse_entry_param));
+    entry->ino = stbuf->st_ino;
+    entry->attr_timeout = WFS_TIMEOUT;
+    entry->entry_timeout = WFS_TIMEOUT;
+    entry->attr = *stbuf;
+}
 
-    // allocate memory for a log entry copy
-    struct wfs_log_entry *log_entry_copy = (struct wfs_log_entry *)malloc(sizeof(struct wfs_log_entry) + data_size);
+// Reply with an entry or the error finding it. The kernel only takes the reference if the reply reaches it
+void reply_entry(fuse_req_t req, int result, struct fuse_entry_param *entry)
+{
+    if (result < 0)
+        fuse_reply_err(req, -result);
+    else if (fuse_reply_entry(req, entry) != 0)
+        wfs_forget(image, NODE_INODE(entry->ino), 1);
+}
 
-    // memcpy old log into copy
-    memcpy(log_entry_copy, f, f->inode.size);
+static void wfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    LOG(LEVEL_TRACE, ">>lookup: %lu %s\n", (unsigned long)parent, name);
+    unsigned long start = wfs_stats_clock();
+    struct fuse_entry_param entry;
+    struct stat stbuf;
+    int result = wfs_lookup(image, NODE_INODE(parent), name, &stbuf, WFS_HOLD);
+
+    if (result == 0)
+        fill_entry(&entry, &stbuf);
+    reply_entry(req, result, &entry);
+    wfs_count_op(OP_LOOKUP, start, result);
+}
 
-    // mark old log entry as deleted
-    f->inode.deleted = 1;
+static void wfs_ll_forget(fuse_req_t req, fuse_ino_t node, unsigned long nlookup)
+{
+    LOG(LEVEL_TRACE, ">>forget: %lu\n", (unsigned long)node);
+    wfs_forget(image, NODE_INODE(node), nlookup);
+    fuse_reply_none(req);
+}
 
-    // write buffer to offset of data
-    memcpy(log_entry_copy->data + offset, buf, size);
+static void wfs_ll_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets)
+{
+    LOG(LEVEL_TRACE, ">>forget_multi: %zu\n", count);
+    for (size_t i = 0; i < count; i++)
+        wfs_forget(image, NODE_INODE(forgets[i].ino), forgets[i].nlookup);
+    fuse_reply_none(req);
+}
 
-    // change size field of new entry to be updated size
-    log_entry_copy->inode.size += data_size;
+static void wfs_ll_getattr(fuse_req_t req, fuse_ino_t node, struct fuse_file_info *fi)
+{
+    LOG(LEVEL_TRACE, ">>getattr: %lu\n", (unsigned long)node);
+    unsigned long start = wfs_stats_clock();
+    struct stat stbuf;
+    int result = wfs_getattr(image, NODE_INODE(node), &stbuf);
 
-    // update modify time
-    log_entry_copy->inode.ctime = time(NULL);
-    log_entry_copy->inode.mtime = time(NULL);
+    if (result < 0)
+        fuse_reply_err(req, -result);
+    else
+        fuse_reply_attr(req, &stbuf, WFS_TIMEOUT);
+    wfs_count_op(OP_GETATTR, start, result);
+}
 
-    // add log entry to head
-    memcpy(head, log_entry_copy, log_entry_copy->inode.size);
+// Create a file or directory for the kernel, taking a reference on it
+int create_node(unsigned int parent_inode, const char *name, mode_t mode, struct fuse_entry_param *entry)
+{
+    struct stat stbuf;
+    int result = wfs_create(image, parent_inode, name, mode, &stbuf, WFS_HOLD);
 
-    // update total size count
-    total_size += log_entry_copy->inode.size;
+    if (result == 0)
+        fill_entry(entry, &stbuf);
+    return result;
+}
 
-    // update head
-    head += log_entry_copy->inode.size;
+static void wfs_ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
+{
+    LOG(LEVEL_TRACE, ">>mknod: %lu %s\n", (unsigned long)parent, name);
+    unsigned long start = wfs_stats_clock();
+    struct fuse_entry_param entry;
+    int result = create_node(NODE_INODE(parent), name, S_IFREG, &entry);
 
-    return size;
+    reply_entry(req, result, &entry);
+    wfs_count_op(OP_MKNOD, start, result);
 }
 
-// Function to read directory entries
-static int wfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
+static void wfs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
 {
-    printf(">>readdir: %s\n", path);
-    path = remove_pre_mount(path);
+    LOG(LEVEL_TRACE, ">>mkdir: %lu %s\n", (unsigned long)parent, name);
+    unsigned long start = wfs_stats_clock();
+    struct fuse_entry_param entry;
+    int result = create_node(NODE_INODE(parent), name, S_IFDIR, &entry);
 
-    struct wfs_log_entry *dir_log_entry = get_log_entry(path, 0);
+    reply_entry(req, result, &entry);
+    wfs_count_op(OP_MKDIR, start, result);
+}
 
-    if(dir_log_entry == NULL) {
-        printf("Log Entry Associated With Path Does Not Exist.\nPath: %s\n", path);
-        return -ENOENT;
-    }
+static void wfs_ll_open(fuse_req_t req, fuse_ino_t node, struct fuse_file_info *fi)
+{
+    LOG(LEVEL_TRACE, ">>open: %lu\n", (unsigned long)node);
+    unsigned long start = wfs_stats_clock();
+    struct wfs_file *file;
+    int result = wfs_open(image, NODE_INODE(node), fi->flags, &file);
+
+    if (result == 0)
+        set_open_file(fi, file);
+
+    if (result < 0)
+        fuse_reply_err(req, -result);
+    else if (fuse_reply_open(req, fi) != 0)
+        close_open_file(fi);
+    wfs_count_op(OP_OPEN, start, result);
+}
 
-    dir_log_entry->inode.atime = time(NULL);
+static void wfs_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi)
+{
+    LOG(LEVEL_TRACE, ">>create: %lu %s\n", (unsigned long)parent, name);
+    unsigned long start = wfs_stats_clock();
+    struct fuse_entry_param entry;
+    struct wfs_file *file;
+    int result = create_node(NODE_INODE(parent), name, S_IFREG, &entry);
 
-    // incorporate offset as multiple of dentry's
-    char *data_addr = dir_log_entry->data + (offset * sizeof(struct wfs_dentry));
+    // the reference keeps it around to be opened even if it is unlinked in between
+    if (result == 0)
+    {
+        result = wfs_open(image, NODE_INODE(entry.ino), fi->flags, &file);
+        if (result < 0)
+            wfs_forget(image, NODE_INODE(entry.ino), 1);
+        else
+            set_open_file(fi, file);
+    }
 
-    // iterate over all dentries
-    while (data_addr != (char *)(dir_log_entry) + dir_log_entry->inode.size)
+    // the kernel neither takes the reference nor opens the file if the reply doesn't reach it
+    if (result < 0)
+        fuse_reply_err(req, -result);
+    else if (fuse_reply_create(req, &entry, fi) != 0)
     {
-        struct wfs_dentry *curr_dentry = (struct wfs_dentry *)data_addr;
+        close_open_file(fi);
+        wfs_forget(image, NODE_INODE(entry.ino), 1);
+    }
+    wfs_count_op(OP_CREATE, start, result);
+}
 
-        size_t len1 = strlen(path);
-        size_t len2 = strlen(curr_dentry->name);
-        size_t totalLength = len1 + len2;
+// Closing a descriptor is when errors in buffered writes can still be reported
+static void wfs_ll_flush(fuse_req_t req, fuse_ino_t node, struct fuse_file_info *fi)
+{
+    LOG(LEVEL_TRACE, ">>flush: %lu\n", (unsigned long)node);
+    fuse_reply_err(req, -wfs_flush(image, NODE_INODE(node)));
+}
 
-        // Allocate memory for the new string
-        char *total_path = (char *)malloc(totalLength + 1); // +1 for the null terminator
+// Syncing goes as far as the durability mode says
+static void wfs_ll_fsync(fuse_req_t req, fuse_ino_t node, int datasync, struct fuse_file_info *fi)
+{
+    LOG(LEVEL_TRACE, ">>fsync: %lu\n", (unsigned long)node);
+    unsigned long start = wfs_stats_clock();
+    int result = wfs_fsync(image, NODE_INODE(node));
 
-        if (total_path == NULL)
-        {
-            // Handle memory allocation failure
-            return -1;
-        }
+    fuse_reply_err(req, -result);
+    wfs_count_op(OP_FSYNC, start, result);
+}
 
-        // Copy the contents of the original strings to the new string
-        strcpy(total_path, path);
-        strcpy(total_path + len1, curr_dentry->name);
+static void wfs_ll_release(fuse_req_t req, fuse_ino_t node, struct fuse_file_info *fi)
+{
+    LOG(LEVEL_TRACE, ">>release: %lu\n", (unsigned long)node);
+    close_open_file(fi);
+    fuse_reply_err(req, 0);
+}
 
-        struct wfs_log_entry *curr_log_entry = get_log_entry(total_path, 0);
+static void wfs_ll_read(fuse_req_t req, fuse_ino_t node, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    LOG(LEVEL_TRACE, ">>read: %lu\n", (unsigned long)node);
+    unsigned long start = wfs_stats_clock();
+    struct fuse_bufvec *bufv = wfs_map(image, FILE_OF(fi), size, offset, splice_reads);
 
-        if(curr_log_entry == NULL) {
-            printf("Log Entry Associated With Path Does Not Exist.\nPath: %s\n", path);
-            return -ENOENT;
-        }
+    if (bufv == NULL)
+    {
+        fuse_reply_err(req, ENOENT);
+        wfs_count_op(OP_READ, start, -ENOENT);
+        return;
+    }
 
-        // Update time of last access
-        curr_log_entry->inode.atime = time(NULL);
-
-        // create a struct stat for the log entry
-        struct stat stbuf;
-        // populate stat struct
-        stbuf.st_uid = curr_log_entry->inode.uid;
-        stbuf.st_gid = curr_log_entry->inode.gid;
-        stbuf.st_atime = curr_log_entry->inode.atime;
-        stbuf.st_mtime = curr_log_entry->inode.mtime;
-        stbuf.st_mode = curr_log_entry->inode.mode;
-        stbuf.st_nlink = curr_log_entry->inode.links;
-        stbuf.st_size = curr_log_entry->inode.size;
-
-        offset += sizeof(struct wfs_dentry);
-        if (filler(buf, curr_dentry->name, &stbuf, offset) != 0)
-        {
-            return 0;
-        }
+    // the reply goes out straight from the log, so the cleaner has to wait until it is sent
+    if (bufv->count == 0)
+        fuse_reply_buf(req, NULL, 0);
+    else
+        fuse_reply_data(req, bufv, FUSE_BUF_SPLICE_MOVE);
+    wfs_unmap(image, bufv);
+    wfs_count_op(OP_READ, start, 0);
+}
 
-        data_addr += sizeof(struct wfs_dentry);
-    }
+static void wfs_ll_write_buf(fuse_req_t req, fuse_ino_t node, struct fuse_bufvec *bufv, off_t offset, struct fuse_file_info *fi)
+{
+    LOG(LEVEL_TRACE, ">>write_buf: %lu\n", (unsigned long)node);
+    unsigned long start = wfs_stats_clock();
+    int result = wfs_write_buf(image, NODE_INODE(node), bufv, offset);
 
-    return 0;
+    if (result < 0)
+        fuse_reply_err(req, -result);
+    else
+        fuse_reply_write(req, result);
+    wfs_count_op(OP_WRITE, start, result);
 }
 
-// Function to unlink (delete) a file
-static int wfs_unlink(const char *path)
+// A reply buffer being packed with the names of a directory
+struct ll_listing {
+    fuse_req_t req;
+    char *buf;
+    size_t size;
+    size_t used;
+};
+
+// Pack a name into the reply, the kernel only takes the inode number and file type from the attributes
+static int fill_ll_listing(void *context, const char *name, const struct stat *stbuf, off_t next_offset)
 {
-    printf(">>unlink: %s\n", path);
-    path = remove_pre_mount(path);
+    struct ll_listing *listing = context;
+    size_t entry_size = fuse_add_direntry(listing->req, listing->buf + listing->used, listing->size - listing->used, name, stbuf, next_offset);
 
-    // get parent log entry
-    struct wfs_log_entry *parent_log_entry = get_log_entry(snip_bottom_level(path), 0);
+    if (entry_size > listing->size - listing->used)
+        return 1;
+    listing->used += entry_size;
+    return 0;
+}
 
-    if(parent_log_entry == NULL) {
-        printf("Log Entry Associated With Path Does Not Exist.\nPath: %s\n", path);
-        return -ENOENT;
+static void wfs_ll_readdir(fuse_req_t req, fuse_ino_t node, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    LOG(LEVEL_TRACE, ">>readdir: %lu\n", (unsigned long)node);
+    unsigned long start = wfs_stats_clock();
+    struct ll_listing listing = {req, malloc(size), size, 0};
+    if (listing.buf == NULL)
+    {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
     }
 
-    parent_log_entry->inode.atime = time(NULL);
+    int result = wfs_readdir(image, NODE_INODE(node), offset, fill_ll_listing, &listing);
 
-    // perform size bounds checking
-    // current size + size of copy of parent
-    if ((total_size + parent_log_entry->inode.size - sizeof(struct wfs_dentry)) > MAX_SIZE) {
-        printf("Insufficient Disk Space to Perform Operation.\n");
-        return -ENOSPC;
-    }
+    if (result < 0)
+        fuse_reply_err(req, -result);
+    else
+        fuse_reply_buf(req, listing.buf, listing.used);
+    free(listing.buf);
+    wfs_count_op(OP_READDIR, start, result);
+}
+
+static void wfs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    LOG(LEVEL_TRACE, ">>unlink: %lu %s\n", (unsigned long)parent, name);
+    unsigned long start = wfs_stats_clock();
+    int result = wfs_unlink(image, NODE_INODE(parent), name);
 
-    // get target log entry
-    struct wfs_log_entry *log_entry = get_log_entry(path, 0);
+    fuse_reply_err(req, -result);
+    wfs_count_op(OP_UNLINK, start, result);
+}
 
-    if(log_entry == NULL) {
-        printf("Log Entry Associated With Path Does Not Exist.\nPath: %s\n", path);
-        return -ENOENT;
+static void wfs_ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+    if (conn->capable & FUSE_CAP_SPLICE_WRITE)
+    {
+        conn->want |= FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE;
+        splice_reads = 1;
     }
 
-    log_entry->inode.atime = time(NULL);
+    // written bytes can stay in the FUSE device's pipe until write_extent takes them into the log
+    if (conn->capable & FUSE_CAP_SPLICE_READ)
+        conn->want |= FUSE_CAP_SPLICE_READ;
+
+    wfs_init(conn);
+}
+
+static void wfs_ll_destroy(void *userdata)
+{
+    wfs_destroy(userdata);
+}
+
+static struct fuse_lowlevel_ops my_ll_operations = {
+    .init = wfs_ll_init,
+    .destroy = wfs_ll_destroy,
+    .lookup = wfs_ll_lookup,
+    .forget = wfs_ll_forget,
+    .forget_multi = wfs_ll_forget_multi,
+    .getattr = wfs_ll_getattr,
+    .mknod = wfs_ll_mknod,
+    .mkdir = wfs_ll_mkdir,
+    .open = wfs_ll_open,
+    .create = wfs_ll_create,
+    .flush = wfs_ll_flush,
+    .release = wfs_ll_release,
+    .fsync = wfs_ll_fsync,
+    .read = wfs_ll_read,
+    .write_buf = wfs_ll_write_buf,
+    .readdir = wfs_ll_readdir,
+    .unlink = wfs_ll_unlink,
+};
+
+// Serve the mount through the low-level API, taking the same options fuse_main does.
+// Returns 0 once unmounted, -1 if it couldn't be mounted
+int fuse_main_lowlevel(int argc, char *argv[])
+{
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    char *fuse_mount_point;
+    int multithreaded, foreground;
+    int result = -1;
 
-    // mark file log entry as deleted
-    log_entry->inode.deleted = 1;
-    // decrement inode links count
-    log_entry->inode.links -= 1;
-    // update inode change time
-    log_entry->inode.ctime = time(NULL);
+    if (fuse_parse_cmdline(&args, &fuse_mount_point, &multithreaded, &foreground) == -1)
+        return -1;
 
-    // Make a copy of the old parent log entry and remove the files dentry from the new data member (don't copy it over)
-    struct wfs_log_entry *log_entry_copy = (struct wfs_log_entry *)malloc(parent_log_entry->inode.size - sizeof(struct wfs_dentry));
-    if (log_entry_copy != NULL)
+    struct fuse_chan *channel = fuse_mount(fuse_mount_point, &args);
+    if (channel != NULL)
     {
-        // find the address offset of the dentry for this file
-        char *data_addr = parent_log_entry->data;
-        // iterate over all dentry's
-        while (data_addr != (char *)(parent_log_entry) + parent_log_entry->inode.size)
+        struct fuse_session *session = fuse_lowlevel_new(&args, &my_ll_operations, sizeof(my_ll_operations), NULL);
+        if (session != NULL)
         {
-            // check the inode number against the target log entry (deleted file)
-            if (((struct wfs_dentry *)data_addr)->inode_number == log_entry->inode.inode_number)
+            if (fuse_set_signal_handlers(session) != -1)
             {
-                break;
-            }
-            data_addr += sizeof(struct wfs_dentry);
-        }
+                fuse_session_add_chan(session, channel);
 
-        // memcpy up to target file's dentry to delete
-        memcpy(log_entry_copy, parent_log_entry, data_addr - (char *)(parent_log_entry));
+                // the cleaner starts in init, once this has forked into the background
+                fuse_daemonize(foreground);
+                result = multithreaded ? fuse_session_loop_mt(session) : fuse_session_loop(session);
 
-        // memcpy after the deleted dentry -- if this check does not hit, it means the deleted file was the last dentry of the parent log entry
-        if (data_addr != ((char *)(parent_log_entry) + parent_log_entry->inode.size - sizeof(struct wfs_dentry)))
-        {
-            // the start of the remaining data portion of the copy of the parent's log entry
-            char *data_start_addr = (char *)(log_entry_copy) + (data_addr - (char *)(parent_log_entry));
-            // the address of the remaining data in the original parent (after the deleted target file's dentry)
-            char *parent_after_data_addr = data_addr + sizeof(struct wfs_dentry);
-            // the size remaining after the child's dentry
-            uint parent_remaining_size = (char *)(parent_log_entry) + parent_log_entry->inode.size - parent_after_data_addr;
-
-            memcpy(data_start_addr, parent_after_data_addr, parent_remaining_size);
+                fuse_remove_signal_handlers(session);
+                fuse_session_remove_chan(channel);
+            }
+            fuse_session_destroy(session);
         }
-        // mark parent as deleted
-        parent_log_entry->inode.deleted = 1;
-        // update size of the new log entry
-        log_entry_copy->inode.size -= sizeof(struct wfs_dentry);
-
-        // write the log entry copy to the log
-        memcpy(head, log_entry_copy, log_entry_copy->inode.size);
-
-        // update total size count
-        total_size += log_entry_copy->inode.size;
-
-        // update the head
-        head += log_entry_copy->inode.size;
-    }
-    else
-    {
-        // Handle allocation failure
+        fuse_unmount(fuse_mount_point, channel);
     }
 
-    return 0;
+    free(fuse_mount_point);
+    fuse_opt_free_args(&args);
+    return result;
 }
 
-static struct fuse_operations my_operations = {
-    .getattr = wfs_getattr,
-    .mknod = wfs_mknod,
-    .mkdir = wfs_mkdir,
-    .read = wfs_read,
-    .write = wfs_write,
-    .readdir = wfs_readdir,
-    .unlink = wfs_unlink,
+#endif
+
+// Keys of -o loglevel=, durability=, sync_interval= and storage=, the others are the atime mode they choose
+#define OPTION_LOG_LEVEL 100
+#define OPTION_DURABILITY 101
+#define OPTION_SYNC_INTERVAL 102
+#define OPTION_STORAGE 103
+
+// Mount options of our own
+static struct fuse_opt wfs_options[] = {
+    FUSE_OPT_KEY("strictatime", ATIME_STRICT),
+    FUSE_OPT_KEY("relatime", ATIME_RELATIVE),
+    FUSE_OPT_KEY("noatime", ATIME_NONE),
+    FUSE_OPT_KEY("loglevel=", OPTION_LOG_LEVEL),
+    FUSE_OPT_KEY("durability=", OPTION_DURABILITY),
+    FUSE_OPT_KEY("sync_interval=", OPTION_SYNC_INTERVAL),
+    FUSE_OPT_KEY("storage=", OPTION_STORAGE),
+    FUSE_OPT_END
 };
 
-int main(int argc, char *argv[])
+// Take our options out of the FUSE options, returns 1 to pass an option on to libfuse
+static int wfs_option(void *data, const char *arg, int key, struct fuse_args *outargs)
 {
-    if (argc < 4)
+    if (key < 0)
+        return 1;
+
+    if (key == OPTION_LOG_LEVEL)
     {
-        fprintf(stderr, "Usage: %s [FUSE options] disk_path mount_point\n", argv[0]);
-        exit(EXIT_FAILURE);
+        const char *level = arg + strlen("loglevel=");
+        for (int i = LEVEL_ERROR; i <= LEVEL_TRACE; i++)
+        {
+            if (strcmp(level, wfs_level_name(i)) == 0)
+            {
+                if (i > WFS_LOG_LEVEL)
+                    fprintf(stderr, "Messages above %s are compiled out\n", wfs_level_name(WFS_LOG_LEVEL));
+                wfs_set_log_level(i);
+                return 0;
+            }
+        }
+        fprintf(stderr, "Unknown log level %s\n", level);
+        return -1;
     }
 
-    // Parse disk_path and mount_point from the command line arguments
-    disk_path = argv[argc - 2];
-    mount_point = argv[argc - 1];
-
-    int fd;
-
-    // Open file descriptor for file to init system with
-    fd = open(disk_path, O_RDWR, 0666);
-    if (fd == -1)
+    if (key == OPTION_DURABILITY)
     {
-        perror("Error opening file");
-        exit(EXIT_FAILURE);
+        const char *mode = arg + strlen("durability=");
+        for (int i = DURABILITY_NONE; i <= DURABILITY_FSYNC; i++)
+        {
+            if (strcmp(mode, wfs_durability_name(i)) == 0)
+            {
+                wfs_set_durability(i);
+                return 0;
+            }
+        }
+        fprintf(stderr, "Unknown durability %s\n", mode);
+        return -1;
     }
 
-    // Get file info (for file size)
-    struct stat file_stat;
-    if (fstat(fd, &file_stat) == -1)
+    if (key == OPTION_SYNC_INTERVAL)
     {
-        perror("fstat");
-        close(fd);
-        exit(EXIT_FAILURE);
+        char *end;
+        long interval = strtol(arg + strlen("sync_interval="), &end, 10);
+        if (*end != '\0' || interval <= 0 || interval > 3600 * 1000)
+        {
+            fprintf(stderr, "Bad sync interval %s, milliseconds expected\n", arg + strlen("sync_interval="));
+            return -1;
+        }
+        wfs_set_sync_interval(interval);
+        return 0;
     }
 
-    base = mmap(NULL, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
-                fd, 0);
-    // Check for errors in mmap
-    if (base == MAP_FAILED)
+    if (key == OPTION_STORAGE)
     {
-        // TODO Handle error
+        const char *backend = arg + strlen("storage=");
+        for (int i = STORAGE_MMAP; i <= STORAGE_URING; i++)
+        {
+            if (strcmp(backend, wfs_storage_name(i)) == 0)
+            {
+                wfs_set_storage(i);
+                return 0;
+            }
+        }
+        fprintf(stderr, "Unknown storage %s\n", backend);
         return -1;
     }
 
-    // Cast superblock
-    superblock = (struct wfs_sb *)base;
+    wfs_set_atime_mode(key);
+
+    // the kernel knows noatime as well, the others only mean something here
+    return key == ATIME_NONE;
+}
 
-    // Check magic number
-    if (superblock->magic != WFS_MAGIC)
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
     {
-        return -1;
+        fprintf(stderr, "Usage: %s [FUSE options] disk_path mount_point\n", argv[0]);
+        exit(EXIT_FAILURE);
     }
 
-    // Store head global
-    head = base + superblock->head;
+    // Parse disk_path and mount_point from the command line arguments
+    disk_path = argv[argc - 2];
+    mount_point = argv[argc - 1];
 
     // FUSE options are passed to fuse_main, starting from argv[1]
     argv[argc-2] = argv[argc-1];
     argv[argc-1] = NULL;
     argc--;
 
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    if (fuse_opt_parse(&args, NULL, wfs_options, wfs_option) == -1)
+        return -1;
+
+    // Open the image once the log level is known, for what loading it reports
+    image = wfs_open_image(disk_path);
+    if (image == NULL)
+    {
+        perror("Error opening image");
+        exit(EXIT_FAILURE);
+    }
+
+#ifdef WFS_PATH_API
     // Call fuse_main with your FUSE operations and data
-    fuse_main(argc, argv, &my_operations, NULL);
+    fuse_main(args.argc, args.argv, &my_operations, NULL);
+#else
+    fuse_main_lowlevel(args.argc, args.argv);
+#endif
+    fuse_opt_free_args(&args);
 
-    munmap(base, file_stat.st_size);
+    wfs_close_image(image);
 
     return 0;
 }
@@ -6,15 +6,36 @@
 
 #define MAX_FILE_NAME_LEN 32
 #define WFS_MAGIC 0xdeadbeef
-#define MAX_SIZE 1000000
+#define WFS_VERSION 4
+
+// Images from before checkpoints had only magic and head, with the log starting right after them
+#define WFS_LEGACY_SB_SIZE (2 * sizeof(uint32_t))
 
 struct wfs_sb {
     uint32_t magic;
-    uint32_t head;
+    uint32_t legacy_head;       // head of legacy images, whose superblock ends here
+    uint32_t version;           // on-disk format revision, 0 for legacy images
+    uint32_t generation;        // bumped by fsck.wfs whenever it moves log entries
+    uint64_t head;              // offset the next log entry is appended at
+    uint64_t disk_size;         // bytes of the image the filesystem was made for
+    uint64_t checkpoint[2];     // offsets of the two most recent checkpoint entries (0 if unused)
+    uint32_t segment_size;      // bytes per log segment, segments follow the superblock back to back
+    uint32_t segment_count;
 };
 
-extern int inode_count;
-extern int total_size;
+// Default segment size, mkfs.wfs shrinks it for images too small to hold one and grows it
+// for images so large they would need more than WFS_MAX_SEGMENTS
+#define WFS_SEGMENT_SIZE (64 * 1024)
+#define WFS_MAX_SEGMENTS (64 * 1024)
+#define WFS_SEGMENT_MAGIC 0x5e65e600
+
+// Header at the start of every segment in use. Log entries never cross segment
+// boundaries and the log continues in the segment with the next higher sequence
+struct wfs_segment {
+    uint32_t magic;             // WFS_SEGMENT_MAGIC, anything else marks a free segment
+    uint32_t sequence;          // position of the segment in the log, 1 for the first
+    uint32_t created;           // time the segment was started, the cleaner prefers old ones
+};
 
 struct wfs_inode {
     unsigned int inode_number;
@@ -40,4 +61,57 @@ struct wfs_log_entry {
     char data[];
 };
 
+// Kind of a log entry, kept in inode.flags
+#define WFS_ENTRY_INODE 0
+#define WFS_ENTRY_CHECKPOINT 1
+#define WFS_ENTRY_EXTENT 2
+#define WFS_ENTRY_DENTRY_ADD 3      // data is one wfs_dentry added to the directory
+#define WFS_ENTRY_DENTRY_REMOVE 4   // data is one wfs_dentry removed from the directory
+#define WFS_ENTRY_PADDING 5         // space reserved for an entry that was still being copied in, holds nothing
+#define WFS_ENTRY_ATTRIBUTES 6      // no data, only new attributes for the inode
+
+// Inode number carried by log entries that don't belong to any inode
+#define WFS_NO_INODE 0xffffffff
+
+// Data of an extent entry: bytes written to a file at some offset. Its inode
+// carries the file's attributes as of the write, inode.size is the entry size
+struct wfs_extent {
+    uint64_t file_size;         // size of the file once the write is applied
+    uint64_t offset;            // file offset of the first byte of data
+    uint64_t length;            // number of bytes in data
+    char data[];
+};
+
+// Data of a checkpoint entry: the live log entries and counters at some point, so
+// mount only has to replay those and the entries appended after the checkpoint.
+// A checkpoint too large for the room left in a segment is split into parts, each
+// one an entry of its own, chained back to the first; the superblock points at the last
+struct wfs_checkpoint {
+    uint32_t version;           // incremented by every checkpoint, the higher valid one wins
+    uint32_t checksum;          // wfs_checksum() over the whole entry with this field zeroed
+    uint64_t head;              // log position the snapshot covers, roll forward from here (last part only)
+    uint64_t live_size;         // bytes of the log held by live entries
+    uint64_t previous;          // offset of the part before this one, 0 for the first
+    uint32_t inode_count;       // highest inode number handed out so far
+    uint32_t part;              // index of this part, from 0
+    uint32_t entry_count;       // number of offsets that follow in this part
+    uint32_t reserved;          // 0
+    uint64_t entries[];         // offsets of the live log entries in log order, 0 slots are skipped
+};
+
+// FNV-1a, used to validate checkpoints
+static inline uint32_t wfs_checksum(const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
 #endif